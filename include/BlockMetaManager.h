@@ -1,160 +1,329 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "common.h"
 #include "io/file.h"
+#include "struct/ColumnValue.h"
 #include "struct/Vin.h"
 #include "util/defer.h"
 #include "util/logging.h"
 
 namespace LindormContest {
 
+// 一个block的元数据，定长的头部后面紧跟着变长部分，不含指针，持久化的时候整体拷贝
+//   extent: [column_num + 1]，每一列在段内相对base_off的偏移和压缩后的大小，最后一个是时间戳列
+//   stat:   只有数值列有，按列的实际类型存放，位置由BlockLayout决定
+// 解压之后的大小由行数和列类型推出，string列的由zstd的帧头记录，都不再单独存
 struct BlockMeta {
-  BlockMeta* next;
-  int num; // 一共写了多少行数据
+  struct Extent {
+    uint32_t off; // 相对base_off的偏移
+    uint32_t len; // 压缩之后的大小
+  };
+
+  uint16_t num; // 一共写了多少行数据
+  uint16_t column_num;
+  uint32_t segment; // 数据所在的段文件
   int64_t min_ts;
   int64_t max_ts;
+  uint64_t base_off; // 开始写这个block时段的写入位置，各列的偏移都不小于它
+
+  uint64_t Offset(int colid) const { return base_off + extents()[colid].off; }
+  uint32_t CompressSz(int colid) const { return extents()[colid].len; }
 
-  uint64_t max_val[kColumnNum];
-  uint64_t sum_val[kColumnNum];
+  void SetExtent(int colid, uint64_t off, uint64_t len) {
+    LOG_ASSERT(off >= base_off && off - base_off <= UINT32_MAX && len <= UINT32_MAX,
+               "column %d extent [%lu, +%lu) out of range, base %lu", colid, off, len, base_off);
+    extents()[colid] = {(uint32_t)(off - base_off), (uint32_t)len};
+  }
 
-  // 每一列对应的块的元数据
-  uint64_t compress_sz[kColumnNum + kExtraColNum];
-  uint64_t origin_sz[kColumnNum + kExtraColNum];
-  uint64_t offset[kColumnNum + kExtraColNum];
+  char* Stats() { return reinterpret_cast<char*>(extents() + column_num + 1); }
+  const char* Stats() const { return reinterpret_cast<const char*>(extents() + column_num + 1); }
+
+private:
+  Extent* extents() { return reinterpret_cast<Extent*>(this + 1); }
+  const Extent* extents() const { return reinterpret_cast<const Extent*>(this + 1); }
+};
+static_assert(sizeof(BlockMeta) == 32, "BlockMeta header should stay compact");
+static_assert(std::is_trivially_copyable<BlockMeta>::value, "BlockMeta is persisted by memcpy");
+
+// 下刷之前MemTable统计的每一列的值，和列的类型无关，每列都按uint64_t存放（int列的max/min/first/last在低4字节）
+// 行数和first/last对应的时间戳就是BlockMeta中的num、min_ts和max_ts，不再单独存
+struct ColumnStats {
+  std::vector<uint64_t> sum_val;
+  std::vector<uint64_t> max_val;
+  std::vector<uint64_t> min_val;
+  std::vector<uint64_t> first_val; // 时间戳最小的一行
+  std::vector<uint64_t> last_val;  // 时间戳最大的一行
+
+  void Reset(int column_num) {
+    for (auto vals : {&sum_val, &max_val, &min_val, &first_val, &last_val}) {
+      vals->assign(column_num, 0);
+    }
+  }
 };
 
 /**
- * 每一个Shard都有一个元数据管理器，存储了每一个Shard下刷的所有的Block的元数据信息
+ * 由schema决定的BlockMeta变长部分的布局，同一张表的所有block共用
+ * 每个数值列一个统计槽：sum在前占8字节（int列为int64，double列为double），
+ * 之后是max、min、first、last，按列的类型各占4或8字节
+ * 槽是紧密排列的，读写都用memcpy，不要求对齐
  */
-// TODO: 重构，把kShardNum 去掉
-class BlockMetaManager {
+class BlockLayout {
 public:
-  BlockMeta* NewVinBlockMeta(int num, int64_t min_ts, int64_t max_ts, uint64_t max_val[kColumnNum], uint64_t sum_val[kColumnNum]) {
-    BlockMeta* blk_meta = new BlockMeta();
-    LOG_ASSERT(blk_meta != nullptr, "blk_meta == nullptr");
-    blk_meta->num = num;
-    blk_meta->min_ts = min_ts;
-    blk_meta->max_ts = max_ts;
-    for (int i = 0; i < kColumnNum; i++) {
-      blk_meta->max_val[i] = max_val[i];
-      blk_meta->sum_val[i] = sum_val[i];
+  void Build(const ColumnType* types, int column_num) {
+    column_num_ = column_num;
+    stat_off_.assign(column_num, -1);
+    val_sz_.assign(column_num, 0);
+    int off = 0;
+    for (int i = 0; i < column_num; i++) {
+      if (types[i] == COLUMN_TYPE_INTEGER || types[i] == COLUMN_TYPE_DOUBLE_FLOAT) {
+        stat_off_[i] = off;
+        val_sz_[i] = types[i] == COLUMN_TYPE_INTEGER ? sizeof(int32_t) : sizeof(double);
+        off += sizeof(uint64_t) + kValStatNum * val_sz_[i];
+      }
     }
+    size_t sz = sizeof(BlockMeta) + sizeof(BlockMeta::Extent) * (column_num + 1) + off;
+    stride_ = (sz + 7) & ~(size_t)7;
+  }
+
+  int ColumnNum() const { return column_num_; }
+
+  // 一个BlockMeta占用的字节数，8字节对齐，manifest中的block也按这个间隔存放
+  size_t Stride() const { return stride_; }
 
-    blk_meta->next = nullptr;
-    block_cnts_++;
+  bool HasStat(int colid) const { return stat_off_[colid] >= 0; }
 
-    if (head_ == nullptr) {
-      head_ = blk_meta;
-    } else {
-      // 头插法
-      blk_meta->next = head_;
-      head_ = blk_meta;
+  // 以下T为列的类型，int或者double
+  template <typename T>
+  T Max(const BlockMeta* meta, int colid) const {
+    return val<T>(meta, colid, kMax);
+  }
+
+  template <typename T>
+  T Min(const BlockMeta* meta, int colid) const {
+    return val<T>(meta, colid, kMin);
+  }
+
+  template <typename T>
+  T First(const BlockMeta* meta, int colid) const {
+    return val<T>(meta, colid, kFirst);
+  }
+
+  template <typename T>
+  T Last(const BlockMeta* meta, int colid) const {
+    return val<T>(meta, colid, kLast);
+  }
+
+  // T为累加的类型，int64_t或者double
+  template <typename T>
+  T Sum(const BlockMeta* meta, int colid) const {
+    T res;
+    memcpy(&res, meta->Stats() + stat_off_[colid], sizeof(T));
+    return res;
+  }
+
+  // 按列的实际类型压缩存放
+  void PackStats(BlockMeta* meta, const ColumnStats& stats) const {
+    char* buf = meta->Stats();
+    for (int i = 0; i < column_num_; i++) {
+      if (stat_off_[i] < 0) continue;
+      char* slot = buf + stat_off_[i];
+      memcpy(slot, &stats.sum_val[i], sizeof(uint64_t));
+      slot += sizeof(uint64_t);
+      for (auto vals : {&stats.max_val, &stats.min_val, &stats.first_val, &stats.last_val}) {
+        memcpy(slot, &(*vals)[i], val_sz_[i]);
+        slot += val_sz_[i];
+      }
     }
+  }
+
+private:
+  // sum之后按列类型存放的统计值，顺序和PackStats一致
+  enum ValStat { kMax, kMin, kFirst, kLast, kValStatNum };
+
+  template <typename T>
+  T val(const BlockMeta* meta, int colid, ValStat which) const {
+    T res;
+    memcpy(&res, meta->Stats() + stat_off_[colid] + sizeof(uint64_t) + which * sizeof(T), sizeof(T));
+    return res;
+  }
+
+  int column_num_{0};
+  size_t stride_{0};
+  std::vector<int> stat_off_; // 统计槽相对Stats()的偏移，string列为-1
+  std::vector<uint8_t> val_sz_;
+};
+
+// BlockMeta的分配区，按大块申请，block不会单独释放，分配区析构的时候一起释放
+// 只在所属shard的调度线程上使用，不加锁
+class BlockMetaArena {
+public:
+  static constexpr size_t kChunkSize = 1 * MB;
+
+  BlockMetaArena() = default;
+  BlockMetaArena(const BlockMetaArena&) = delete;
+  BlockMetaArena& operator=(const BlockMetaArena&) = delete;
+
+  ~BlockMetaArena() {
+    for (auto chunk : chunks_) {
+      free(chunk);
+    }
+  }
+
+  char* Allocate(size_t sz) {
+    sz = (sz + 7) & ~(size_t)7;
+    if (UNLIKELY(cur_ + sz > end_)) {
+      size_t chunk_sz = std::max(sz, kChunkSize);
+      cur_ = reinterpret_cast<char*>(malloc(chunk_sz));
+      LOG_ASSERT(cur_ != nullptr, "alloc BlockMeta chunk failed");
+      end_ = cur_ + chunk_sz;
+      chunks_.push_back(cur_);
+      usage_ += chunk_sz;
+    }
+    char* res = cur_;
+    cur_ += sz;
+    return res;
+  }
+
+  size_t MemoryUsage() const { return usage_; }
+
+private:
+  std::vector<char*> chunks_;
+  char* cur_{nullptr};
+  char* end_{nullptr};
+  size_t usage_{0};
+};
+
+/**
+ * 每一个vin都有一个元数据管理器，存储了这个vin下刷的所有的Block的元数据信息
+ * 本次运行新下刷的block从shard的分配区中分配，之前运行持久化的block直接使用manifest映射中的连续数组
+ * 映射的block在connect的时候只记下数组，第一次查询这个vin的时候才一次性排序建索引，没有查询的vin不花时间
+ * 查询走按min_ts排序的索引，同时维护max_ts的前缀最大值：
+ *   前缀最大值单调不减，二分找到第一个可能和查询区间重合的位置，再二分找到min_ts超出区间的位置，中间逐个过滤
+ *   block基本按时间顺序下刷，这时两次二分之间几乎都是命中的block，查询为O(log n + k)；乱序的block也能保证正确
+ * 按顺序到来的block直接追加到索引末尾；乱序的block先放进未排序的pending_，下一次查询时排序之后和索引归并一次，
+ * 为O(n + p log p)，p是两次查询之间乱序的block数，乱序下刷不会变成每个block一次O(n)的插入
+ */
+class BlockMetaManager {
+public:
+  // layout在createTable之后才有内容，只要在第一个block之前建好就行
+  BlockMetaManager(const BlockLayout* layout, BlockMetaArena* arena) : layout_(layout), arena_(arena) {}
+
+  BlockMeta* NewVinBlockMeta(int num, int64_t min_ts, int64_t max_ts, const ColumnStats& stats) {
+    LOG_ASSERT(layout_->ColumnNum() > 0, "block layout is not built");
+    LOG_ASSERT(num > 0 && num <= UINT16_MAX, "invalid block rows %d", num);
+    size_t stride = layout_->Stride();
+    BlockMeta* blk_meta = reinterpret_cast<BlockMeta*>(arena_->Allocate(stride));
+    memset(static_cast<void*>(blk_meta), 0, stride);
+    blk_meta->num = num;
+    blk_meta->column_num = layout_->ColumnNum();
+    blk_meta->min_ts = min_ts;
+    blk_meta->max_ts = max_ts;
+    layout_->PackStats(blk_meta, stats);
+    new_blocks_.push_back(blk_meta);
+    index(blk_meta);
 
     // 剩下的元数据，返回回去，每个列的Flush函数自己填充，当前的测试流程应该不会出现并发问题
     return blk_meta;
   }
 
-  // 遍历所有meta，只要是时间戳区间有重合的都返回
+  // 挂上manifest中cnt个连续的BlockMeta，间隔为layout的Stride，不拷贝，索引等到第一次查询再建
+  void AddMapped(char* base, int cnt) {
+    LOG_ASSERT(reinterpret_cast<BlockMeta*>(base)->column_num == layout_->ColumnNum(), "column num mismatch");
+    mapped_.emplace_back(base, cnt);
+    block_num_ += cnt;
+  }
+
+  // 返回时间戳区间和[min_ts, max_ts)有重合的meta，按min_ts升序
   void GetVinBlockMetasByTimeRange(uint16_t vid, int64_t min_ts, int64_t max_ts,
                                    OUT std::vector<BlockMeta*>& blk_metas) {
     blk_metas.clear();
-    BlockMeta* p = head_;
-    int svid = vid2svid(vid);
-    while (p != nullptr) {
-      if (p->max_ts < min_ts || p->min_ts >= max_ts) {
-        p = p->next;
-        continue;
+    buildIndex();
+    size_t begin = std::lower_bound(run_max_ts_.begin(), run_max_ts_.end(), min_ts) - run_max_ts_.begin();
+    size_t end = std::lower_bound(min_ts_.begin() + begin, min_ts_.end(), max_ts) - min_ts_.begin();
+    for (size_t i = begin; i < end; i++) {
+      if (max_ts_[i] >= min_ts) {
+        blk_metas.emplace_back(metas_[i]);
       }
-
-      blk_metas.emplace_back(p);
-      p = p->next;
     }
   }
 
-  // shutdown的时候，持久化到文件
-  // 格式：block_cnt [blk_meta]
-  //  blk_meta: row_num min_ts[kVinNumPerShard] max_ts[kVinNumPerShard] compress_sz[col_num] origin_sz[col_num]
-  //  offset[col_num]
-  void Save(File* file) {
-    LOG_ASSERT(file != nullptr, "error file");
-
-    int blk_cnt = block_cnts_;
-    // block_cnt
-    file->write((const char*)&blk_cnt, sizeof(blk_cnt));
-    BlockMeta* p = head_;
-    for (int i = 0; i < blk_cnt; i++) {
-      LOG_ASSERT(p != nullptr, "p == nullptr");
-      // row num
-      file->write((const char*)&p->num, sizeof(p->num));
-      // min_ts[]
-      file->write((const char*)&p->min_ts, sizeof(p->min_ts));
-      // max_ts
-      file->write((const char*)&p->max_ts, sizeof(p->max_ts));
-            // min_ts[]
-      file->write((const char*)p->max_val, sizeof(p->max_val));
-      // max_ts
-      file->write((const char*)p->sum_val, sizeof(p->sum_val));
-      // compress_sz
-      file->write((const char*)p->compress_sz, sizeof(p->compress_sz));
-      // origin_sz
-      file->write((const char*)p->origin_sz, sizeof(p->origin_sz));
-      // offset
-      file->write((const char*)p->offset, sizeof(p->offset));
-      p = p->next;
+  size_t BlockNum() const { return block_num_ + new_blocks_.size(); }
+
+  // 本次运行新下刷、还没有写入manifest的block，取出之后就算已经持久化，checkpoint和shutdown的时候追加到manifest
+  void TakeUnpersisted(std::vector<BlockMeta*>& blocks) {
+    blocks.assign(new_blocks_.begin() + persisted_, new_blocks_.end());
+    persisted_ = new_blocks_.size();
+  }
+
+private:
+  // 把还没有进索引的映射block和pending_中的block排序之后和已有的索引归并
+  void buildIndex() {
+    if (LIKELY(pending_.empty() && indexed_mapped_ == mapped_.size())) {
+      return;
     }
-    LOG_ASSERT(p == nullptr, "p should be equal nullptr");
-  }
-
-  // connect的时候，从文件读取，重新构建VinBlockMetaManager
-  void Load(File* file) {
-    LOG_ASSERT(file != nullptr, "error file");
-
-    // block_cnt
-    int blk_cnt;
-    file->read((char*)&blk_cnt, sizeof(blk_cnt));
-    block_cnts_ = 0;
-
-    LOG_ASSERT(head_ == nullptr, "head should be nullptr");
-    for (int i = 0; i < blk_cnt; i++) {
-      int num;
-      int64_t min_ts;
-      int64_t max_ts;
-      uint64_t max_val[kColumnNum];
-      uint64_t sum_val[kColumnNum];
-      file->read((char*)&num, sizeof(num));
-      file->read((char*)&min_ts, sizeof(min_ts));
-      file->read((char*)&max_ts, sizeof(max_ts));
-      file->read((char*)max_val, sizeof(max_val));
-      file->read((char*)sum_val, sizeof(sum_val));
-
-      auto* p = NewVinBlockMeta(num, min_ts, max_ts, max_val, sum_val);
-
-      file->read((char*)p->compress_sz, sizeof(p->compress_sz));
-      file->read((char*)p->origin_sz, sizeof(p->origin_sz));
-      file->read((char*)p->offset, sizeof(p->offset));
+    size_t stride = layout_->Stride();
+    for (; indexed_mapped_ < mapped_.size(); indexed_mapped_++) {
+      auto [base, cnt] = mapped_[indexed_mapped_];
+      for (int i = 0; i < cnt; i++) {
+        pending_.push_back(reinterpret_cast<BlockMeta*>(base + i * stride));
+      }
+    }
+    // stable保证min_ts相同的block按到来的顺序排列，和逐个插入时一致
+    auto by_min_ts = [](const BlockMeta* a, const BlockMeta* b) { return a->min_ts < b->min_ts; };
+    std::stable_sort(pending_.begin(), pending_.end(), by_min_ts);
+    std::vector<BlockMeta*> metas(metas_.size() + pending_.size());
+    std::merge(metas_.begin(), metas_.end(), pending_.begin(), pending_.end(), metas.begin(), by_min_ts);
+    pending_.clear();
+    metas_ = std::move(metas);
+    min_ts_.resize(metas_.size());
+    max_ts_.resize(metas_.size());
+    run_max_ts_.resize(metas_.size());
+    int64_t run_max = INT64_MIN;
+    for (size_t i = 0; i < metas_.size(); i++) {
+      min_ts_[i] = metas_[i]->min_ts;
+      max_ts_[i] = metas_[i]->max_ts;
+      run_max = std::max(run_max, max_ts_[i]);
+      run_max_ts_[i] = run_max;
     }
   }
 
-  virtual ~BlockMetaManager() {
-    int num = 0;
-    BlockMeta* next = nullptr;
-    while (head_ != nullptr) {
-      next = head_->next;
-      delete head_;
-      head_ = next;
-      num++;
+  // 按顺序到来的block直接追加到索引末尾，其他的等查询的时候再归并
+  void index(BlockMeta* meta) {
+    if (!pending_.empty() || indexed_mapped_ != mapped_.size() ||
+        (!min_ts_.empty() && meta->min_ts < min_ts_.back())) {
+      pending_.push_back(meta);
+      return;
     }
-    LOG_ASSERT(num == block_cnts_, "num != block_cnt");
+    int64_t run_max = run_max_ts_.empty() ? INT64_MIN : run_max_ts_.back();
+    min_ts_.push_back(meta->min_ts);
+    max_ts_.push_back(meta->max_ts);
+    run_max_ts_.push_back(std::max(run_max, meta->max_ts));
+    metas_.push_back(meta);
   }
 
-private:
-  int block_cnts_{0}; // 一共下刷了多少个block
-  BlockMeta* head_{nullptr};
+  const BlockLayout* layout_;
+  BlockMetaArena* arena_; // 新block的内存，归shard所有
+  std::vector<BlockMeta*> new_blocks_;
+  size_t persisted_{0}; // new_blocks_中前这么多个已经写入manifest
+  std::vector<std::pair<char*, int>> mapped_;
+  size_t indexed_mapped_{0}; // mapped_中前这么多段已经进了索引
+  size_t block_num_{0};      // 映射的block数
+
+  // 按min_ts排序的索引，分开存放，二分的时候只访问用到的数组
+  std::vector<int64_t> min_ts_;
+  std::vector<int64_t> max_ts_;
+  std::vector<int64_t> run_max_ts_; // max_ts_[0..i]的最大值
+  std::vector<BlockMeta*> metas_;
+  std::vector<BlockMeta*> pending_; // 还没有进索引的block，没有排序
 };
 
 } // namespace LindormContest
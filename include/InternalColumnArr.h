@@ -5,11 +5,13 @@
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <new>
 #include <string>
 
 #include "BlockMetaManager.h"
 #include "common.h"
+#include "column_batch.h"
 #include "compress.h"
 #include "io/aligned_buffer.h"
 #include "io/io_manager.h"
@@ -25,7 +27,9 @@ namespace LindormContest {
 template <typename T>
 class ColumnArr {
 public:
-  ColumnArr(int col_id, MyColumnType type) : col_id_(col_id), type_(type) {}
+  // 容量按照运行时配置的memtable行数分配
+  ColumnArr(int col_id, MyColumnType type)
+      : col_id_(col_id), capacity_(g_config.memtable_row_num), data_(new T[capacity_]), type_(type) {}
   virtual ~ColumnArr() {}
 
   void Add(const ColumnValue& col, int idx) {
@@ -49,33 +53,42 @@ public:
         LOG_ASSERT(0, "error");
       } break;
     }
-    if (idx == 0) {
-      diff_cnt = 1;
-      min = data_[idx];
-      max = data_[idx];
-    } else {
-      if (std::abs(data_[idx] - data_[idx-1]) >= MAX_DIFF_VAL) diff_cnt++;
-      if (data_[idx] < min) min = data_[idx];
-      if (data_[idx] > max) max = data_[idx];
+  }
+
+  // 写入的时候只追加数据，min/max/diff_cnt在下刷之前一次性统计，循环可以被向量化
+  void ComputeStats(int cnt) {
+    if (UNLIKELY(cnt <= 0)) return;
+    T lo = data_[0];
+    T hi = data_[0];
+    for (int i = 1; i < cnt; i++) {
+      lo = data_[i] < lo ? data_[i] : lo;
+      hi = data_[i] > hi ? data_[i] : hi;
+    }
+    // 和DiffCompress里面的判断保持一致
+    int diff = 1;
+    for (int i = 1; i < cnt; i++) {
+      diff += std::abs(data_[i] - data_[i - 1]) >= MAX_DIFF_VAL;
     }
+    min = lo;
+    max = hi;
+    diff_cnt = diff;
   }
 
   // 元数据直接写到内存，内存里面的元数据在shutdown的时候会持久化的
   void Flush(AlignedWriteBuffer* buffer, int cnt, BlockMeta* meta) {
+    ComputeStats(cnt);
     uint64_t offset;
     uint64_t input_sz = cnt * sizeof(T);
     uint64_t compress_buf_sz = 0;
 
     char* compress_buf;
     uint64_t compress_sz = 0;
-    TArrCompress(data_, cnt, min, max, diff_cnt, compress_buf, compress_sz, type_);
+    TArrCompress(data_.get(), cnt, min, max, diff_cnt, compress_buf, compress_sz, type_);
 
     buffer->write(compress_buf, compress_sz, offset);
     naive_free(compress_buf);
 
-    meta->offset[col_id_] = offset;
-    meta->origin_sz[col_id_] = input_sz;
-    meta->compress_sz[col_id_] = compress_sz;
+    meta->SetExtent(col_id_, offset, compress_sz);
     RECORD_ARR_FETCH_ADD(origin_szs, col_id_, input_sz);
     RECORD_ARR_FETCH_ADD(compress_szs, col_id_, compress_sz);
   }
@@ -84,11 +97,11 @@ public:
     LOG_ASSERT(meta != nullptr, "error");
 
     // buf 和offset 的按512字节对齐
-    uint64_t offset = meta->offset[col_id_];
-    size_t compress_sz = meta->compress_sz[col_id_];
+    uint64_t offset = meta->Offset(col_id_);
+    size_t compress_sz = meta->CompressSz(col_id_);
 
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]);                                 // offset对齐
-    size_t compressed_buf_sz = roundup512(meta->compress_sz[col_id_] + (offset - file_read_off)); // 预留足够的空间
+    uint64_t file_read_off = rounddown512(offset);                                     // offset对齐
+    size_t compressed_buf_sz = roundup512(compress_sz + (offset - file_read_off)); // 预留足够的空间
     auto buf = reinterpret_cast<char*>(naive_alloc(compressed_buf_sz));
     char* compressed_data = buf;
 
@@ -120,8 +133,10 @@ public:
     }
 
     int cnt;
-    TArrDeCompress<T>(data_, cnt, meta->origin_sz[col_id_], compressed_data, meta->compress_sz[col_id_], type_);
-    LOG_ASSERT(cnt*sizeof(T) == (long unsigned int)meta->origin_sz[col_id_], "uncompress error");
+    LOG_ASSERT(meta->num <= capacity_, "block rows %d > capacity %d", meta->num, capacity_);
+    size_t origin_sz = meta->num * sizeof(T);
+    TArrDeCompress<T>(data_.get(), cnt, origin_sz, compressed_data, compress_sz, type_);
+    LOG_ASSERT(cnt * sizeof(T) == origin_sz, "uncompress error");
     naive_free(buf);
   }
 
@@ -129,12 +144,12 @@ public:
     LOG_ASSERT(meta != nullptr, "error");
 
     // buf 和offset 的按512字节对齐
-    uint64_t offset = meta->offset[col_id_];
-    size_t compress_sz = meta->compress_sz[col_id_];
+    uint64_t offset = meta->Offset(col_id_);
+    size_t compress_sz = meta->CompressSz(col_id_);
 
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]);                                 // offset对齐
-    size_t compressed_buf_sz = roundup512(meta->compress_sz[col_id_] + (offset - file_read_off)); // 预留足够的空间
-    auto buf = reinterpret_cast<char*>(naive_alloc(compressed_buf_sz));
+    uint64_t file_read_off = rounddown512(offset);                                     // offset对齐
+    size_t compressed_buf_sz = roundup512(compress_sz + (offset - file_read_off)); // 预留足够的空间
+    auto buf = reinterpret_cast<char*>(file->aio()->AllocBuffer(compressed_buf_sz));
     char* compressed_data = buf;
 
     struct stat st;
@@ -147,15 +162,16 @@ public:
 
   void Decompressed(char* data_buf, BlockMeta* meta) {
     char* compressed_data = data_buf;
-    uint64_t offset = meta->offset[col_id_];
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]); // offset对齐
-    size_t compress_sz = meta->compress_sz[col_id_];
+    uint64_t offset = meta->Offset(col_id_);
+    uint64_t file_read_off = rounddown512(offset); // offset对齐
+    size_t compress_sz = meta->CompressSz(col_id_);
 
     compressed_data += (offset - file_read_off); // 偏移修正
     int cnt;
-    TArrDeCompress(data_, cnt, meta->origin_sz[col_id_], compressed_data, compress_sz, type_);
-    LOG_ASSERT(cnt * sizeof(T) == (long unsigned int)meta->origin_sz[col_id_], "uncompress error, expect %lu ,but got %lu", meta->origin_sz[col_id_], cnt * sizeof(T));
-    naive_free(data_buf);
+    LOG_ASSERT(meta->num <= capacity_, "block rows %d > capacity %d", meta->num, capacity_);
+    size_t origin_sz = meta->num * sizeof(T);
+    TArrDeCompress(data_.get(), cnt, origin_sz, compressed_data, compress_sz, type_);
+    LOG_ASSERT(cnt * sizeof(T) == origin_sz, "uncompress error, expect %lu ,but got %lu", origin_sz, cnt * sizeof(T));
   }
 
   void Get(int idx, ColumnValue& value) {
@@ -192,23 +208,58 @@ public:
 
   int64_t GetVal(int idx) { return data_[idx]; }
 
-  size_t TotalSize() const { return sizeof(T) * kMemtableRowNum; }
+  // 把选中的行追加到列式结果里，sel为nullptr表示追加[0, n)
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) {
+    switch (type_) {
+      case MyColumnType::MyInt32:
+        appendTo(buf.ints, sel, n);
+        return;
+      case MyColumnType::MyDouble:
+        appendTo(buf.doubles, sel, n);
+        return;
+      default:
+        LOG_ASSERT(false, "should not run here");
+    }
+  }
+
+  size_t TotalSize() const { return sizeof(T) * capacity_; }
 
   void Reset(){};
 
   const int col_id_;
+  const int capacity_;
 
-  T data_[kMemtableRowNum];
+  std::unique_ptr<T[]> data_;
   T min;
   T max;
   MyColumnType type_;
   int diff_cnt = 1;
+
+private:
+  template <typename V>
+  void appendTo(std::vector<V>& out, const uint16_t* sel, int n) {
+    size_t base = out.size();
+    out.resize(base + n);
+    V* dst = out.data() + base;
+    if (sel == nullptr) {
+      for (int i = 0; i < n; i++) dst[i] = (V)data_[i];
+    } else {
+      for (int i = 0; i < n; i++) dst[i] = (V)data_[sel[i]];
+    }
+  }
 };
 
 template <>
 class ColumnArr<std::string> {
 public:
-  ColumnArr(int col_id) : col_id_(col_id), offset_(0) { offsets_[0] = 0; }
+  ColumnArr(int col_id)
+      : col_id_(col_id),
+        capacity_(g_config.memtable_row_num),
+        offset_(0),
+        offsets_(new uint32_t[capacity_ + 1]),
+        lens_(new uint16_t[capacity_]) {
+    offsets_[0] = 0;
+  }
   ~ColumnArr() {}
 
   void Add(const ColumnValue& col, int idx) {
@@ -216,38 +267,43 @@ public:
 
     std::pair<int32_t, const char*> pair;
     col.getStringValue(pair);
-    std::string str(pair.second, pair.first);
-
-    data_.append(str);
+    Append(pair.second, pair.first, idx);
+  }
 
-    offset_ += pair.first;
+  void Append(const char* str, int32_t len, int idx) {
+    data_.append(str, len);
+    offset_ += len;
     offsets_[idx + 1] = offset_;
-    lens_[idx] = pair.first;
-    if (idx == 0) {
-      min = lens_[idx];
-      max = lens_[idx];
-    } else {
-      if (lens_[idx] < min) min = lens_[idx];
-      if (lens_[idx] > max) max = lens_[idx];
+    lens_[idx] = len;
+  }
+
+  void ComputeStats(int cnt) {
+    if (UNLIKELY(cnt <= 0)) return;
+    uint16_t lo = lens_[0];
+    uint16_t hi = lens_[0];
+    for (int i = 1; i < cnt; i++) {
+      lo = lens_[i] < lo ? lens_[i] : lo;
+      hi = lens_[i] > hi ? lens_[i] : hi;
     }
+    min = lo;
+    max = hi;
   }
 
   // 元数据直接写到内存，内存里面的元数据在shutdown的时候会持久化的
   void Flush(AlignedWriteBuffer* buffer, int cnt, BlockMeta* meta) {
+    ComputeStats(cnt);
     uint64_t writesz1 = cnt * sizeof(lens_[0]);
     uint64_t writesz2 = data_.size();
     uint64_t input_sz = writesz1 + writesz2;
     char* compress_buf;
     uint64_t compress_sz;
-    StringArrCompress(&data_, lens_, cnt, min, max, compress_buf, compress_sz);
+    StringArrCompress(&data_, lens_.get(), cnt, min, max, compress_buf, compress_sz);
 
     uint64_t off;
     buffer->write(compress_buf, compress_sz, off);
     naive_free(compress_buf);
 
-    meta->offset[col_id_] = off;
-    meta->origin_sz[col_id_] = input_sz;
-    meta->compress_sz[col_id_] = compress_sz;
+    meta->SetExtent(col_id_, off, compress_sz);
     RECORD_ARR_FETCH_ADD(origin_szs, col_id_, input_sz);
     RECORD_ARR_FETCH_ADD(compress_szs, col_id_, compress_sz);
   }
@@ -256,16 +312,14 @@ public:
   void Read(File* file, AlignedWriteBuffer* buffer, BlockMeta* meta) {
     LOG_ASSERT(meta != nullptr, "error");
 
-    uint64_t offset = meta->offset[col_id_];
-    size_t compress_sz = meta->compress_sz[col_id_];
+    uint64_t offset = meta->Offset(col_id_);
+    size_t compress_sz = meta->CompressSz(col_id_);
 
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]);                                 // offset对齐
-    size_t compressed_buf_sz = roundup512(meta->compress_sz[col_id_] + (offset - file_read_off)); // 预留足够的空间
-    size_t origin_buf_sz = meta->origin_sz[col_id_];
+    uint64_t file_read_off = rounddown512(offset);                                     // offset对齐
+    size_t compressed_buf_sz = roundup512(compress_sz + (offset - file_read_off)); // 预留足够的空间
 
     char* compress_buf = reinterpret_cast<char*>(naive_alloc(compressed_buf_sz));
     char* compress_data = compress_buf;
-    char* origin_buf = reinterpret_cast<char*>(naive_alloc(origin_buf_sz));
 
     if (LIKELY(buffer == nullptr) || buffer->empty() || offset + compress_sz <= buffer->FlushedSz()) {
       // 全部在文件里面
@@ -294,10 +348,13 @@ public:
       }
     }
 
+    size_t origin_buf_sz = StringArrOriginSize(compress_data, compress_sz);
+    char* origin_buf = reinterpret_cast<char*>(naive_alloc(origin_buf_sz));
     auto ret = StringArrDeCompress(origin_buf, origin_buf_sz, compress_data, compress_sz);
     LOG_ASSERT(ret == (int)origin_buf_sz, "uncompress error");
 
-    memcpy(lens_, origin_buf, sizeof(lens_[0]) * (meta->num));
+    LOG_ASSERT(meta->num <= capacity_, "block rows %d > capacity %d", meta->num, capacity_);
+    memcpy(lens_.get(), origin_buf, sizeof(lens_[0]) * (meta->num));
     data_ = std::string(origin_buf + sizeof(lens_[0]) * (meta->num), origin_buf_sz - sizeof(lens_[0]) * meta->num);
 
     offset = 0;
@@ -314,13 +371,13 @@ public:
   char* AsyncReadCompressed(AsyncFile* file, BlockMeta* meta) {
     LOG_ASSERT(meta != nullptr, "error");
 
-    uint64_t offset = meta->offset[col_id_];
-    size_t compress_sz = meta->compress_sz[col_id_];
+    uint64_t offset = meta->Offset(col_id_);
+    size_t compress_sz = meta->CompressSz(col_id_);
 
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]);                                 // offset对齐
-    size_t compressed_buf_sz = roundup512(meta->compress_sz[col_id_] + (offset - file_read_off)); // 预留足够的空间
+    uint64_t file_read_off = rounddown512(offset);                                     // offset对齐
+    size_t compressed_buf_sz = roundup512(compress_sz + (offset - file_read_off)); // 预留足够的空间
 
-    char* compress_buf = reinterpret_cast<char*>(naive_alloc(compressed_buf_sz));
+    char* compress_buf = reinterpret_cast<char*>(file->aio()->AllocBuffer(compressed_buf_sz));
     char* compress_data = compress_buf;
 
     // 全部在文件里面
@@ -334,20 +391,20 @@ public:
   }
 
   void Decompressed(char* data_buf, BlockMeta* meta) {
-    uint64_t offset = meta->offset[col_id_];
-    uint64_t file_read_off = rounddown512(meta->offset[col_id_]); // offset对齐
-    size_t compress_sz = meta->compress_sz[col_id_];
-
-    size_t origin_buf_sz = meta->origin_sz[col_id_];
-    char* origin_buf = reinterpret_cast<char*>(naive_alloc(origin_buf_sz));
+    uint64_t offset = meta->Offset(col_id_);
+    uint64_t file_read_off = rounddown512(offset); // offset对齐
+    size_t compress_sz = meta->CompressSz(col_id_);
 
     char* compress_data = data_buf;
 
     compress_data += (offset - file_read_off); // 偏移修正
+    size_t origin_buf_sz = StringArrOriginSize(compress_data, compress_sz);
+    char* origin_buf = reinterpret_cast<char*>(naive_alloc(origin_buf_sz));
     auto ret = StringArrDeCompress(origin_buf, origin_buf_sz, compress_data, compress_sz);
     LOG_ASSERT(ret == (int)origin_buf_sz, "uncompress error");
 
-    memcpy(lens_, origin_buf, sizeof(lens_[0]) * (meta->num));
+    LOG_ASSERT(meta->num <= capacity_, "block rows %d > capacity %d", meta->num, capacity_);
+    memcpy(lens_.get(), origin_buf, sizeof(lens_[0]) * (meta->num));
     data_ = std::string(origin_buf + sizeof(lens_[0]) * (meta->num), origin_buf_sz - sizeof(lens_[0]) * meta->num);
 
     offset = 0;
@@ -356,7 +413,6 @@ public:
       offsets_[i + 1] = offset;
     }
 
-    naive_free(data_buf);
     naive_free(origin_buf);
   }
 
@@ -374,6 +430,21 @@ public:
     std::memcpy(value.columnData + sizeof(int32_t), res_str.data(), res_str.size());
   }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) {
+    if (sel == nullptr) {
+      // 连续的一段，整体拷贝
+      uint32_t base = buf.bytes.size();
+      buf.bytes.append(data_.data(), offsets_[n]);
+      for (int i = 0; i < n; i++) buf.offsets.push_back(base + offsets_[i + 1]);
+    } else {
+      for (int i = 0; i < n; i++) {
+        int idx = sel[i];
+        buf.bytes.append(data_.data() + offsets_[idx], offsets_[idx + 1] - offsets_[idx]);
+        buf.offsets.push_back(buf.bytes.size());
+      }
+    }
+  }
+
   void Reset() {
     offset_ = 0;
     offsets_[0] = 0;
@@ -381,20 +452,27 @@ public:
   };
 
   const int col_id_;
+  const int capacity_;
 
   size_t TotalSize() const {
-    size_t meta_sz = sizeof(ColumnArr<std::string>);
     if (data_.empty()) {
       // 没有填充数据的时候，先预估大小
-      return meta_sz * 2;
+      return PlaceholderSize();
     }
-    return meta_sz + data_.size();
+    return fixedSize() + data_.size();
   }
 
+  // 填充数据之前预估的大小
+  size_t PlaceholderSize() const { return fixedSize() * 2; }
+
 private:
+  size_t fixedSize() const {
+    return sizeof(ColumnArr<std::string>) + capacity_ * (sizeof(offsets_[0]) + sizeof(lens_[0]));
+  }
+
   uint32_t offset_;
-  uint32_t offsets_[kMemtableRowNum + 1];
-  uint16_t lens_[kMemtableRowNum];
+  std::unique_ptr<uint32_t[]> offsets_;
+  std::unique_ptr<uint16_t[]> lens_;
   uint16_t min;
   uint16_t max;
   std::string data_;
@@ -410,6 +488,7 @@ public:
 
   virtual void Read(File* file, AlignedWriteBuffer* buffer, BlockMeta* meta) = 0;
 
+  // 缓冲区从file->aio()中分配，Decompressed之后由调用方归还
   virtual char* AsyncReadCompressed(AsyncFile* file, BlockMeta* meta) = 0;
 
   virtual void Decompressed(char* data_buf, BlockMeta* meta) = 0;
@@ -418,6 +497,9 @@ public:
 
   virtual int64_t GetVal(int idx) = 0;
 
+  // sel为nullptr表示追加[0, n)
+  virtual void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) = 0;
+
   virtual void Reset() = 0;
 
   virtual int GetColid() = 0;
@@ -445,10 +527,14 @@ public:
 
   int64_t GetVal(int idx) override { return arr->GetVal(idx); }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
+  int* GetDataArr() { return arr->data_.get(); }
+
   size_t TotalSize() override { return arr->TotalSize(); }
 
 private:
@@ -478,10 +564,14 @@ public:
     return -1;
   }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
+  double* GetDataArr() { return arr->data_.get(); }
+
   size_t TotalSize() override { return arr->TotalSize(); }
 
 private:
@@ -511,10 +601,16 @@ public:
     return -1;
   }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
+  void Append(const char* str, int32_t len, int idx) { arr->Append(str, len, idx); }
+
+  size_t PlaceholderSize() { return arr->PlaceholderSize(); }
+
   size_t TotalSize() override { return arr->TotalSize(); }
 
 private:
@@ -529,16 +625,7 @@ public:
 
   void Add(const ColumnValue& col, int idx) override { arr->Add(col, idx); }
 
-  void Add(uint16_t svid, int idx) {
-    arr->data_[idx] = svid;
-    if (idx == 0) {
-      arr->min = svid;
-      arr->max = svid;
-    } else {
-      if ((uint16_t)arr->min > svid) arr->min = svid;
-      if ((uint16_t)arr->max < svid) arr->max = svid;
-    }
-  }
+  void Add(uint16_t svid, int idx) { arr->data_[idx] = svid; }
 
   void Flush(AlignedWriteBuffer* buffer, int cnt, BlockMeta* meta) override { arr->Flush(buffer, cnt, meta); }
 
@@ -552,11 +639,13 @@ public:
 
   int64_t GetVal(int idx) override { return arr->GetVal(idx); }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
-  uint16_t* GetDataArr() { return arr->data_; }
+  uint16_t* GetDataArr() { return arr->data_.get(); }
 
   size_t TotalSize() override { return arr->TotalSize(); }
 
@@ -573,18 +662,7 @@ public:
 
   void Add(const ColumnValue& col, int idx) override { arr->Add(col, idx); }
 
-  void Add(int64_t ts, int idx) {
-    arr->data_[idx] = ts;
-    if (idx == 0) {
-      arr->diff_cnt = 1;
-      arr->min = ts;
-      arr->max = ts;
-    } else {
-      if (std::abs(arr->data_[idx] - arr->data_[idx-1]) >= MAX_DIFF_VAL) arr->diff_cnt++;
-      if ((int64_t)arr->min > ts) arr->min = ts;
-      if ((int64_t)arr->max < ts) arr->max = ts;
-    }
-  }
+  void Add(int64_t ts, int idx) { arr->data_[idx] = ts; }
 
   void Flush(AlignedWriteBuffer* buffer, int cnt, BlockMeta* meta) override { arr->Flush(buffer, cnt, meta); }
 
@@ -598,11 +676,13 @@ public:
 
   int64_t GetVal(int idx) override { return arr->GetVal(idx); }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
-  int64_t* GetDataArr() { return arr->data_; }
+  int64_t* GetDataArr() { return arr->data_.get(); }
 
   size_t TotalSize() override { return arr->TotalSize(); }
 
@@ -632,11 +712,13 @@ public:
 
   int64_t GetVal(int idx) override { return arr->GetVal(idx); }
 
+  void AppendTo(ColumnBuffer& buf, const uint16_t* sel, int n) override { arr->AppendTo(buf, sel, n); }
+
   void Reset() override { arr->Reset(); }
 
   int GetColid() override { return arr->col_id_; }
 
-  uint16_t* GetDataArr() { return arr->data_; }
+  uint16_t* GetDataArr() { return arr->data_.get(); }
 
   size_t TotalSize() override { return arr->TotalSize(); }
 
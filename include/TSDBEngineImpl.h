@@ -7,21 +7,32 @@
 
 #ifndef LINDORMTSDBCONTESTCPP_TSDBENGINEIMPL_H
 #define LINDORMTSDBCONTESTCPP_TSDBENGINEIMPL_H
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "Hasher.hpp"
 #include "TSDBEngine.hpp"
+#include "batch_request.h"
+#include "column_batch.h"
+#include "coroutine/coro_cond.h"
 #include "coroutine/coroutine_pool.h"
+#include "ingest_plan.h"
 #include "io/io_manager.h"
+#include "manifest.h"
 #include "util/rwlock.h"
 #include "util/waitgroup.h"
+#include "vin_dict.h"
 
 namespace LindormContest {
 extern bool write_phase;
 class ShardImpl;
+class WalWriter;
 class TSDBEngineImpl : public TSDBEngine {
 public:
   /**
@@ -45,10 +56,32 @@ public:
 
   int executeTimeRangeQuery(const TimeRangeQueryRequest& trReadReq, std::vector<Row>& trReadRes) override;
 
+  // 列式返回time range查询结果，直接从解压后的列数组拷贝，不为每一行构造Row
+  int executeTimeRangeQueryColumnar(const TimeRangeQueryRequest& trReadReq, ColumnBatch& trReadRes);
+
+  // 多个vin同一时间范围的查询，按scheduler分组后所有线程并行执行，线程内的vin并发执行，
+  // 结果按请求中vin的顺序追加到trReadRes
+  int executeTimeRangeBatchQuery(const TimeRangeBatchQueryRequest& trReadReq, std::vector<Row>& trReadRes);
+
+  // 列式的批量查询，trReadRes[i]对应trReadReq.vins[i]
+  int executeTimeRangeBatchQueryColumnar(const TimeRangeBatchQueryRequest& trReadReq,
+                                         std::vector<ColumnBatch>& trReadRes);
+
+  // 带过滤条件的time range查询，由block中过滤列的min/max跳过没有行满足条件的block
+  int executeTimeRangeFilteredQuery(const TimeRangeFilteredQueryRequest& trReadReq, std::vector<Row>& trReadRes);
+
   // 遍历的时候在线处理聚合
   int executeAggregateQuery(const TimeRangeAggregationRequest& aggregationReq,
                             std::vector<Row>& aggregationRes) override;
 
+  // 批量聚合，按vid分组后同一个vid的所有项共享block的读取和解压，aggregationRes[i]对应aggregationReq.items[i]
+  int executeAggregateBatchQuery(const TimeRangeAggregationBatchRequest& aggregationReq,
+                                 std::vector<std::vector<Row>>& aggregationRes);
+
+  // 批量降采样，downsampleRes[i]对应downsampleReq.items[i]
+  int executeDownsampleBatchQuery(const TimeRangeDownsampleBatchRequest& downsampleReq,
+                                  std::vector<std::vector<Row>>& downsampleRes);
+
   // 遍历的时候分桶处理
   int executeDownsampleQuery(const TimeRangeDownsampleRequest& downsampleReq, std::vector<Row>& downsampleRes) override;
 
@@ -57,15 +90,75 @@ public:
 private:
   void fillColids(const std::set<std::string>& requestedColumns, std::vector<int>& colids);
 
+  // 写入请求拆分到某个scheduler上的一批行，带着已经查好的vid
+  struct WriteBatch {
+    std::vector<std::pair<uint16_t, Row>> rows;
+    // 按vid排序后的行，同一个vid的行一次性写入memtable
+    std::vector<std::pair<uint16_t, const Row*>> sorted;
+    std::vector<const Row*> group;
+    // 是否需要写日志，日志回放的时候不需要
+    bool log{true};
+    // 日志落盘之后Done，为nullptr表示调用者不等待
+    WaitGroup* durable{nullptr};
+  };
+
+  // 把rows按scheduler拆分成WriteBatch提交，返回时还没有写入memtable
+  void submitWrite(const std::vector<Row>& rows, bool log, WaitGroup* durable);
+
+  // 从池子里获取一个空的WriteBatch，用完之后freeWriteBatch放回池子复用
+  WriteBatch* allocWriteBatch();
+  void freeWriteBatch(WriteBatch* batch);
+
+  // 写阶段的读己之写：读请求只等待自己的vid在请求之前已经返回的写入落到memtable，不影响其他写入
+  void waitWritesApplied(uint16_t vid);
+  void waitWritesApplied(const std::vector<std::vector<uint16_t>>& vids);
+
+  // 批量聚合和降采样的公共部分，filters[i]为nullptr表示不过滤
+  void batchAggregate(const std::vector<const AggregationItem*>& items,
+                      const std::vector<const CompareExpression*>& filters, int64_t lowerInclusive,
+                      int64_t upperExclusive, int64_t interval, std::vector<std::vector<Row>>& res);
+
+  // 把vins按照所在的scheduler分组，idxs[tid]记录对应vin在原请求中的下标，不存在的vin会被跳过
+  void groupVinsByTid(const std::vector<Vin>& vins, std::vector<std::vector<uint16_t>>& vids,
+                      std::vector<std::vector<int>>& idxs);
+
   friend class MemTable;
   friend class ShardImpl;
   void saveSchema();
   void loadSchema();
 
+  // 加载运行时配置，已有数据的时候分片数和memtable行数要和写入时保持一致
+  void loadConfig();
+
+  // vin字典、block元数据和最新行都在manifest中，block元数据直接使用映射，不拷贝
+  void loadManifest();
+  // 正常shutdown的时候把剩下的元数据作为最后一次编辑追加到manifest
+  void saveManifest();
+  // 把新分配的vin和各个shard编码好的parts合并成一次编辑追加到manifest，wal_gen之前的日志都已经包含在内
+  void appendManifest(const std::vector<ManifestEditBuilder>& parts, uint32_t wal_gen, uint32_t flags);
+  // 每个调度线程切换到新一代日志，下刷所有memtable，追加一次manifest编辑，之后删除旧的日志
+  void checkpoint();
+
+  // 在每个shard所在的调度线程上执行func(shard_id)，所有shard并行，返回时全部完成
+  void forEachShard(const std::function<void(int)>& func);
+  // 在每个调度线程上执行一次func(tid)
+  void forEachTid(const std::function<void(int)>& func);
+  // 在当前调度线程上并发地对vids中的每一项执行func(i)，各项的IO互相重叠，返回时全部完成
+  void forEachVid(const std::vector<uint16_t>& vids, const std::function<void(size_t)>& func);
+
+  // 数据目录下本表的文件中后缀为exts之一的文件
+  std::vector<std::string> listTableFiles(const std::vector<std::string>& exts);
+  // 每个调度线程打开一个新的日志文件，gen比已有的日志都大
+  void openWal(const std::vector<std::string>& old_wals);
+  // 按gen从旧到新回放日志，同一代中每个日志文件一个线程，回放的行按vid分发到各自的shard并行写入
+  void replayWal(const std::vector<std::string>& wals);
+
   uint16_t getVidForWrite(const Vin& vin);
 
   uint16_t getVidForRead(const Vin& vin);
 
+  // schema的列数，createTable或者loadSchema时确定，所有存储结构按这个大小分配
+  int column_num_{0};
   // The column's type for each column.
   ColumnType* columns_type_ = nullptr;
   // The column's name for each column.
@@ -74,24 +167,52 @@ private:
   // 用于存储 列名到其在schema中下标的映射
   std::unordered_map<std::string, int> column_idx_;
 
+  // createTable时根据schema构建
+  IngestPlan ingest_plan_;
+  // BlockMeta变长部分的布局，createTable或者loadSchema时根据schema构建
+  BlockLayout block_layout_;
+
   // 用于存储 17个字节的 vin 到 对应的唯一的一个uint16_t的vid的映射关系
-  RWLock vin2vid_lck_;
-  uint16_t vid_cnt_ = 0;
-  std::unordered_map<std::string, uint16_t> vin2vid_;
-  std::unordered_map<uint16_t, std::string> vid2vin_;
+  VinDict vin_dict_;
+
+  Manifest manifest_;
+  // manifest中已有的vin数，下一次编辑只追加新的vin
+  uint16_t manifest_vin_num_{0};
+  // manifest中最后一次编辑的Footer的偏移，下一次编辑接在它后面
+  uint64_t manifest_footer_{Manifest::kNoPrev};
 
   IOManager* io_mgr_{nullptr};
-  ShardImpl* shards_[kShardNum];
+  std::vector<ShardImpl*> shards_;
+  // 写前日志，下标是调度线程的tid，没有开启日志或者读阶段为空
+  std::vector<WalWriter*> wal_;
+  // 一个调度线程上写日志的关口，只在这个调度线程上访问
+  // checkpoint的时候关上，等已经写了日志的批次都写进memtable，之后的批次等切换到新的日志之后再写
+  struct WalGate {
+    int active{0}; // 已经开始写日志、还没有写进memtable的批次数
+    bool closed{false};
+    CoroCV cv;
+  };
+  std::vector<WalGate> wal_gate_;
+  // 正在写的日志的gen
+  uint32_t wal_gen_{0};
+  // 有日志文件写到了wal_checkpoint_size / worker_thread，下一次write在后台线程上开始checkpoint
+  std::atomic<bool> checkpoint_wanted_{false};
+  std::atomic<bool> checkpointing_{false};
+  // 只由把checkpointing_从false改成true的write和shutdown访问
+  std::thread checkpoint_thread_;
 
   CoroutinePool* coro_pool_{nullptr};
   void* mem_pool_addr_{nullptr};
 
   WaitGroup inflight_write_{0};
+  moodycamel::ConcurrentQueue<WriteBatch*> write_batch_pool_;
 
   std::thread* stat_thread_{nullptr};
   volatile bool stop_{false};
 
-  volatile bool sync_{false};
+  // 每个vid已经提交的行数和已经写入memtable的行数
+  std::atomic<uint64_t> submitted_seq_[kVinNum];
+  std::atomic<uint64_t> applied_seq_[kVinNum];
 }; // End class TSDBEngineImpl.
 
 } // namespace LindormContest
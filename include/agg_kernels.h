@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "config.h"
+#include "struct/CompareExpression.h"
+
+namespace LindormContest {
+
+/**
+ * 直接在解压之后的int/double列数组上做聚合的kernel，有AVX2、SSE4.2和标量三种实现，
+ * connect的时候按照配置和CPU支持的指令集选择一种。
+ * 行的选择用按字节的掩码表示，0xff为选中，0为没有选中，长度和列数组一样。
+ * double的和在所有实现中都按行的顺序累加，结果和逐行计算完全一样，不随指令集变化
+ */
+
+// 掩码选中的行的聚合结果，cnt为0的时候max和min没有意义
+template <typename T>
+struct MaskedAgg {
+  using TSum = std::conditional_t<std::is_integral<T>::value, int64_t, double>;
+  int64_t cnt{0};
+  TSum sum{0};
+  T max{std::numeric_limits<T>::lowest()};
+  T min{std::numeric_limits<T>::max()};
+};
+
+struct AggKernels {
+  const char* name;
+  // mask[i] = lo <= tss[i] < hi
+  void (*range_mask)(const int64_t* tss, int n, int64_t lo, int64_t hi, uint8_t* mask);
+  // 不满足过滤条件的行从mask中去掉
+  void (*filter_mask_int)(const int* data, int n, CompareOp op, int val, uint8_t* mask);
+  void (*filter_mask_double)(const double* data, int n, CompareOp op, double val, uint8_t* mask);
+  // 掩码选中的行的行数、和、最大值和最小值累加到res
+  void (*aggregate_int)(const int* data, const uint8_t* mask, int n, MaskedAgg<int>& res);
+  void (*aggregate_double)(const double* data, const uint8_t* mask, int n, MaskedAgg<double>& res);
+};
+
+// 不超过simd的指令集中CPU支持的最快的一种，AUTO表示不限制
+const AggKernels* GetAggKernels(SimdLevel simd);
+
+// 按照g_config.simd选择全局使用的kernel，加载配置之后调用
+void SelectAggKernels();
+
+extern const AggKernels* g_agg_kernels;
+
+inline void RangeMask(const int64_t* tss, int n, int64_t lo, int64_t hi, uint8_t* mask) {
+  g_agg_kernels->range_mask(tss, n, lo, hi, mask);
+}
+
+inline void FilterMask(const int* data, int n, CompareOp op, int val, uint8_t* mask) {
+  g_agg_kernels->filter_mask_int(data, n, op, val, mask);
+}
+
+inline void FilterMask(const double* data, int n, CompareOp op, double val, uint8_t* mask) {
+  g_agg_kernels->filter_mask_double(data, n, op, val, mask);
+}
+
+inline void MaskedAggregate(const int* data, const uint8_t* mask, int n, MaskedAgg<int>& res) {
+  g_agg_kernels->aggregate_int(data, mask, n, res);
+}
+
+inline void MaskedAggregate(const double* data, const uint8_t* mask, int n, MaskedAgg<double>& res) {
+  g_agg_kernels->aggregate_double(data, mask, n, res);
+}
+
+} // namespace LindormContest
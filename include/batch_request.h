@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "struct/Requests.h"
+#include "struct/Vin.h"
+
+namespace LindormContest {
+
+/**
+ * 多个vin共用同一个时间范围的time range查询
+ * If requestedColumns is empty, return all columns.
+ * Return all rows with timestamp during [timeLowerBound, timeUpperBound) of every vin.
+ */
+typedef struct TimeRangeBatchQueryRequest {
+  std::string tableName;
+  std::vector<Vin> vins;
+  int64_t timeLowerBound;
+  int64_t timeUpperBound;
+  std::set<std::string> requestedColumns;
+} TimeRangeBatchQueryRequest;
+
+/**
+ * 带过滤条件的time range查询，只返回filterColumnName这一列满足columnFilter的行
+ * filterColumnName不需要在requestedColumns中
+ * If requestedColumns is empty, return all columns.
+ */
+typedef struct TimeRangeFilteredQueryRequest : public TimeRangeQueryRequest {
+  std::string filterColumnName;
+  CompareExpression columnFilter;
+} TimeRangeFilteredQueryRequest;
+
+/**
+ * 批量聚合请求中的一项
+ */
+typedef struct AggregationItem {
+  Vin vin;
+  std::string columnName;
+  Aggregator aggregator;
+} AggregationItem;
+
+/**
+ * 多个(vin, column, aggregator)共用同一个时间范围的聚合查询
+ * 结果按item的下标返回，某个item的时间范围内没有数据时对应的结果为空
+ */
+typedef struct TimeRangeAggregationBatchRequest {
+  std::string tableName;
+  std::vector<AggregationItem> items;
+  int64_t timeLowerBound;
+  int64_t timeUpperBound;
+} TimeRangeAggregationBatchRequest;
+
+/**
+ * 批量降采样请求中的一项，过滤条件作用在请求的列上
+ */
+typedef struct DownsampleItem : public AggregationItem {
+  CompareExpression columnFilter;
+} DownsampleItem;
+
+/**
+ * 多个(vin, column, aggregator, filter)共用同一个时间范围和interval的降采样查询
+ */
+typedef struct TimeRangeDownsampleBatchRequest {
+  std::string tableName;
+  std::vector<DownsampleItem> items;
+  int64_t timeLowerBound;
+  int64_t timeUpperBound;
+  int64_t interval;
+} TimeRangeDownsampleBatchRequest;
+
+} // namespace LindormContest
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "BlockMetaManager.h"
+#include "InternalColumnArr.h"
+#include "agg.h"
+#include "agg_kernels.h"
+#include "struct/ColumnValue.h"
+#include "struct/CompareExpression.h"
+
+namespace LindormContest {
+
+/**
+ * 按桶聚合用到的聚合函数和过滤条件，都是编译期确定的模板参数，查询开始的时候只分发一次，
+ * 内层循环里没有虚函数调用和运行时的条件判断，可以完全内联。
+ * 每个聚合函数的State按列存放所有桶的累加器（SoA），字段都是长度为桶数的数组，
+ * cnt是桶中满足过滤条件的行数，为0的时候结果是NaN（COUNT为0）
+ */
+
+// 过滤条件，Pass判断一个值，Mask把不满足的行从掩码中去掉
+template <typename T>
+struct NoFilter {
+  explicit NoFilter(const CompareExpression* cmp) {}
+  bool Pass(T v) const { return true; }
+  void Mask(const T* data, int n, uint8_t* mask) const {}
+};
+
+template <typename T>
+struct GreaterFilter {
+  explicit GreaterFilter(const CompareExpression* cmp) : val(ColumnValueWrapper(&cmp->value).getFixedSizeValue<T>()) {}
+  bool Pass(T v) const { return v > val; }
+  void Mask(const T* data, int n, uint8_t* mask) const { FilterMask(data, n, GREATER, val, mask); }
+  T val;
+};
+
+template <typename T>
+struct EqualFilter {
+  explicit EqualFilter(const CompareExpression* cmp) : val(ColumnValueWrapper(&cmp->value).getFixedSizeValue<T>()) {}
+  bool Pass(T v) const { return v == val; }
+  void Mask(const T* data, int n, uint8_t* mask) const { FilterMask(data, n, EQUAL, val, mask); }
+  T val;
+};
+
+// 聚合函数，Type是列中的值类型
+//   Add       加入第pos个桶的一行
+//   Merge     加入kernel算出来的一段行的行数、和、最值，kMaskable为false的不支持
+//   MergeStat 加入blockmeta中整个block的统计值
+//   Result    第pos个桶的结果
+
+template <typename T>
+struct AvgOp {
+  using Type = T;
+  using TSum = typename MaskedAgg<T>::TSum;
+  static constexpr bool kMaskable = true;
+  struct State {
+    std::vector<int64_t> cnt;
+    std::vector<TSum> sum;
+    void Init(int n) {
+      cnt.assign(n, 0);
+      sum.assign(n, 0);
+    }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) {
+    s.cnt[pos]++;
+    s.sum[pos] += v;
+  }
+  static void Merge(State& s, int pos, const MaskedAgg<T>& m) {
+    s.cnt[pos] += m.cnt;
+    s.sum[pos] += m.sum;
+  }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    s.cnt[pos] += meta->num;
+    s.sum[pos] += layout.Sum<TSum>(meta, colid);
+  }
+  static ColumnValue Result(const State& s, int pos) {
+    return ColumnValue(s.cnt[pos] == 0 ? kDoubleNan : s.sum[pos] * 1.0 / s.cnt[pos]);
+  }
+};
+
+// int列用int64_t累加，结果和AVG一样是DOUBLE
+template <typename T>
+struct SumOp {
+  using Type = T;
+  using TSum = typename MaskedAgg<T>::TSum;
+  static constexpr bool kMaskable = true;
+  using State = typename AvgOp<T>::State;
+  static void Add(State& s, int pos, T v, int64_t ts) { AvgOp<T>::Add(s, pos, v, ts); }
+  static void Merge(State& s, int pos, const MaskedAgg<T>& m) { AvgOp<T>::Merge(s, pos, m); }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    AvgOp<T>::MergeStat(s, pos, layout, meta, colid);
+  }
+  static ColumnValue Result(const State& s, int pos) {
+    return ColumnValue(s.cnt[pos] == 0 ? kDoubleNan : (double)s.sum[pos]);
+  }
+};
+
+// 结果是INTEGER，全部被过滤掉的时候是0；超过INT_MAX的行数截断为INT_MAX
+template <typename T>
+struct CountOp {
+  using Type = T;
+  static constexpr bool kMaskable = true;
+  struct State {
+    std::vector<int64_t> cnt;
+    void Init(int n) { cnt.assign(n, 0); }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) { s.cnt[pos]++; }
+  static void Merge(State& s, int pos, const MaskedAgg<T>& m) { s.cnt[pos] += m.cnt; }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    s.cnt[pos] += meta->num;
+  }
+  static ColumnValue Result(const State& s, int pos) {
+    return ColumnValue((int)std::min<int64_t>(s.cnt[pos], std::numeric_limits<int>::max()));
+  }
+};
+
+// 累加器初始化为类型的最小值，不需要判断桶是否为空
+template <typename T>
+struct MaxOp {
+  using Type = T;
+  static constexpr bool kMaskable = true;
+  struct State {
+    std::vector<int64_t> cnt;
+    std::vector<T> max;
+    void Init(int n) {
+      cnt.assign(n, 0);
+      max.assign(n, std::numeric_limits<T>::lowest());
+    }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) {
+    s.cnt[pos]++;
+    s.max[pos] = std::max(s.max[pos], v);
+  }
+  static void Merge(State& s, int pos, const MaskedAgg<T>& m) {
+    s.cnt[pos] += m.cnt;
+    s.max[pos] = std::max(s.max[pos], m.max);
+  }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    s.cnt[pos] += meta->num;
+    s.max[pos] = std::max(s.max[pos], layout.Max<T>(meta, colid));
+  }
+  static ColumnValue Result(const State& s, int pos) { return ColumnValue(s.cnt[pos] == 0 ? AggNan<T>() : s.max[pos]); }
+};
+
+template <typename T>
+struct MinOp {
+  using Type = T;
+  static constexpr bool kMaskable = true;
+  struct State {
+    std::vector<int64_t> cnt;
+    std::vector<T> min;
+    void Init(int n) {
+      cnt.assign(n, 0);
+      min.assign(n, std::numeric_limits<T>::max());
+    }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) {
+    s.cnt[pos]++;
+    s.min[pos] = std::min(s.min[pos], v);
+  }
+  static void Merge(State& s, int pos, const MaskedAgg<T>& m) {
+    s.cnt[pos] += m.cnt;
+    s.min[pos] = std::min(s.min[pos], m.min);
+  }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    s.cnt[pos] += meta->num;
+    s.min[pos] = std::min(s.min[pos], layout.Min<T>(meta, colid));
+  }
+  static ColumnValue Result(const State& s, int pos) { return ColumnValue(s.cnt[pos] == 0 ? AggNan<T>() : s.min[pos]); }
+};
+
+// 时间戳最小的一行的值，时间戳相同的取先加入的
+template <typename T>
+struct FirstOp {
+  using Type = T;
+  static constexpr bool kMaskable = false;
+  struct State {
+    std::vector<int64_t> cnt;
+    std::vector<T> val;
+    std::vector<int64_t> ts;
+    void Init(int n) {
+      cnt.assign(n, 0);
+      val.assign(n, 0);
+      ts.assign(n, 0);
+    }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) {
+    if (s.cnt[pos]++ == 0 || ts < s.ts[pos]) {
+      s.val[pos] = v;
+      s.ts[pos] = ts;
+    }
+  }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    Add(s, pos, layout.First<T>(meta, colid), meta->min_ts);
+  }
+  static ColumnValue Result(const State& s, int pos) { return ColumnValue(s.cnt[pos] == 0 ? AggNan<T>() : s.val[pos]); }
+};
+
+// 时间戳最大的一行的值，时间戳相同的取先加入的
+template <typename T>
+struct LastOp {
+  using Type = T;
+  static constexpr bool kMaskable = false;
+  struct State {
+    std::vector<int64_t> cnt;
+    std::vector<T> val;
+    std::vector<int64_t> ts;
+    void Init(int n) {
+      cnt.assign(n, 0);
+      val.assign(n, 0);
+      ts.assign(n, 0);
+    }
+  };
+  static void Add(State& s, int pos, T v, int64_t ts) {
+    if (s.cnt[pos]++ == 0 || ts > s.ts[pos]) {
+      s.val[pos] = v;
+      s.ts[pos] = ts;
+    }
+  }
+  static void MergeStat(State& s, int pos, const BlockLayout& layout, const BlockMeta* meta, int colid) {
+    Add(s, pos, layout.Last<T>(meta, colid), meta->max_ts);
+  }
+  static ColumnValue Result(const State& s, int pos) { return ColumnValue(s.cnt[pos] == 0 ? AggNan<T>() : s.val[pos]); }
+};
+
+} // namespace LindormContest
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "struct/ColumnValue.h"
+#include "struct/Vin.h"
+
+namespace LindormContest {
+
+/**
+ * 列式结果中的一列，按列类型只使用其中一组buffer
+ * string列按 offsets + bytes 存储，第i行为 bytes[offsets[i], offsets[i+1])
+ */
+struct ColumnBuffer {
+  std::string name;
+  ColumnType type{COLUMN_TYPE_UNINITIALIZED};
+
+  std::vector<int32_t> ints;     // COLUMN_TYPE_INTEGER
+  std::vector<double> doubles;   // COLUMN_TYPE_DOUBLE_FLOAT
+  std::vector<uint32_t> offsets; // COLUMN_TYPE_STRING, offsets.size() == 行数 + 1
+  std::string bytes;             // COLUMN_TYPE_STRING
+
+  ColumnBuffer() = default;
+  ColumnBuffer(const std::string& col_name, ColumnType col_type) : name(col_name), type(col_type) { Clear(); }
+
+  void Reserve(size_t rows) {
+    switch (type) {
+      case COLUMN_TYPE_INTEGER:
+        ints.reserve(rows);
+        break;
+      case COLUMN_TYPE_DOUBLE_FLOAT:
+        doubles.reserve(rows);
+        break;
+      case COLUMN_TYPE_STRING:
+        offsets.reserve(rows + 1);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void Clear() {
+    ints.clear();
+    doubles.clear();
+    bytes.clear();
+    offsets.assign(1, 0);
+  }
+
+  std::pair<int32_t, const char*> GetString(size_t row) const {
+    return std::make_pair((int32_t)(offsets[row + 1] - offsets[row]), bytes.data() + offsets[row]);
+  }
+};
+
+/**
+ * 列式的time range查询结果，一个时间戳数组 + 每个请求列一个连续的数组，不需要为每一行构造Row
+ * columns 的顺序与 requestedColumns 的顺序(列名字典序)一致，行的顺序和executeTimeRangeQuery一样，不保证按时间戳有序
+ */
+struct ColumnBatch {
+  Vin vin;
+  std::vector<int64_t> timestamps;
+  std::vector<ColumnBuffer> columns;
+
+  size_t RowNum() const { return timestamps.size(); }
+
+  // 返回列在columns中的下标，不存在返回-1
+  int ColumnIndex(const std::string& name) const {
+    for (size_t i = 0; i < columns.size(); i++) {
+      if (columns[i].name == name) return i;
+    }
+    return -1;
+  }
+
+  void Clear() {
+    timestamps.clear();
+    columns.clear();
+  }
+};
+
+} // namespace LindormContest
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 
+#include "config.h"
 #include "util/likely.h"
 #include "util/logging.h"
 #include "util/slice.h"
@@ -16,36 +17,25 @@
 namespace LindormContest {
 
 
+// 分片数、调度线程数、缓存和缓冲区的大小等都是运行时配置，见 config.h
 #ifndef DEBUG_TEST
 constexpr int kColumnNum = 60;
 constexpr int kVinNum = 5000;
-constexpr int kShardBits = 7;
-// 按照vin进行分片的数量，最好保证和kVinNum是整除的关系，这样每个分片的vin数量是均匀的
-constexpr int kShardNum = 1 << kShardBits;
-constexpr int kVinNumPerShard = (kVinNum / kShardNum) + 1; // 打到每个memtable里面vin的个数
-constexpr int kMemtableRowNum = 256;                    // 一个memtable里面最多存储多少行数据
+constexpr int kMaxMemtableRowNum = 1024; // memtable行数的上限，实际行数见 EngineConfig::memtable_row_num
 constexpr int kExtraColNum = 1;
-constexpr int kWriteBufferSize = 256 * KB;
-constexpr size_t kReadCacheSize = 32 * MB;
-constexpr int kWorkerThread = 8;
-constexpr int kCoroutinePerThread = 32;
 // constexpr size_t kMemoryPoolSz = 1 * 1024 * MB; // 1GB临时内存
 #else
 constexpr int kColumnNum = 20;
 constexpr int kVinNum = 1024;
-constexpr int kShardBits = 4;
-// 按照vin进行分片的数量，最好保证和kVinNum是整除的关系，这样每个分片的vin数量是均匀的
-constexpr int kShardNum = 1 << kShardBits;
-constexpr int kVinNumPerShard = (kVinNum / kShardNum) + 1; // 打到每个memtable里面vin的个数
-constexpr int kMemtableRowNum = 16 * 32;                    // 一个memtable里面最多存储多少行数据
+constexpr int kMaxMemtableRowNum = 1024;
 constexpr int kExtraColNum = 3;
-constexpr int kWriteBufferSize = 4 * KB;
-constexpr size_t kReadCacheSize = 1024 * KB;
-constexpr int kWorkerThread = 8;
-constexpr int kCoroutinePerThread = 16;
 constexpr size_t kMemoryPoolSz = 1 * 1024 * MB; // 1GB临时内存
 #endif
 
+// kColumnNum 只是默认（测试用）schema的列数，存储结构都按createTable时实际的列数分配
+// 时间戳列的colid等于列数，ReadCache中colid为uint8_t，所以最多支持254列
+constexpr int kMaxColumnNum = 254;
+
 const int64_t _LONG_DOUBLE_NAN = 0xfff0000000000000L;
 const double kDoubleNan = *reinterpret_cast<const double *>(&_LONG_DOUBLE_NAN);
 constexpr int kIntNan = 0x80000000;
@@ -59,23 +49,24 @@ const std::string kTableName = "only_one"; // 目前就一张表，表名预留
 // 低位决定shard
 static inline int sharding(uint16_t vid) {
   LOG_ASSERT(vid < kVinNum, "vid = %d", vid);
-  return vid % kShardNum;
+  return vid & (g_config.shard_num - 1);
 }
 
 static inline int shard2tid(uint16_t shard) {
-  LOG_ASSERT(shard < kShardNum, "shard = %d", shard);
-  return shard % kWorkerThread;
+  LOG_ASSERT(shard < g_config.shard_num, "shard = %d", shard);
+  return shard % g_config.worker_thread;
 }
 
 // vid -->  shard 内序号
 static inline int vid2svid(uint16_t vid) {
-  LOG_ASSERT((vid >> kShardBits) < kVinNumPerShard, "idx = %d", vid >> kShardBits);
-  return vid >> kShardBits;
+  LOG_ASSERT((vid >> g_config.shard_bits) < g_config.vin_num_per_shard, "idx = %d", vid >> g_config.shard_bits);
+  return vid >> g_config.shard_bits;
 }
 
 static inline int svid2vid(int shard_id, int idx) {
-  LOG_ASSERT((shard_id + (idx << kShardBits)) < (kVinNumPerShard * kShardNum), "vid = %d", shard_id + (idx << kShardBits));
-  return shard_id + (idx << kShardBits);
+  LOG_ASSERT((shard_id + (idx << g_config.shard_bits)) < (g_config.vin_num_per_shard * g_config.shard_num),
+             "vid = %d", shard_id + (idx << g_config.shard_bits));
+  return shard_id + (idx << g_config.shard_bits);
 }
 
 static inline size_t rounddown512(size_t offset) { return offset & ~511; }
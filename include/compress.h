@@ -288,6 +288,13 @@ inline int StringArrCompress(std::string* data, uint16_t lens[], int cnt, uint16
   return 0;
 }
 
+// 解压之后的大小记在zstd的帧头里，BlockMeta不用再存
+inline size_t StringArrOriginSize(const char* compress_data, uint64_t compress_sz) {
+  unsigned long long sz = ZSTD_getFrameContentSize(compress_data, compress_sz);
+  LOG_ASSERT(sz != ZSTD_CONTENTSIZE_UNKNOWN && sz != ZSTD_CONTENTSIZE_ERROR, "invalid string block");
+  return sz;
+}
+
 inline int StringArrDeCompress(char* origin_buf, int origin_sz, char* compress_data, uint64_t compress_sz) {
   return ZSTDDeCompress(compress_data, origin_buf, compress_sz, origin_sz);
 }
@@ -352,14 +359,11 @@ inline int DoubleArrCompress(double double_arr[], int cnt, double min, double ma
   int low_bytes = low_bits / 8;
   uint64_t buf_low_sz = low_bytes * cnt;
   int skip = 12;
-  uint64_t buf_sz = 8 * cnt + skip; // 一次性分配好，后面压缩的直接追加在后面就好了
   int diff_cnt = 1;
-  buf = reinterpret_cast<char*>(naive_alloc(buf_sz));
   for (int i = 0; i < cnt; i++) {
     // 提取double的高位比特
     uint64_t binaryRepresentation = *reinterpret_cast<uint64_t*>(&double_arr[i]);
     high[i] = (binaryRepresentation >> (64-high_bits)) & high_mask;
-    memcpy(buf + low_bytes * i + skip, &double_arr[i], low_bytes);
     if (i == 0) {
       diff_cnt = 1;
       high_min = high[i];
@@ -374,6 +378,11 @@ inline int DoubleArrCompress(double double_arr[], int cnt, double min, double ma
   char* buf_high;
   uint64_t high_compress_size;
   TArrCompress(high, cnt, high_min, high_max, diff_cnt, buf_high, high_compress_size, MyColumnType::MyInt32);
+  // 高位压缩之后可能比原来的高位还大，压缩完再按实际大小分配
+  buf = reinterpret_cast<char*>(naive_alloc(buf_low_sz + high_compress_size + skip));
+  for (int i = 0; i < cnt; i++) {
+    memcpy(buf + low_bytes * i + skip, &double_arr[i], low_bytes);
+  }
   memcpy(buf + buf_low_sz + skip, buf_high, high_compress_size);
   compress_sz = buf_low_sz + high_compress_size + skip;
 
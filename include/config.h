@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace LindormContest {
+
+/**
+ * 引擎的运行时配置，connect的时候确定，之后不再修改
+ * 来源依次为 数据目录下的 engine.conf、环境变量（优先级更高），没有配置的项在Finalize的时候按照机器的核数和内存自动计算
+ *   engine.conf: 每行一个 key=value，'#' 开头为注释
+ *   环境变量: LINDORM_ + 大写的key，例如 LINDORM_WORKER_THREAD=4
+ * cpu_set 形如 "0-3,8,10-11"，调度线程tid绑定到 cpu_set[tid % size]，"none" 表示不绑核
+ * wal 为 off / async / sync，见 WalMode
+ * wal_checkpoint_size 日志总量超过这个大小时做一次checkpoint：下刷所有memtable并追加manifest编辑，之后删除旧的日志
+ * io_backend 为 auto / libaio / io_uring，auto在内核支持的时候用io_uring；sqpoll 为 on / off，只对io_uring生效
+ * simd 为 auto / scalar / sse4.2 / avx2，聚合kernel最多使用的指令集，auto为CPU支持的最快的一种
+ * rollup 为逗号分隔的分辨率列表，支持 ms/s/m/h/d 后缀，例如 "1m,1h,1d"，"none" 表示不维护rollup
+ *   写阶段rollup全部在内存中，每个vin每个桶占 16 + 24 * 数值列数 字节，分辨率越细占用越多
+ */
+enum class WalMode {
+  OFF,   // 不写日志，崩溃之后丢失上一次正常shutdown之后的所有数据
+  ASYNC, // 写日志，但write不等待日志落盘
+  SYNC,  // write返回时这次写入已经在日志中落盘
+};
+
+enum class IOBackend {
+  AUTO,     // 优先io_uring，不支持就用libaio
+  LIBAIO,
+  IO_URING, // 不支持的时候也退回libaio，并打印错误
+};
+
+enum class SimdLevel {
+  AUTO,
+  SCALAR,
+  SSE4_2,
+  AVX2, // CPU不支持的时候退回更低的指令集
+};
+
+struct EngineConfig {
+  // 数值为0表示自动计算
+  int shard_bits{0};
+  int worker_thread{0};
+  int coroutine_per_thread{0};
+  int memtable_row_num{0};       // 一个memtable最多存多少行，不能超过kMaxMemtableRowNum，自动计算时要等schema确定
+  int write_buffer_size{0};      // 每个shard的写缓冲区大小，512对齐
+  size_t segment_size{0};        // 段文件写到多大之后切换到新的段
+  size_t read_cache_size{0};     // 每个shard的读缓存大小
+  size_t wal_checkpoint_size{0}; // 所有调度线程的日志加起来写到多大之后做一次checkpoint
+  std::vector<int> cpu_set;
+  bool cpu_set_given{false};
+  WalMode wal_mode{WalMode::SYNC};
+  IOBackend io_backend{IOBackend::AUTO};
+  bool sqpoll{false}; // io_uring由内核线程轮询提交队列
+  SimdLevel simd{SimdLevel::AUTO};
+  std::vector<int64_t> rollup{3600 * 1000LL, 24 * 3600 * 1000LL}; // 从小到大排列的rollup分辨率，单位ms
+
+  // 由上面的配置推导出来的
+  int shard_num{0};
+  int vin_num_per_shard{0};
+
+  // 依次应用 data_dir/engine.conf 和环境变量中的配置
+  void Load(const std::string& data_dir);
+
+  // 设置一个配置项，key不认识或者value非法返回false
+  bool Set(const std::string& key, const std::string& value);
+
+  // 补全自动计算的配置项，校验并计算推导出来的值
+  void Finalize();
+
+  // schema确定之后（createTable或者加载已有的schema）按实际的列数计算memtable_row_num
+  void FinalizeMemtable(int column_num);
+
+  std::string ToString() const;
+
+  // 调度线程tid应该绑定的cpu，-1表示不绑核
+  int CpuOf(int tid) const { return cpu_set.empty() ? -1 : cpu_set[tid % cpu_set.size()]; }
+
+  // 当前进程可以使用的cpu
+  static std::vector<int> AvailableCpus();
+  // 可用内存，取物理内存和cgroup限制中较小的那个
+  static size_t AvailableMemory();
+};
+
+// 全局配置，程序启动时就按照机器配置初始化好，connect的时候重新加载
+extern EngineConfig g_config;
+
+} // namespace LindormContest
@@ -11,7 +11,8 @@
 
 class CoroutinePool {
  public:
-  CoroutinePool(int thread_num, int coroutine_per_thread);
+  // cpus非空时，第i个调度线程绑定到 cpus[i % cpus.size()]
+  CoroutinePool(int thread_num, int coroutine_per_thread, const std::vector<int>& cpus = {});
 
   void registerPollingFunc(AdvanceFunc func);
 
@@ -26,7 +26,8 @@ class Scheduler : public Coroutine {
   static constexpr int kYieldCnt = 32;
   static constexpr int kIDLECnt = 4;
 public:
-  explicit Scheduler(int coroutine_num, int tid);
+  // cpu为-1表示不绑核
+  explicit Scheduler(int coroutine_num, int tid, int cpu = -1);
   ~Scheduler();
   void registerPollingFunc(AdvanceFunc func) { polling_ = std::move(func); }
   void scheduling();
@@ -49,6 +50,7 @@ private:
   volatile bool stop = false;
   int coro_num_;
   int tid_;
+  int cpu_;
 
   std::atomic_int32_t task_num_{0};
 
@@ -15,32 +15,32 @@ static inline std::string NumToStr(T num) {
   return oss.str();
 }
 
-inline std::string ShardDataFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t shardid) {
+// shard的第segment个数据段，shard中所有vin的block都追加写到段里
+inline std::string SegmentFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t shardid,
+                                   uint32_t segment) {
   LOG_ASSERT(kDataDirPath != "", "kDataDirPath: %s", kDataDirPath.c_str());
-  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(shardid) + ".data";
+  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(shardid) + "_" + NumToStr<uint32_t>(segment) +
+         ".data";
 }
 
-inline std::string VinFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t vid) {
+// shard中分辨率为resolution毫秒的rollup，写阶段shutdown的时候一次写入
+inline std::string RollupFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t shardid,
+                                  int64_t resolution) {
   LOG_ASSERT(kDataDirPath != "", "kDataDirPath: %s", kDataDirPath.c_str());
-  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(vid) + ".data";
+  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(shardid) + "_" + NumToStr<int64_t>(resolution) +
+         ".rollup";
 }
 
-// 每个shard的元数据的文件名
-inline std::string ShardMetaFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t shardid) {
+// 持久化元数据（vin字典、block元数据、最新行、数据布局）的文件名
+inline std::string ManifestFileName(const std::string& kDataDirPath, const std::string& tableName) {
   LOG_ASSERT(kDataDirPath != "", "kDataDirPath: %s", kDataDirPath.c_str());
-  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(shardid) + ".meta";
+  return kDataDirPath + "/" + tableName + ".manifest";
 }
 
-// 存储vin到vid的映射关系的文件名
-inline std::string Vin2vidFileName(const std::string& kDataDirPath, const std::string& tableName) {
+// 写前日志的文件名，每次带着日志启动和每次checkpoint的时候gen加一，每个调度线程一个文件
+inline std::string WalFileName(const std::string& kDataDirPath, const std::string& tableName, uint32_t gen, int tid) {
   LOG_ASSERT(kDataDirPath != "", "kDataDirPath: %s", kDataDirPath.c_str());
-  return kDataDirPath + "/" + tableName + ".vin2vid";
-}
-
-// 存储每个vin所对应的最新ts的row的文件名
-inline std::string LatestRowFileName(const std::string& kDataDirPath, const std::string& tableName, uint16_t shardid) {
-  LOG_ASSERT(kDataDirPath != "", "kDataDirPath: %s", kDataDirPath.c_str());
-  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint16_t>(shardid) + ".latestrow";
+  return kDataDirPath + "/" + tableName + "_" + NumToStr<uint32_t>(gen) + "_" + NumToStr<int>(tid) + ".wal";
 }
 
 } // namespace LindormContest
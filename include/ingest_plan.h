@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include "struct/ColumnValue.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+/**
+ * createTable的时候根据schema编译出来的写入计划
+ * 把列号按类型分好组，写入时按列批量转置，不需要对每一个值做类型判断和虚函数调用
+ */
+struct IngestPlan {
+  std::vector<int> int_cols;
+  std::vector<int> double_cols;
+  std::vector<int> string_cols;
+
+  void Build(const ColumnType* types, int column_num) {
+    int_cols.clear();
+    double_cols.clear();
+    string_cols.clear();
+    for (int i = 0; i < column_num; i++) {
+      switch (types[i]) {
+        case COLUMN_TYPE_INTEGER:
+          int_cols.push_back(i);
+          break;
+        case COLUMN_TYPE_DOUBLE_FLOAT:
+          double_cols.push_back(i);
+          break;
+        case COLUMN_TYPE_STRING:
+          string_cols.push_back(i);
+          break;
+        case COLUMN_TYPE_UNINITIALIZED:
+          LOG_ASSERT(false, "column %d uninitialized", i);
+          break;
+      }
+    }
+  }
+};
+
+} // namespace LindormContest
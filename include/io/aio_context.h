@@ -0,0 +1,162 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "coroutine/coro_cond.h"
+#include "coroutine/scheduler.h"
+#include "util/libaio.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace LindormContest {
+
+/**
+ * 一个调度线程上所有异步文件共用的异步IO上下文
+ * 协程发起的IO先放进待提交队列，轮询的时候一次提交这个线程上所有文件的IO，再一次收割完成事件
+ * 有libaio和io_uring两种实现，New按照g_config.io_backend选择，内核不支持io_uring的时候退回libaio
+ * NOT THREAD-SAFE，只能在对应的调度线程上使用
+ */
+class AIOContext {
+public:
+  static constexpr int kMaxIONum = 256;
+
+  static AIOContext* New();
+
+  AIOContext();
+  virtual ~AIOContext() = default;
+
+  virtual const char* Name() const = 0;
+
+  // 还有能发起多少个IO
+  int avalibaleIOC() const { return free_list_.size(); }
+
+  // 等其他人IO结束释放IOC
+  void waitIOC() { cv_.wait(); }
+
+  // 把一个IO放进待提交队列，调用方保证avalibaleIOC() > 0
+  // file_index是RegisterFile返回的下标，-1表示直接用fd
+  void Prepare(bool write, int fd, int file_index, const char* buf, size_t length, off_t offset);
+
+  // 当前协程Prepare过、还没有等待的IO数
+  int TakeQueued();
+
+  // 提交所有待提交的IO，收割已经完成的IO并唤醒对应的协程
+  virtual void Poll() = 0;
+
+  // 把文件注册到上下文中，返回下标，不支持或者注册失败返回-1
+  virtual int RegisterFile(int fd) { return -1; }
+  virtual void UnregisterFile(int file_index) {}
+
+  // IO用的512对齐的缓冲区，io_uring会优先从预先注册的缓冲区中分配
+  virtual void* AllocBuffer(size_t sz);
+  virtual void FreeBuffer(void* buf);
+
+protected:
+  virtual void prepare(int slot, bool write, int fd, int file_index, const char* buf, size_t length,
+                       off_t offset) = 0;
+
+  // slot的IO完成了，唤醒发起IO的协程
+  void complete(int slot);
+
+  // 收割完一批之后调用，唤醒等待IOC的协程
+  void notifyIOC() { cv_.notify(); }
+
+  bool idle() const { return free_list_.size() == kMaxIONum; }
+
+private:
+  Coroutine* coros_[kMaxIONum];
+  std::vector<int> free_list_;
+  std::unordered_map<Coroutine*, int> queued_;
+  CoroCV cv_;
+};
+
+class LibaioContext : public AIOContext {
+public:
+  LibaioContext();
+  ~LibaioContext() override;
+
+  const char* Name() const override { return "libaio"; }
+
+  void Poll() override;
+
+protected:
+  void prepare(int slot, bool write, int fd, int file_index, const char* buf, size_t length, off_t offset) override;
+
+private:
+  io_context_t ctx_;
+  iocb cbs_[kMaxIONum];
+  std::vector<iocb*> pending_; // 还没有提交的IO，iocb在cbs_里，提交之前一直有效，提交不完的留到下一次轮询
+  io_event events_[kMaxIONum];
+};
+
+/**
+ * 直接用系统调用实现的io_uring，不依赖liburing
+ * 文件注册成固定文件，预先注册一块对齐的缓冲区，从中分配的IO用READ_FIXED/WRITE_FIXED，可选SQPOLL
+ */
+class UringContext : public AIOContext {
+public:
+  // 内核不支持返回nullptr
+  static UringContext* Create(bool sqpoll);
+
+  ~UringContext() override;
+
+  const char* Name() const override { return sqpoll_ ? "io_uring(sqpoll)" : "io_uring"; }
+
+  void Poll() override;
+
+  int RegisterFile(int fd) override;
+  void UnregisterFile(int file_index) override;
+
+  void* AllocBuffer(size_t sz) override;
+  void FreeBuffer(void* buf) override;
+
+protected:
+  void prepare(int slot, bool write, int fd, int file_index, const char* buf, size_t length, off_t offset) override;
+
+private:
+  static constexpr int kMaxFileNum = 1024;
+  static constexpr size_t kFixedBufferSize = 64 * 1024;
+  static constexpr int kFixedBufferNum = 32;
+
+  UringContext() = default;
+  bool init(bool sqpoll);
+  bool inFixedBuffer(const void* buf) const {
+    return fixed_buf_ != nullptr && buf >= fixed_buf_ && buf < fixed_buf_ + kFixedBufferSize * kFixedBufferNum;
+  }
+
+  int ring_fd_{-1};
+  bool sqpoll_{false};
+  void* ring_{nullptr}; // sq和cq共用一次映射
+  size_t ring_sz_{0};
+  ::io_uring_sqe* sqes_{nullptr};
+  size_t sqes_sz_{0};
+
+  unsigned* sq_tail_{nullptr};
+  unsigned* sq_flags_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned* cq_head_{nullptr};
+  unsigned* cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  ::io_uring_cqe* cqes_{nullptr};
+
+  unsigned local_tail_{0}; // 已经填好还没有对内核可见的sqe
+  unsigned to_submit_{0};  // 还没有被io_uring_enter接收的sqe，提交不完的留到下一次轮询
+
+  // 每个slot写请求的长度，读为0，写必须完整写完
+  uint32_t write_len_[kMaxIONum];
+
+  bool fixed_files_{false};
+  std::vector<int> free_file_index_;
+
+  char* fixed_buf_{nullptr};
+  bool fixed_buf_registered_{false};
+  std::vector<int> free_fixed_buf_;
+};
+
+} // namespace LindormContest
@@ -22,12 +22,13 @@ namespace LindormContest {
  */
 class AlignedWriteBuffer {
 public:
-  AlignedWriteBuffer(File* file) : file_(file) {
-    buffer_ = std::aligned_alloc(512, kWriteBufferSize);
-    ENSURE(buffer_ != nullptr, "std::aligned_alloc(512, kWriteBufferSize) failed");
-  }
+  AlignedWriteBuffer(File* file) : AlignedWriteBuffer(file, g_config.write_buffer_size) {}
 
-  AlignedWriteBuffer(File* file, size_t buffer_size) : file_(file) { posix_memalign(&buffer_, 512, buffer_size); }
+  AlignedWriteBuffer(File* file, size_t buffer_size) : size_(buffer_size), file_(file) {
+    LOG_ASSERT(buffer_size % 512 == 0, "buffer_size = %zu", buffer_size);
+    buffer_ = std::aligned_alloc(512, buffer_size);
+    ENSURE(buffer_ != nullptr, "std::aligned_alloc(512, %zu) failed", buffer_size);
+  }
 
   virtual ~AlignedWriteBuffer() {
     if (buffer_ != nullptr) {
@@ -41,29 +42,29 @@ public:
       RECORD_FETCH_ADD(flush_wait_cnt, 1);
       cv_.wait(); // 休眠当前协程，等待另一个协程对buf的flush结束
     }
-    LOG_ASSERT(offset_ <= kWriteBufferSize, "offset = %d", offset_);
+    LOG_ASSERT(offset_ <= size_, "offset = %d", offset_);
 
-    file_offset = flush_blk_num_ * kWriteBufferSize + offset_;
+    file_offset = flushed_sz_ + offset_;
 
     while (len != 0) {
-      int remain = kWriteBufferSize - offset_;
+      int remain = size_ - offset_;
       int copy_len = (remain >= len) ? len : remain;
 
       memcpy((char*)buffer_ + offset_, compressed_data, copy_len);
 
       offset_ += copy_len;
-      LOG_ASSERT(offset_ <= kWriteBufferSize, "offset = %d", offset_);
+      LOG_ASSERT(offset_ <= size_, "offset = %d", offset_);
 
       // buffer满了，下刷
-      if (offset_ == kWriteBufferSize) {
+      if (offset_ == size_) {
         // 异步写
         in_flush_ = true;
         // LOG_DEBUG("[tid %d] [coro %d] start flush.", this_coroutine::coro_scheduler()->tid(), this_coroutine::current()->id());
-        auto rc = file_->write((const char*)buffer_, kWriteBufferSize);
+        auto rc = file_->write((const char*)buffer_, size_);
         in_flush_ = false;
         cv_.notify(); // 通知其他协程开始flush数据
         LOG_ASSERT(rc == Status::OK, "async write io buffer failed.");
-        flush_blk_num_ += 1;
+        flushed_sz_ += size_;
         offset_ = 0;
       }
 
@@ -74,28 +75,43 @@ public:
 
   // 写阶段需要从未下刷完毕的buffer中读取数据
   void read(char* res_buf, size_t length, off_t off) {
-    LOG_ASSERT((uint64_t)(off % kWriteBufferSize) + (uint64_t)length <= (uint64_t)offset_,
-               "(pos mod kWriteBufferSize) = %ld, offset = %d", (off % kWriteBufferSize), offset_);
-    memcpy(res_buf, (char*)buffer_ + (off % kWriteBufferSize), length);
+    LOG_ASSERT((uint64_t)off >= flushed_sz_ && (uint64_t)off - flushed_sz_ + length <= (uint64_t)offset_,
+               "pos = %ld, flushed = %lu, offset = %d", off, flushed_sz_, offset_);
+    memcpy(res_buf, (char*)buffer_ + (off - flushed_sz_), length);
   }
 
+  // 把缓冲区中已有的数据按512对齐下刷，之后的数据接着对齐之后的位置继续写，同一个文件可以多次调用
   void flush() {
-    auto rc = file_->write((const char*)buffer_, kWriteBufferSize);
+    while (in_flush_) {
+      RECORD_FETCH_ADD(flush_wait_cnt, 1);
+      cv_.wait();
+    }
+    if (offset_ == 0) {
+      return;
+    }
+    size_t len = roundup512(offset_);
+    memset((char*)buffer_ + offset_, 0, len - offset_);
+    // 下刷期间查询还可以从缓冲区中读
+    in_flush_ = true;
+    auto rc = file_->write((const char*)buffer_, len);
+    in_flush_ = false;
+    cv_.notify();
     LOG_ASSERT(rc == Status::OK, "async write io buffer failed.");
+    flushed_sz_ += len;
     offset_ = 0;
-    struct stat st;
-    fstat(file_->fd(), &st);
-    // LOG_DEBUG("file name%s, file write size %lu, file sz %lu", file_->getFileName().c_str(), st.st_size,
-    //           file_->getFileSz());
   }
 
   bool empty() { return offset_ == 0; }
 
-  const size_t FlushedSz() const { return flush_blk_num_ * kWriteBufferSize; }
+  const size_t FlushedSz() const { return flushed_sz_; }
+
+  // 已经写入的数据量，包括还在缓冲区里的
+  size_t WrittenSz() const { return FlushedSz() + offset_; }
 
 private:
+  const int size_; // 缓冲区大小，512对齐
   void* buffer_ = nullptr;
-  int flush_blk_num_ = 0; // 已经下刷了多少个块了
+  uint64_t flushed_sz_ = 0; // 已经下刷到文件中的长度，512对齐
   int offset_ = 0;
   File* file_;
   volatile bool in_flush_{false};
@@ -5,11 +5,15 @@
 #include <unistd.h>
 
 #include <cstdio>
+#include <cstring>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "common.h"
 #include "coroutine/coro_cond.h"
 #include "coroutine/scheduler.h"
+#include "io/aio_context.h"
 #include "status.h"
 #include "util/libaio.h"
 #include "util/likely.h"
@@ -157,22 +161,15 @@ public:
   };
 };
 
+/**
+ * O_DIRECT的异步文件，IO通过所在调度线程的AIOContext提交
+ * async_write/async_read只是把IO放进队列，burst等待当前协程放进队列的所有IO完成
+ */
 class AsyncFile : public File {
 public:
-  static constexpr int kMaxIONum = 8;
-  struct IOContext {
-    Coroutine* coro;
-    AsyncFile* file;
-    iocb cb;
-  };
+  AsyncFile(const std::string& filename, AIOContext* aio) : File(filename), aio_(aio) {}
 
-  AsyncFile(const std::string& filename) : File(filename) {
-    memset(&ctx_, 0, sizeof(io_context_t));
-    for (int i = 0; i < kMaxIONum; i++) {
-      iocb_data_[i].coro = nullptr;
-      iocb_data_[i].file = this;
-    }
-  }
+  ~AsyncFile() override { aio_->UnregisterFile(file_index_); }
 
   virtual Status async_write(const char* buf, size_t length) {
     LOG_ASSERT(false, "Not implemented");
@@ -184,59 +181,32 @@ public:
     return Status::NotSupported;
   }
 
-  virtual Status burst() {
-    LOG_ASSERT(false, "Not implemented");
-    return Status::NotSupported;
-  }
-
-  virtual ~AsyncFile() { io_destroy(ctx_); }
-
-  static void done(IOContext* ioctx) {
-    ioctx->coro->wakeup_once();
-    ioctx->coro = nullptr;
-    ioctx->file->inflight_--;
-    ioctx->file->cv_.notify();
-    ioctx->file->ctx_list_.push_back(ioctx);
+  Status burst() {
+    this_coroutine::co_wait(aio_->TakeQueued());
+    return Status::OK;
   }
 
-  io_context_t* getAIOContext() { return &ctx_; }
+  AIOContext* aio() const { return aio_; }
 
-  // 还有能发起多少个IO
-  int avalibaleIOC() const {
-    ENSURE(inflight_ >= 0 && inflight_ < kMaxIONum, "invalid inflight %d", inflight_);
-    return kMaxIONum - inflight_;
+protected:
+  // IO上下文用完了就先等别人的IO结束
+  void waitAvailable() {
+    while (aio_->avalibaleIOC() <= 0) {
+      aio_->waitIOC();
+    }
   }
 
-  // 等其他人IO结束释放IOC
-  void waitIOC() { cv_.wait(); }
-
-protected:
-  struct batch_job {
-    const char* buf;
-    uint32_t size;
-    int32_t offset;
-  };
-  batch_job batchs_[kMaxIONum];
-  int batch_idx_{0};
-
-  io_context_t ctx_;
-  IOContext iocb_data_[kMaxIONum];
-  std::list<IOContext*> ctx_list_;
-  volatile int inflight_{0};
-  CoroCV cv_;
+  AIOContext* aio_;
+  int file_index_{-1}; // 在aio_中注册的下标，io_uring用固定文件提交
 };
 
 class AsyncWriteFile : public AsyncFile {
 public:
-  AsyncWriteFile(const std::string& filename) : AsyncFile(filename) {
-    fd_ = open(filename.c_str(), LIBAIO_FLAG, S_IRUSR | S_IWUSR);
+  // extra_flags追加到LIBAIO_FLAG上，例如O_DSYNC让每次写完成时数据和文件长度都已经落盘
+  AsyncWriteFile(const std::string& filename, AIOContext* aio, int extra_flags = 0) : AsyncFile(filename, aio) {
+    fd_ = open(filename.c_str(), LIBAIO_FLAG | extra_flags, S_IRUSR | S_IWUSR);
     LOG_ASSERT(fd_ >= 0, "fd_ is %d", fd_);
-
-    int ret = io_setup(kMaxIONum, &ctx_);
-    LOG_ASSERT(ret == 0, "io_setup error ret = %d", ret);
-    for (int i = 0; i < kMaxIONum; i++) {
-      ctx_list_.push_back(&iocb_data_[i]);
-    }
+    file_index_ = aio_->RegisterFile(fd_);
   }
 
   // NOT THREAD-SAFE，上层需要保证buf、len、offset都是512对齐的
@@ -248,57 +218,22 @@ public:
 
   // NOT THREAD-SAFE，上层需要保证buf、len、offset都是512对齐的
   Status async_write(const char* buf, size_t length) override {
-    ENSURE(inflight_ >= 0 && inflight_ < kMaxIONum, "too many parallel write");
     ENSURE((length & 511) == 0, "invalid length.");
     ENSURE(((uint64_t)buf & 511) == 0, "invalid buf address.");
-
-    auto& job = batchs_[batch_idx_++];
-    job.size = length;
-    job.buf = buf;
-    job.offset = file_sz_;
+    // 等待之后再分配偏移，中间不会让出协程，同一个文件的追加写不会错乱
+    waitAvailable();
+    aio_->Prepare(true, fd_, file_index_, buf, length, file_sz_);
     file_sz_ += length;
-    inflight_++;
-
-    // LOG_DEBUG("[coro %d] [file %s] async write", this_coroutine::current()->id(), this->filename_.c_str());
-    return Status::OK;
-  }
-
-  Status burst() override {
-    iocb ios[batch_idx_];
-    iocb *iosp[batch_idx_];
-    for (int i = 0; i < batch_idx_; i++) {
-      iosp[i] = &ios[i];
-    }
-    for (int i = 0; i < batch_idx_; i++) {
-      auto& job = batchs_[i];
-      iocb* io = &ios[i];
-      io_prep_pwrite(io, fd_, (void*)job.buf, job.size, job.offset);
-
-      IOContext* ioctx = ctx_list_.front();
-      ctx_list_.pop_front();
-      ioctx->coro = this_coroutine::current();
-      io->data = ioctx;
-    }
-    int ret = io_submit(ctx_, batch_idx_, iosp);
-    ENSURE(ret == batch_idx_, "io_submit failed");
-    int cnt = batch_idx_;
-    batch_idx_ = 0;
-    this_coroutine::co_wait(cnt);
     return Status::OK;
   }
 };
 
 class AsyncRandomAccessFile : public AsyncFile {
 public:
-  AsyncRandomAccessFile(const std::string& filename) : AsyncFile(filename) {
+  AsyncRandomAccessFile(const std::string& filename, AIOContext* aio) : AsyncFile(filename, aio) {
     fd_ = open(filename.c_str(), O_RDONLY, S_IRUSR | S_IWUSR);
     LOG_ASSERT(fd_ >= 0, "fd_ is %d", fd_);
-
-    int ret = io_setup(kMaxIONum, &ctx_);
-    LOG_ASSERT(ret == 0, "io_setup error ret = %d", ret);
-    for (int i = 0; i < kMaxIONum; i++) {
-      ctx_list_.push_back(&iocb_data_[i]);
-    }
+    file_index_ = aio_->RegisterFile(fd_);
   }
 
   // NOT THREAD-SAFE，上层需要保证buf、len、offset都是512对齐的
@@ -310,41 +245,11 @@ public:
 
   // NOT THREAD-SAFE，上层需要保证buf、len、offset都是512对齐的
   Status async_read(char* res_buf, size_t length, off_t pos) override {
-    ENSURE(inflight_ >= 0 && inflight_ < kMaxIONum, "too many parallel read");
     ENSURE((length & 511) == 0, "invalid length.");
     ENSURE(((uint64_t)res_buf & 511) == 0, "invalid res_buf.");
     ENSURE((pos & 511) == 0, "invalid pos.");
-
-    auto& job = batchs_[batch_idx_++];
-    job.size = length;
-    job.buf = res_buf;
-    job.offset = pos;
-
-    inflight_++;
-    return Status::OK;
-  }
-
-  Status burst() override {
-    iocb ios[batch_idx_];
-    iocb *iosp[batch_idx_];
-    for (int i = 0; i < batch_idx_; i++) {
-      iosp[i] = &ios[i];
-    }
-    for (int i = 0; i < batch_idx_; i++) {
-      auto& job = batchs_[i];
-      iocb* io = &ios[i];
-      io_prep_pread(io, fd_, (void*)job.buf, job.size, job.offset);
-
-      IOContext* ioctx = ctx_list_.front();
-      ctx_list_.pop_front();
-      ioctx->coro = this_coroutine::current();
-      io->data = ioctx;
-    }
-    int ret = io_submit(ctx_, batch_idx_, iosp);
-    ENSURE(ret == batch_idx_, "io_submit failed");
-    int cnt = batch_idx_;
-    batch_idx_ = 0;
-    this_coroutine::co_wait(cnt);
+    waitAvailable();
+    aio_->Prepare(false, fd_, file_index_, res_buf, length, pos);
     return Status::OK;
   }
 };
@@ -2,11 +2,14 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
 #include <fstream>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "common.h"
 #include "io/file.h"
 #include "util/libaio.h"
 #include "util/rwlock.h"
@@ -18,6 +21,14 @@ namespace LindormContest {
  */
 class IOManager {
 public:
+  // 每个调度线程一个aio context，线程上的所有异步文件共用
+  IOManager() : aio_ctxs_(g_config.worker_thread, nullptr), async_files_(g_config.worker_thread) {
+    for (auto& aio : aio_ctxs_) {
+      aio = AIOContext::New();
+    }
+    LOG_INFO("async io backend: %s", aio_ctxs_[0]->Name());
+  }
+
   bool Exist(std::string filename) { return access(filename.c_str(), F_OK) != -1; }
 
   File* Open(std::string filename, int flag) {
@@ -46,44 +57,44 @@ public:
     return file;
   }
 
-  File* OpenAsyncWriteFile(std::string filename, int tid) {
-    auto it = opened_files_.find(filename);
-    if (it != opened_files_.cend()) {
-      auto pFileOut = it->second;
-      return pFileOut;
-    }
+  // 异步文件只能在tid对应的调度线程上打开（或者调度线程还没有启动），轮询的时候不需要加锁
+  File* OpenAsyncWriteFile(std::string filename, int tid, int extra_flags = 0) {
+    return openAsyncFile<AsyncWriteFile>(filename, tid, extra_flags);
+  }
 
-    auto* file = new AsyncWriteFile(filename);
-    io_ctxs_[tid].push_back(file->getAIOContext());
-    opened_files_.insert(std::make_pair(filename, file));
-    return file;
+  File* OpenAsyncReadFile(std::string filename, int tid) { return openAsyncFile<AsyncRandomAccessFile>(filename, tid); }
+
+  // 关闭tid上的一个异步文件，只能在tid对应的调度线程上调用，文件上不能还有没完成的IO
+  void CloseAsyncFile(File* file, int tid) {
+    auto& files = async_files_[tid];
+    auto it = std::find(files.begin(), files.end(), file);
+    LOG_ASSERT(it != files.end(), "file %s is not opened on tid %d", file->getFileName().c_str(), tid);
+    files.erase(it);
+    rwlock.wlock();
+    opened_files_.erase(file->getFileName());
+    rwlock.unlock();
+    delete file;
   }
 
-  File* OpenAsyncReadFile(std::string filename, int tid) {
-    auto it = opened_files_.find(filename);
-    if (it != opened_files_.cend()) {
-      auto pFileOut = it->second;
-      return pFileOut;
+  // 关闭tid上的所有异步文件并销毁它的aio context，同样只能在tid对应的调度线程上调用
+  // 销毁aio context要等内核的宽限期，所有调度线程各自关闭可以把等待重叠起来
+  void CloseAsyncFiles(int tid) {
+    for (auto file : async_files_[tid]) {
+      rwlock.wlock();
+      opened_files_.erase(file->getFileName());
+      rwlock.unlock();
+      delete file;
     }
-
-    auto* file = new AsyncRandomAccessFile(filename);
-    io_ctxs_[tid].push_back(file->getAIOContext());
-    opened_files_.insert(std::make_pair(filename, file));
-    return file;
+    async_files_[tid].clear();
+    delete aio_ctxs_[tid];
+    aio_ctxs_[tid] = nullptr;
   }
 
+  // 每次轮询只有一次io_submit和一次io_getevents，和打开的文件数无关
   void PollingIOEvents() {
-    timespec timeout = {0, 0};
-    int ev_cnt = 0;
-    auto sched = this_coroutine::coro_scheduler()->tid();
-    for (auto ioctx : io_ctxs_[sched]) {
-      if ((ev_cnt = io_getevents(*ioctx, 1, AsyncFile::kMaxIONum, (io_event *)events_[sched], &timeout)) != 0) {
-        for (int i = 0; i < ev_cnt; i++) {
-          AsyncFile::IOContext* io = reinterpret_cast<AsyncFile::IOContext*>(events_[sched][i].data);
-          AsyncFile::done(io);
-        }
-      }
-      ev_cnt = 0;
+    auto aio = aio_ctxs_[this_coroutine::coro_scheduler()->tid()];
+    if (LIKELY(aio != nullptr)) {
+      aio->Poll();
     }
   }
 
@@ -91,12 +102,35 @@ public:
     for (const auto& pair : opened_files_) {
       delete pair.second;
     }
+    for (auto aio : aio_ctxs_) {
+      delete aio;
+    }
   }
 
 private:
+  template <typename TFile, typename... Args>
+  File* openAsyncFile(const std::string& filename, int tid, Args... args) {
+    rwlock.rlock();
+    auto it = opened_files_.find(filename);
+    if (it != opened_files_.cend()) {
+      auto pFileOut = it->second;
+      rwlock.unlock();
+      return pFileOut;
+    }
+    rwlock.unlock();
+
+    LOG_ASSERT(aio_ctxs_[tid] != nullptr, "aio context of tid %d is closed", tid);
+    auto* file = new TFile(filename, aio_ctxs_[tid], args...);
+    async_files_[tid].push_back(file);
+    rwlock.wlock();
+    opened_files_.insert(std::make_pair(filename, file));
+    rwlock.unlock();
+    return file;
+  }
+
   RWLock rwlock;
-  volatile io_event events_[kWorkerThread][AsyncFile::kMaxIONum];
-  std::vector<io_context_t*> io_ctxs_[kWorkerThread];
+  std::vector<AIOContext*> aio_ctxs_;
+  std::vector<std::vector<AsyncFile*>> async_files_;
   std::unordered_map<std::string, File*> opened_files_;
 };
 
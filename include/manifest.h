@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BlockMetaManager.h"
+#include "TSDBEngine.hpp"
+
+namespace LindormContest {
+
+/**
+ * 持久化元数据的manifest，整个文件mmap进来直接使用，启动时间和block的数量无关
+ * 文件由若干次编辑（edit）组成，写阶段每次checkpoint和正常shutdown各追加一次编辑，不重写之前的内容
+ *   edit: [vin section][block section][block index][latest section][latest index][Footer]
+ *   vin section:    vin_cnt个17字节的vin，vid从first_vid开始连续
+ *   block section:  定长的BlockMeta，同一个vid的block连续存放，间隔为BlockLayout::Stride()
+ *   block index:    BlockIndex数组，每个vid一项
+ *   latest section: 每个vid最新的一行，ts + 按列号顺序的列值(int 4字节，double 8字节，string 4字节长度+内容)
+ *   latest index:   LatestIndex数组，每个vid一项，同一个vid以后面的编辑为准
+ * 文件中的偏移都是相对于文件开头的，每一段都8字节对齐
+ * 编辑先写内容再写Footer，两次之间fdatasync，Footer完整就说明这次编辑完整
+ * 崩溃时没有写完的编辑被忽略，以之前最后一次完整的编辑为准，下一次追加的时候截掉
+ */
+class Manifest {
+public:
+  static constexpr uint64_t kMagic = 0x54534D4E414D444CULL; // "LDMANMST"
+  static constexpr uint32_t kVersion = 4;
+  static constexpr uint64_t kNoPrev = UINT64_MAX;
+  // Footer::flags
+  static constexpr uint32_t kClosed = 1; // 写阶段正常shutdown时的编辑，之后的日志都没有用了
+
+  struct BlockIndex {
+    uint16_t vid;
+    uint16_t reserved;
+    uint32_t cnt;
+    uint64_t off;
+  };
+
+  struct LatestIndex {
+    uint16_t vid;
+    uint16_t reserved;
+    uint32_t len;
+    uint64_t off;
+  };
+
+  struct Footer {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t column_num;
+    // 数据布局相关的配置，读阶段必须沿用
+    uint32_t shard_bits;
+    uint32_t memtable_row_num;
+    uint32_t block_stride; // 一个BlockMeta的大小，由schema决定
+    uint32_t flags;
+    uint64_t prev_footer; // 上一次编辑的Footer的偏移，kNoPrev表示这是第一次编辑
+    uint32_t wal_gen;     // 到这次编辑为止，gen小于wal_gen的日志中的行都已经在manifest中了
+    uint32_t first_vid;
+    uint32_t vin_cnt;
+    uint32_t reserved;
+    uint64_t vin_off;
+    uint32_t block_index_cnt;
+    uint32_t latest_cnt;
+    uint64_t block_index_off;
+    uint64_t latest_index_off;
+    uint64_t checksum; // 以上字段的校验和
+  };
+
+  // 一次编辑在映射中的位置
+  struct Edit {
+    const Footer* footer;
+    const char* vins;
+    const BlockIndex* blocks;
+    const LatestIndex* latest;
+  };
+
+  ~Manifest() { Close(); }
+
+  // 映射已有的manifest，文件不存在或者没有完整的编辑返回false，末尾没有写完的编辑被忽略
+  bool Open(const std::string& filename);
+
+  // 解除映射，之后所有指向manifest中的BlockMeta都失效
+  void Close();
+
+  bool Valid() const { return !edits_.empty(); }
+
+  const Footer& Last() const { return *edits_.back().footer; }
+
+  // 最后一次编辑的Footer在文件中的偏移
+  uint64_t LastOffset() const { return reinterpret_cast<const char*>(edits_.back().footer) - base_; }
+
+  // 按写入顺序排列的所有编辑
+  const std::vector<Edit>& Edits() const { return edits_; }
+
+  char* At(uint64_t off) const { return base_ + off; }
+
+  static uint64_t Checksum(const Footer& footer);
+
+private:
+  // off处是不是一个完整的Footer
+  bool validFooter(uint64_t off) const;
+
+  char* base_{nullptr};
+  size_t size_{0};
+  std::vector<Edit> edits_;
+};
+
+// 一次编辑的内容，先在内存中拼好，再一次追加到manifest的末尾
+class ManifestEditBuilder {
+public:
+  ManifestEditBuilder(const BlockLayout& layout, uint32_t first_vid)
+      : column_num_(layout.ColumnNum()), block_stride_(layout.Stride()), first_vid_(first_vid) {}
+
+  // vid必须从first_vid开始连续添加
+  void AddVin(const char* vin);
+
+  void AddBlocks(uint16_t vid, const std::vector<BlockMeta*>& blocks);
+
+  void AddLatestRow(uint16_t vid, int64_t ts, const std::vector<ColumnValue>& cols);
+
+  // 合并另一个builder中的block和最新行，用于多个shard并行编码之后汇总
+  void Merge(const ManifestEditBuilder& other);
+
+  // 追加到上一次编辑的后面，prev_footer是上一次编辑的Footer的偏移，没有则是Manifest::kNoPrev
+  // 上一次编辑之后残留的内容（没有写完的编辑）会被截掉，返回这次编辑的Footer的偏移
+  uint64_t AppendTo(const std::string& filename, uint64_t prev_footer, uint32_t wal_gen, uint32_t flags);
+
+private:
+  int column_num_;
+  size_t block_stride_;
+  uint32_t first_vid_;
+  uint32_t vin_cnt_{0};
+  std::string vins_;
+  std::string blocks_;
+  std::vector<Manifest::BlockIndex> block_index_; // off暂时是相对blocks_的偏移
+  std::string latest_;
+  std::vector<Manifest::LatestIndex> latest_index_; // off暂时是相对latest_的偏移
+};
+
+// 解析latest section中的一行，返回时间戳
+int64_t DecodeLatestRow(const char* image, int column_num, const ColumnType* types, std::vector<ColumnValue>& cols);
+
+} // namespace LindormContest
@@ -3,9 +3,11 @@
 #include <cstdint>
 #include <cstring>
 #include <utility>
+#include <vector>
 
 #include "InternalColumnArr.h"
 #include "TSDBEngineImpl.h"
+#include "column_batch.h"
 #include "common.h"
 #include "coroutine/coro_cond.h"
 #include "filename.h"
@@ -29,7 +31,7 @@ public:
   MemTable(int shard_id, TSDBEngineImpl* engine) : engine_(engine), shard_id_(shard_id), cnt_(0) {}
 
   virtual ~MemTable() {
-    for (int i = 0; i < kColumnNum; i++) {
+    for (int i = 0; i < column_num_; i++) {
       LOG_ASSERT(columnArrs_[i] != nullptr, "nullptr");
       delete columnArrs_[i];
     }
@@ -42,9 +44,14 @@ public:
   void Init();
 
   /**
-   * 写入一行数据到memtable，会将其所有列分别加到对应列的数组当中, 满了就返回true
+   * 把同一个vid的多行按列转置写入memtable，返回实际写入的行数（memtable满了就只写一部分）
    */
-  bool Write(uint16_t vid, const Row& row);
+  int WriteRows(const Row* const* rows, int n);
+
+  bool Full() const { return cnt_ >= g_config.memtable_row_num; }
+
+  // 下刷之前统计每个数值列的sum/max/min/first/last，填到stats_里面
+  void ComputeStats();
 
   void GetLatestRow(uint16_t svid, const std::vector<int>& colids, Row& row);
 
@@ -52,6 +59,10 @@ public:
   void GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
                             const std::vector<int>& colids, std::vector<Row>& results);
 
+  // 写阶段从memtable中读取time-range，列式输出，batch.columns[k]对应colids[k]
+  void GetColumnsFromTimeRange(int64_t lowerInclusive, int64_t upperExclusive, const std::vector<int>& colids,
+                               ColumnBatch& batch);
+
   // 清空状态
   void Reset();
 
@@ -77,6 +88,10 @@ private:
 
   // std::string *engine->columnsName; // The column's name for each column.
   ColumnArrWrapper** columnArrs_;
+  // 按照ingest plan解析好的各类型列，下标和plan中的列号数组一一对应
+  std::vector<int*> int_data_;
+  std::vector<double*> double_data_;
+  std::vector<StringArrWrapper*> string_arrs_;
   // VidArrWrapper* svid_col_;
   TsArrWrapper* ts_col_;
   // IdxArrWrapper* idx_col_;
@@ -85,8 +100,8 @@ private:
   int64_t min_ts_;
   int64_t max_ts_;
 
-  uint64_t max_val_[kColumnNum];
-  uint64_t sum_val_[kColumnNum];
+  int column_num_{0}; // schema的列数，Init的时候确定
+  ColumnStats stats_;
 
   // mem latest row idx and ts
   int64_t mem_latest_row_idx_;
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "InternalColumnArr.h"
+#include "agg_kernels.h"
+#include "struct/ColumnValue.h"
+
+namespace LindormContest {
+
+/**
+ * 一个shard在某个分辨率上的rollup：每个vin按时间对齐到分辨率的桶，保存桶内的行数和每个数值列的sum/max/min，
+ * 降采样的interval是分辨率的整数倍的时候直接用桶的统计值，不用解压原始数据
+ * 写阶段每次Flush把memtable中的行加入内存中的桶，shutdown的时候在manifest之前一次写入文件，
+ * 读阶段整个文件mmap进来直接使用
+ *   文件: [按svid顺序，每个svid的桶按ts排序连续存放][Index数组][Footer]
+ *   桶:   [ts int64][cnt int64][按列号顺序每个数值列 sum 8字节, max 8字节, min 8字节]
+ *         int列的sum是int64_t，max/min是int，double列都是double
+ */
+class Rollup {
+public:
+  static constexpr uint64_t kMagic = 0x50554C4C4F52444CULL; // "LDROLLUP"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kHeadSize = 2 * sizeof(int64_t);
+  static constexpr size_t kStatSize = 3 * sizeof(int64_t);
+
+  struct Index {
+    uint16_t svid;
+    uint16_t reserved;
+    uint32_t cnt;
+    uint64_t off;
+  };
+
+  struct Footer {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t column_num;
+    int64_t resolution;
+    uint32_t stride;
+    uint32_t index_cnt;
+    uint64_t index_off;
+    uint64_t checksum; // 以上字段的校验和
+  };
+
+  Rollup(int64_t resolution, const ColumnType* types, int column_num, int vin_num);
+  ~Rollup();
+
+  int64_t Resolution() const { return resolution_; }
+  size_t Stride() const { return stride_; }
+
+  // 桶中的字段
+  static int64_t Ts(const char* rec) { return load<int64_t>(rec); }
+  static int64_t Cnt(const char* rec) { return load<int64_t>(rec + sizeof(int64_t)); }
+  const char* Stat(const char* rec, int colid) const { return rec + kHeadSize + slot_[colid] * kStatSize; }
+
+  // 把一个下刷的memtable中的行加入对应的桶，cols按列号索引
+  void Add(uint16_t svid, const int64_t* tss, int n, ColumnArrWrapper* const* cols);
+
+  // 写阶段shutdown的时候写入文件
+  void Save(const std::string& filename) const;
+
+  // 读阶段映射已经写好的文件，文件不存在或者和schema、分辨率不一致返回false
+  bool Load(const std::string& filename);
+
+  // svid中ts在[lo, hi)的桶，返回第一个桶，n为桶数，只有Load之后才有
+  const char* Find(uint16_t svid, int64_t lo, int64_t hi, int& n) const;
+
+  // 桶中一列的统计值，和kernel的聚合结果是同样的含义
+  template <typename T>
+  static MaskedAgg<T> LoadStat(int64_t cnt, const char* stat) {
+    MaskedAgg<T> m;
+    m.cnt = cnt;
+    m.sum = load<typename MaskedAgg<T>::TSum>(stat);
+    m.max = load<T>(stat + sizeof(int64_t));
+    m.min = load<T>(stat + 2 * sizeof(int64_t));
+    return m;
+  }
+
+  template <typename T>
+  static void StoreStat(const MaskedAgg<T>& m, char* stat) {
+    memcpy(stat, &m.sum, sizeof(m.sum));
+    memcpy(stat + sizeof(int64_t), &m.max, sizeof(T));
+    memcpy(stat + 2 * sizeof(int64_t), &m.min, sizeof(T));
+  }
+
+  static uint64_t Checksum(const Footer& footer);
+
+private:
+  template <typename T>
+  static T load(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+  }
+
+  char* stat(char* rec, int colid) const { return rec + kHeadSize + slot_[colid] * kStatSize; }
+
+  int64_t bucketOf(int64_t ts) const { return ts - ((ts % resolution_) + resolution_) % resolution_; }
+
+  // svid中ts这个桶，没有就按顺序插入一个空桶
+  char* bucket(uint16_t svid, int64_t ts);
+
+  template <typename T, typename TWrapper>
+  void addStat(char* rec, int colid, ColumnArrWrapper* col, int begin, int end);
+
+  int64_t resolution_;
+  const ColumnType* types_;
+  int column_num_;
+  std::vector<int> slot_; // 列号对应的统计值位置，string列为-1
+  size_t stride_;
+
+  std::vector<std::string> mem_; // 写阶段按svid存放的桶
+
+  char* base_{nullptr};
+  size_t size_{0};
+  std::vector<const char*> mapped_; // 读阶段按svid索引的桶
+  std::vector<uint32_t> mapped_cnt_;
+};
+
+} // namespace LindormContest
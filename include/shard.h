@@ -1,8 +1,11 @@
 #pragma once
 #include <unordered_map>
 
-#include "agg.h"
+#include "bucket_agg.h"
+#include "column_batch.h"
+#include "manifest.h"
 #include "memtable.h"
+#include "rollup.h"
 #include "util/likely.h"
 #include "util/util.h"
 namespace LindormContest {
@@ -50,23 +53,45 @@ public:
     return dynamic_cast<TColumn*>(res);
   };
 
+  // 预读用，缓存里既没有空闲也没有能剔除的空间时不等待，直接返回nullptr
+  template <typename TColumn>
+  TColumn* TryReserveDataArr(BlockMeta* meta, uint8_t colid) {
+    auto res = new TColumn(colid);
+    if (!TryPutColumn(meta, colid, res)) {
+      delete res;
+      return nullptr;
+    }
+    return res;
+  };
+
   Status PutColumn(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data);
 
+  bool TryPutColumn(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data);
+
   ColumnArrWrapper* GetColumn(BlockMeta* meta, uint8_t colid);
 
+  // 只检查是否在缓存中（包括正在填充的），不增加引用也不会等待
+  bool Contains(BlockMeta* meta, uint8_t colid) const { return cache_.count({.ptr = meta, .colid = colid}) > 0; }
+
+  size_t Capacity() const { return max_sz_; }
+
   void Release(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* data);
 
   // 因为string类型的Column只能在数据读取之后才知道真正size，需要在再进行一次LRU修正，以免cache被string类型冲爆
-  void ReviseCacheSize(StringArrWrapper* col) {
-    size_t placeholder_sz = 2 * sizeof(ColumnArr<std::string>);
+  // wait为false时只剔除LRU中已有的列，不等待其他协程Release
+  void ReviseCacheSize(StringArrWrapper* col, bool wait = true) {
+    size_t placeholder_sz = col->PlaceholderSize();
     ENSURE(total_sz_ >= placeholder_sz, "invalid total_sz %zu", total_sz_);
     total_sz_ -= placeholder_sz;
     total_sz_ += col->TotalSize();
-    evictForPut();
+    evictForPut(wait);
   }
 
 private:
-  void evictForPut();
+  // 剔除LRU中的列直到缓存不满，wait为false时没有可剔除的列就返回false
+  bool evictForPut(bool wait);
+
+  void prepare(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data);
 
   // LRU cache
   std::unordered_map<Col, std::list<Col>::iterator, ColHasher, ColEqual> cache_;
@@ -104,229 +129,372 @@ private:
 // 存储分片
 class ShardImpl {
 public:
-  ShardImpl(int shard_id, TSDBEngineImpl* engine) : shard_id_(shard_id), engine_(engine) {
-    for (int i = 0; i < kVinNumPerShard; i++) {
-      latest_ts_cache_[i] = -1;
-    }
-  }
+  ShardImpl(int shard_id, TSDBEngineImpl* engine)
+      : shard_id_(shard_id),
+        engine_(engine),
+        memtable_(g_config.vin_num_per_shard, nullptr),
+        block_mgr_(g_config.vin_num_per_shard, nullptr),
+        latest_ts_cols_(g_config.vin_num_per_shard),
+        latest_ts_cache_(g_config.vin_num_per_shard, -1),
+        latest_dirty_(g_config.vin_num_per_shard, false) {}
   ~ShardImpl();
   void Init();
 
-  void InitMemTable();
-
-  void Write(uint16_t vid, const Row& row);
+  // 写入同一个vid的多行
+  void WriteRows(uint16_t vid, const Row* const* rows, int n);
 
   void GetLatestRow(uint16_t vid, const std::vector<int>& colids, OUT Row& row);
 
   void GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
                             const std::vector<int>& colids, std::vector<Row>& results);
 
+  // 带过滤条件的time range查询，只返回filter_colid这一列满足cmp的行
+  // blockmeta中这一列的min/max能确定没有行满足的block不读取
+  void GetFilteredRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                                    const std::vector<int>& colids, int filter_colid, const CompareExpression& cmp,
+                                    std::vector<Row>& results);
+
+  // 列式的time range查询，batch.columns需要调用方按colids的顺序预先设置好
+  void GetColumnsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                               const std::vector<int>& colids, ColumnBatch& batch);
+
   void AggregateQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int colid, Aggregator op,
                       std::vector<Row>& res);
 
+  // 批量聚合/降采样中属于同一个vid的一项
+  struct BatchAggItem {
+    int colid;
+    Aggregator op;
+    const CompareExpression* filter; // 降采样的过滤条件，聚合查询为nullptr
+    std::vector<Row>* res;
+  };
+
+  // 同一个vid的多个聚合/降采样请求一起执行，每个block只读取和解压一次
+  // 聚合查询传入interval = upperExclusive - lowerInclusive，即只有一个桶
+  void BatchAggregateQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
+                           const std::vector<BatchAggItem>& items);
+
   void DownSampleQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t interval, int colid,
                        Aggregator op, const CompareExpression& cmp, std::vector<Row>& res);
 
-  void SaveLatestRowCache(File* file);
+  // 直接使用manifest映射中这个vid的cnt个连续的BlockMeta
+  void MapBlocks(uint16_t vid, char* base, int cnt) { block_mgr_[vid2svid(vid)]->AddMapped(base, cnt); }
 
-  void LoadLatestRowCache(File* file);
+  // 从manifest中的一行恢复最新行缓存
+  void LoadLatestRow(uint16_t vid, const char* image);
 
-  void SaveBlockMeta(File* file) {
-    for (int i = 0; i < kVinNumPerShard; i++) {
-      block_mgr_[i]->Save(file);
-    }
-  }
+  // 把上一次编辑之后新下刷的block和变化了的最新行加入manifest的编辑，之后的编辑不再包含它们
+  void AppendManifestEdit(ManifestEditBuilder& edit);
+  Status Flush(uint16_t svid);
 
-  void LoadBlockMeta(File* file) {
-    for (int i = 0; i < kVinNumPerShard; i++) {
-      block_mgr_[i]->Load(file);
-    }
-  }
-  Status Flush(uint16_t svid, bool shutdown = false);
+  // 把当前段写缓冲中剩下的数据下刷，checkpoint和shutdown的时候在所有memtable都Flush之后调用，之后可以继续写
+  void FlushWriteBuffer();
+
+  // 写阶段shutdown的时候在manifest之前写入rollup文件，manifest之前的syncfs保证落盘
+  void SaveRollups();
 
 private:
-  template <typename TAgg, typename TCol>
-  void aggregateImpl2(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int colid, std::vector<Row>& res);
+  // 批量请求中每一项的聚合状态，擦除了聚合类型和列类型
+  class BatchAggBase {
+  public:
+    virtual ~BatchAggBase() = default;
+    // block完全落在第pos个桶内并且所有行都满足过滤条件时，直接使用blockmeta中的统计值
+    virtual void AddBlockStat(BlockMeta* meta, int pos) = 0;
+    // tss为时间戳列，sel为范围内的行号，为nullptr表示[0, n)
+    virtual void AddRows(ColumnArrWrapper* col, const int64_t* tss, const uint16_t* sel, int n) = 0;
+    // range_mask选中的行都落在第pos个桶内，用SIMD kernel过滤和聚合
+    virtual void AddBucketRows(ColumnArrWrapper* col, const int64_t* tss, const uint8_t* range_mask, int n,
+                               int pos) = 0;
+    // rollup中完全落在第pos个桶内并且所有行都满足过滤条件的一个桶，cnt为行数，stat为这一列的统计值
+    virtual void AddRollupStat(int pos, int64_t cnt, const char* stat) = 0;
+    // 范围内有数据的时候才输出，行都被过滤掉的桶也要输出
+    virtual void Output(uint64_t vid, std::vector<Row>& res) = 0;
+  };
+
+  template <typename TOp, typename TFilter, typename TWrapper>
+  class BatchAgg;
+
+  BatchAggBase* newBatchAgg(const BatchAggItem& item, int64_t lowerInclusive, int64_t interval, int bucket_num);
+
+  // 扫描memtable和block中[lowerInclusive, upperExclusive)的行，桶从origin开始，aggs中为nullptr的项跳过
+  void scanBlocks(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t origin, int64_t interval,
+                  int bucket_num, const std::vector<BatchAggItem>& items, const std::vector<BatchAggBase*>& aggs,
+                  bool& has_data);
+
+  // 桶的边界都对齐到分辨率并且聚合函数都能用统计值合并的时候，返回能用的最粗的rollup，没有返回nullptr
+  const Rollup* pickRollup(int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
+                           const std::vector<BatchAggItem>& items) const;
 
-  // 单独抽出来特化这部分，用来向泛型的Agg容器里面加入blockmeta中缓存的内容，使得可以兼容原始的Agg容器语义
-  template <typename TAgg, typename TCol>
-  void aggAdd(TAgg* agg, int colid, BlockMeta* meta);
+  // 用rollup的桶回答查询，只有过滤条件不能由桶的min/max确定的桶才扫描原始的block
+  void rollupAggregate(const Rollup* rollup, uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                       int64_t interval, int bucket_num, const std::vector<BatchAggItem>& items,
+                       const std::vector<BatchAggBase*>& aggs, bool& has_data);
 
-  template <typename TAgg, typename TCol>
-  void aggregateImpl(const std::vector<Row>& input, const std::string& col_name, Row& res);
+  // 过滤条件对一个block中所有行的结果
+  enum class BlockFilter { kAllPass, kNonePass, kPartial };
 
-  template <typename TAgg, typename TCol>
-  void downsampleImpl(const std::vector<Row>& input, const std::string& col_name, int64_t lowerInclusive,
-                      int64_t upperExclusive, int64_t interval, const CompareExpression& cmp, std::vector<Row>& res);
+  // 由blockmeta中colid这一列的min/max判断过滤条件，只支持数值列
+  BlockFilter blockFilter(BlockMeta* meta, int colid, const CompareExpression& cmp);
+
+  // 由rollup桶中colid这一列的min/max判断过滤条件
+  BlockFilter rollupFilter(const Rollup* rollup, const char* rec, int colid, const CompareExpression& cmp);
+
+  template <typename T>
+  static BlockFilter blockFilter(T min, T max, CompareOp op, T val);
+
+  // 把sel中colid这一列不满足cmp的行去掉，返回剩下的行数
+  int filterRows(ColumnArrWrapper* col, int colid, const CompareExpression& cmp, uint16_t* sel, int n);
+
+  template <typename T>
+  static int filterRows(const T* data, CompareOp op, T val, uint16_t* sel, int n);
+
+  // 从cache中获取block的一列，没有命中的时候会在cache中放一个空的列，由调用方填充数据之后Release
+  ColumnArrWrapper* fetchColumn(BlockMeta* blk_meta, int colid, bool& hit);
+
+  // 不等待地在缓存中占住一列，没有空间时返回nullptr
+  ColumnArrWrapper* reserveColumn(BlockMeta* blk_meta, int colid);
+
+  // 预读中的一列数据在段文件中的范围
+  struct ReadaheadExtent {
+    BlockMeta* meta;
+    ColumnArrWrapper* col;
+    uint64_t off;
+    uint64_t end;
+  };
+
+  // 扫描多个block时的顺序预读，只在读阶段生效
+  // 先在cache中占好这些block还没有缓存的列，把相邻的范围合并成大的读请求一起发出去，读完解压填进cache，
+  // 之后处理block的协程直接命中cache。在调用方的协程里做，不另外占协程池，填充的时候也不会等LRU
+  void readaheadBlocks(const std::vector<BlockMeta*>& blk_metas, const std::vector<int>& colids);
+  void readahead(std::vector<ReadaheadExtent>& extents);
+
+  // 获取block中的时间戳列和colids对应的列，cache中没有的会从文件读取并解压
+  TsArrWrapper* fetchColumns(BlockMeta* blk_meta, const std::vector<int>& colids, ColumnArrWrapper** cols,
+                             std::vector<ColumnArrWrapper*>& need_read_from_file);
+
+  // 释放fetchColumns获取的列
+  void releaseColumns(BlockMeta* blk_meta, const std::vector<int>& colids, TsArrWrapper* ts_col,
+                      ColumnArrWrapper** cols, const std::vector<ColumnArrWrapper*>& need_read_from_file);
+
+  // 聚合函数、过滤条件和列数组类型，见bucket_agg.h
+  template <typename TOp, typename TFilter, typename TWrapper>
+  struct AggKind {
+    using Op = TOp;
+    using Filter = TFilter;
+    using Wrapper = TWrapper;
+  };
+
+  // 按聚合函数、过滤条件和列类型调用一次f(AggKind<...>{})，之后的聚合都是编译期确定的类型，string列返回false
+  template <typename F>
+  static bool dispatchAgg(Aggregator op, ColumnType t, const CompareExpression* filter, F&& f);
+  template <typename T, typename TWrapper, typename F>
+  static void dispatchOp(Aggregator op, const CompareExpression* filter, F& f);
+  template <typename TOp, typename TWrapper, typename F>
+  static void dispatchFilter(const CompareExpression* filter, F& f);
+
+  // 第一次写入的时候才创建memtable
+  MemTable* memTable(uint16_t svid);
+
+  // 查询用的段文件，第一次用到的时候才打开，只能在shard所在的调度线程上调用
+  File* segmentFile(uint32_t segment);
+
+  // 段中还没有下刷的数据在写缓冲里，只有正在写的段才有
+  AlignedWriteBuffer* writeBuffer(uint32_t segment) { return segment == active_segment_ ? write_buf_ : nullptr; }
+
+  // 开始往当前段写一个block，返回段号，当前段写满了就切换到新的段
+  uint32_t acquireSegment();
+  void releaseSegment();
+  void rollSegment();
 
   static int position(int64_t lowerInclusive, int64_t interval, int64_t ts) { return (ts - lowerInclusive) / interval; }
 
   int shard_id_;
   TSDBEngineImpl* engine_{nullptr};
-  File* data_file_[kVinNumPerShard]{nullptr};
-
-  ReadCache* read_cache_{nullptr};               // for read phase
-  MemTable* memtable_[kVinNumPerShard]{nullptr}; // for write phase
-  AlignedWriteBuffer* write_buf_[kVinNumPerShard]{nullptr};
-
-  BlockMetaManager* block_mgr_[kVinNumPerShard]{nullptr};
+  // shard中所有vin的block都追加写到段文件里，按段号索引
+  std::vector<File*> segment_file_;      // 读阶段的异步读文件
+  std::vector<File*> segment_read_file_; // 写阶段查询用的同步读文件
+  AlignedWriteBuffer* write_buf_{nullptr}; // 正在写的段的写缓冲
+  uint32_t active_segment_{UINT32_MAX};    // 正在写的段，还没有开始写是UINT32_MAX
+  int segment_writers_{0};                 // 正在往当前段写block的协程数
+  bool rolling_{false};
+  CoroCV segment_cv_;
+
+  ReadCache* read_cache_{nullptr}; // for read phase
+  // 以下都按svid索引，长度为 g_config.vin_num_per_shard，memtable和最新行都是用到时才创建
+  std::vector<MemTable*> memtable_; // for write phase
+
+  std::vector<BlockMetaManager*> block_mgr_;
+  BlockMetaArena block_arena_; // 本次运行新下刷的BlockMeta都分配在这里
 
   // LatestQueryCache
-  // Row latest_row_cache[kVinNumPerShard];
-  ColumnValue latest_ts_cols_[kVinNumPerShard][kColumnNum];
-  int64_t latest_ts_cache_[kVinNumPerShard];
+  std::vector<std::vector<ColumnValue>> latest_ts_cols_; // 每个svid按schema的列数分配
+  std::vector<int64_t> latest_ts_cache_;
+  std::vector<bool> latest_dirty_; // 最新行在上一次manifest编辑之后变化过，下一次编辑需要写入
+
+  // 按g_config.rollup中的分辨率从细到粗，写阶段第一次Flush的时候创建，读阶段只有成功加载的
+  std::vector<Rollup*> rollups_;
 };
 
 // template implementation
-template <typename TAgg, typename TCol>
-inline void ShardImpl::aggregateImpl(const std::vector<Row>& input, const std::string& col_name, Row& res) {
-  TAgg agg;
-  for (auto& row : input) {
-    const ColumnValue& col_val = row.columns.at(col_name);
-    ColumnValueWrapper wrapper(&col_val);
-    agg.Add(wrapper.getFixedSizeValue<TCol>());
-  }
+template <typename TOp, typename TFilter, typename TWrapper>
+class ShardImpl::BatchAgg : public ShardImpl::BatchAggBase {
+  using T = typename TOp::Type;
 
-  ColumnValue res_val(agg.GetResult());
+public:
+  BatchAgg(ShardImpl* shard, int colid, int64_t lowerInclusive, int64_t interval, int bucket_num,
+           const CompareExpression* filter)
+      : shard_(shard), colid_(colid), lower_(lowerInclusive), interval_(interval), bucket_num_(bucket_num),
+        filter_(filter) {
+    state_.Init(bucket_num);
+  }
 
-  res.columns.emplace(std::make_pair(col_name, std::move(res_val)));
-};
+  void AddBlockStat(BlockMeta* meta, int pos) override {
+    TOp::MergeStat(state_, pos, shard_->engine_->block_layout_, meta, colid_);
+  }
 
-template <typename TAgg, typename TCol>
-inline void ShardImpl::downsampleImpl(const std::vector<Row>& input, const std::string& col_name,
-                                      int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
-                                      const CompareExpression& cmp, std::vector<Row>& res) {
-  int bucket_num = (upperExclusive - lowerInclusive) / interval;
-  std::vector<TAgg> buckets;
-  buckets.reserve(bucket_num);
-  ColumnValueWrapper wrapper(&cmp.value);
-  for (int i = 0; i < bucket_num; i++) {
-    buckets.emplace_back(cmp.compareOp, wrapper.getFixedSizeValue<TCol>());
+  void AddRows(ColumnArrWrapper* col, const int64_t* tss, const uint16_t* sel, int n) override {
+    const T* data = static_cast<TWrapper*>(col)->GetDataArr();
+    if (sel == nullptr) {
+      for (int i = 0; i < n; i++) {
+        addRow(data[i], tss[i]);
+      }
+    } else {
+      for (int i = 0; i < n; i++) {
+        addRow(data[sel[i]], tss[sel[i]]);
+      }
+    }
   }
-  for (auto& row : input) {
-    int pos = position(lowerInclusive, interval, row.timestamp);
-    const ColumnValue& col_val = row.columns.at(col_name);
-    ColumnValueWrapper wrapper(&col_val);
-    buckets[pos].Add(wrapper.getFixedSizeValue<TCol>());
+
+  void AddBucketRows(ColumnArrWrapper* col, const int64_t* tss, const uint8_t* range_mask, int n, int pos) override {
+    const T* data = static_cast<TWrapper*>(col)->GetDataArr();
+    if constexpr (TOp::kMaskable) {
+      uint8_t mask[kMaxMemtableRowNum];
+      memcpy(mask, range_mask, n);
+      filter_.Mask(data, n, mask);
+      MaskedAgg<T> res;
+      MaskedAggregate(data, mask, n, res);
+      TOp::Merge(state_, pos, res);
+    } else {
+      for (int i = 0; i < n; i++) {
+        if (range_mask[i] != 0 && filter_.Pass(data[i])) TOp::Add(state_, pos, data[i], tss[i]);
+      }
+    }
   }
 
-  for (size_t i = 0; i < buckets.size(); i++) {
-    auto& agg = buckets[i];
-    Row row;
-    row.columns.emplace(std::make_pair(col_name, ColumnValue(agg.GetResult())));
-    ::memcpy(row.vin.vin, input.front().vin.vin, VIN_LENGTH);
-    row.timestamp = lowerInclusive + i * interval;
-    res.push_back(std::move(row));
+  void AddRollupStat(int pos, int64_t cnt, const char* stat) override {
+    if constexpr (TOp::kMaskable) {
+      TOp::Merge(state_, pos, Rollup::LoadStat<T>(cnt, stat));
+    } else {
+      LOG_ASSERT(false, "rollup can not answer FIRST/LAST");
+    }
   }
-}
 
-template <typename TAgg, typename TCol>
-inline void ShardImpl::aggregateImpl2(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int colid,
-                                      std::vector<Row>& res) {
-  TAgg agg;
-  uint16_t svid = vid2svid(vid);
-  std::vector<BlockMeta*> blk_metas;
-  block_mgr_[svid]->GetVinBlockMetasByTimeRange(vid, lowerInclusive, upperExclusive, blk_metas);
-
-  File* rfile = data_file_[svid];
-  if (!blk_metas.empty()) {
-    RECORD_FETCH_ADD(disk_blk_access_cnt, blk_metas.size());
-    int sub_task_num = 0;
-    for (auto blk_meta : blk_metas) {
-      if (lowerInclusive <= blk_meta->min_ts && blk_meta->max_ts < upperExclusive) {
-        aggAdd<TAgg, TCol>(&agg, colid, blk_meta);
-      } else {
-        auto func = [this, blk_meta, colid, vid, lowerInclusive, upperExclusive, father = this_coroutine::current(),
-                     &agg, rfile, svid]() {
-          ColumnValue col;
-          std::vector<ColumnArrWrapper*> need_read_from_file;
-          // 去读对应列的block
-
-          bool hit;
-
-          TsArrWrapper* tmp_ts_col = read_cache_->FetchDataArr<TsArrWrapper>(blk_meta, kColumnNum, hit);
-          if (!hit) need_read_from_file.push_back(tmp_ts_col);
-
-          ColumnArrWrapper* agg_col = nullptr;
-
-          switch (engine_->columns_type_[colid]) {
-            case COLUMN_TYPE_INTEGER:
-              agg_col = read_cache_->FetchDataArr<IntArrWrapper>(blk_meta, colid, hit);
-              if (!hit) need_read_from_file.push_back(agg_col);
-              break;
-            case COLUMN_TYPE_DOUBLE_FLOAT:
-              agg_col = read_cache_->FetchDataArr<DoubleArrWrapper>(blk_meta, colid, hit);
-              if (!hit) need_read_from_file.push_back(agg_col);
-              break;
-            default:
-              LOG_ASSERT(false, "error");
-              break;
-          }
-          for (auto& col : need_read_from_file) {
-            // 异步非Batch IO
-            col->Read(rfile, write_buf_[svid], blk_meta);
-          }
-
-          auto tss = tmp_ts_col->GetDataArr();
-          for (int i = 0; i < blk_meta->num; i++) {
-            // fill aggragate container.
-            if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
-              agg_col->Get(i, col);
-              ColumnValueWrapper wrapper(&col);
-              agg.Add(wrapper.getFixedSizeValue<TCol>());
-            }
-          }
-
-          read_cache_->Release(blk_meta, kColumnNum, tmp_ts_col);
-          read_cache_->Release(blk_meta, colid, agg_col);
-
-          father->wakeup_once();
-        };
-        this_coroutine::coro_scheduler()->addTask(std::move(func));
-        sub_task_num++;
-      }
+  void Output(uint64_t vid, std::vector<Row>& res) override {
+    const std::string& col_name = shard_->engine_->columns_name_[colid_];
+    for (int i = 0; i < bucket_num_; i++) {
+      Row row;
+      row.timestamp = lower_ + i * interval_;
+      ::memcpy(row.vin.vin, shard_->engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
+      row.columns.emplace(std::make_pair(col_name, TOp::Result(state_, i)));
+      res.push_back(std::move(row));
     }
+  }
 
-    this_coroutine::co_wait(sub_task_num);
+private:
+  void addRow(T v, int64_t ts) {
+    int pos = position(lower_, interval_, ts);
+    if (LIKELY(pos < bucket_num_) && filter_.Pass(v)) {
+      TOp::Add(state_, pos, v, ts);
+    }
   }
 
-  std::string& col_name = engine_->columns_name_[colid];
-  Row r;
-  r.timestamp = lowerInclusive;
-  ::memcpy(r.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
-  ColumnValue res_val(agg.GetResult());
-  r.columns.emplace(std::make_pair(col_name, std::move(res_val)));
-  res.push_back(std::move(r));
+  ShardImpl* shard_;
+  int colid_;
+  int64_t lower_;
+  int64_t interval_;
+  int bucket_num_;
+  TFilter filter_;
+  typename TOp::State state_;
+};
+
+template <typename T>
+inline ShardImpl::BlockFilter ShardImpl::blockFilter(T min, T max, CompareOp op, T val) {
+  switch (op) {
+    case GREATER:
+      if (min > val) return BlockFilter::kAllPass;
+      if (max <= val) return BlockFilter::kNonePass;
+      break;
+    case EQUAL:
+      if (val < min || max < val) return BlockFilter::kNonePass;
+      if (min == val && max == val) return BlockFilter::kAllPass;
+      break;
+  }
+  return BlockFilter::kPartial;
 }
 
-template <>
-inline void ShardImpl::aggAdd<MaxAggreate<double>, double>(MaxAggreate<double>* agg, int colid, BlockMeta* meta) {
-  double val = TO_DOUBLE(meta->max_val[colid]);
-  agg->Add(val);
+template <typename T>
+inline int ShardImpl::filterRows(const T* data, CompareOp op, T val, uint16_t* sel, int n) {
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    T v = data[sel[i]];
+    if (op == GREATER ? v > val : v == val) {
+      sel[m++] = sel[i];
+    }
+  }
+  return m;
 }
 
-template <>
-inline void ShardImpl::aggAdd<MaxAggreate<int>, int>(MaxAggreate<int>* agg, int colid, BlockMeta* meta) {
-  int val = TO_INT(meta->max_val[colid]);
-  agg->Add(val);
+template <typename F>
+inline bool ShardImpl::dispatchAgg(Aggregator op, ColumnType t, const CompareExpression* filter, F&& f) {
+  switch (t) {
+    case COLUMN_TYPE_INTEGER:
+      dispatchOp<int, IntArrWrapper>(op, filter, f);
+      return true;
+    case COLUMN_TYPE_DOUBLE_FLOAT:
+      dispatchOp<double, DoubleArrWrapper>(op, filter, f);
+      return true;
+    default:
+      return false;
+  }
 }
 
-template <>
-inline void ShardImpl::aggAdd<AvgAggregate<double>, double>(AvgAggregate<double>* agg, int colid, BlockMeta* meta) {
-  double val = TO_DOUBLE(meta->sum_val[colid]);
-  for (int i = 0; i < meta->num - 1; i++) {
-    agg->Add(0);
+template <typename T, typename TWrapper, typename F>
+inline void ShardImpl::dispatchOp(Aggregator op, const CompareExpression* filter, F& f) {
+  switch (op) {
+    case AVG:
+      dispatchFilter<AvgOp<T>, TWrapper>(filter, f);
+      break;
+    case MAX:
+      dispatchFilter<MaxOp<T>, TWrapper>(filter, f);
+      break;
+    case MIN:
+      dispatchFilter<MinOp<T>, TWrapper>(filter, f);
+      break;
+    case SUM:
+      dispatchFilter<SumOp<T>, TWrapper>(filter, f);
+      break;
+    case COUNT:
+      dispatchFilter<CountOp<T>, TWrapper>(filter, f);
+      break;
+    case FIRST:
+      dispatchFilter<FirstOp<T>, TWrapper>(filter, f);
+      break;
+    case LAST:
+      dispatchFilter<LastOp<T>, TWrapper>(filter, f);
+      break;
   }
-  agg->Add(val);
 }
 
-template <>
-inline void ShardImpl::aggAdd<AvgAggregate<int64_t>, int64_t>(AvgAggregate<int64_t>* agg, int colid, BlockMeta* meta) {
-  int64_t val = TO_INT64(meta->sum_val[colid]);
-  for (int i = 0; i < meta->num - 1; i++) {
-    agg->Add(0);
+template <typename TOp, typename TWrapper, typename F>
+inline void ShardImpl::dispatchFilter(const CompareExpression* filter, F& f) {
+  using T = typename TOp::Type;
+  if (filter == nullptr) {
+    f(AggKind<TOp, NoFilter<T>, TWrapper>{});
+  } else if (filter->compareOp == GREATER) {
+    f(AggKind<TOp, GreaterFilter<T>, TWrapper>{});
+  } else {
+    f(AggKind<TOp, EqualFilter<T>, TWrapper>{});
   }
-  agg->Add(val);
 }
 
 } // namespace LindormContest
\ No newline at end of file
@@ -29,7 +29,7 @@ namespace LindormContest {
 
     /**
      * An enum stands for the aggregator type. <br>
-     * For the sake of simplicity, we only support AVG and MAX for this contest. <br>
+     * Supported aggregators are AVG, MAX, MIN, SUM, COUNT, FIRST and LAST. <br>
      * The data type of the aggregation result is assumed as follows for simplicity: <br>
      * - AVG: DOUBLE <br>
      *        If all row were filtered, the result should be NaN (Bits as long: 0xfff0000000000000L).<br>
@@ -38,10 +38,20 @@ namespace LindormContest {
                   static double_t DOUBLE_NAN = * (double_t*) (&DOUBLE_NAN_AS_LONG);<br><br>
      * - MAX: The same as the column type of the source column type<br>
      *        If all row were filtered, the result should be NaN (0x80000000).<br>
+     * - MIN: The same as MAX<br>
+     * - SUM: DOUBLE, NaN if all row were filtered<br>
+     * - COUNT: INTEGER, the number of rows left after filtering, 0 if all row were filtered<br>
+     * - FIRST: The value of the row with the smallest timestamp, typed and NaN as MAX<br>
+     * - LAST: The value of the row with the largest timestamp, typed and NaN as MAX<br>
      */
     enum Aggregator {
         AVG,
-        MAX
+        MAX,
+        MIN,
+        SUM,
+        COUNT,
+        FIRST,
+        LAST
     };
 
     /**
@@ -4,6 +4,7 @@
 #include <chrono>
 
 #include "struct/Row.h"
+#include "util/logging.h"
 
 namespace LindormContest {
 
@@ -12,6 +13,26 @@ namespace LindormContest {
 #define TIME_DURATION_US(START, END) (std::chrono::duration_cast<std::chrono::microseconds>((END) - (START)).count())
 #define TO_MS(_time) (_time / 1000)
 
+// 记录connect、shutdown等过程中每个阶段的耗时
+class PhaseTimer {
+public:
+  explicit PhaseTimer(const char* name) : name_(name), start_(TIME_NOW), last_(start_) {}
+
+  // 上一个阶段结束
+  void Phase(const char* phase) {
+    auto now = TIME_NOW;
+    LOG_INFO("[%s] %s: %ld ms", name_, phase, TO_MS(TIME_DURATION_US(last_, now)));
+    last_ = now;
+  }
+
+  ~PhaseTimer() { LOG_INFO("[%s] total: %ld ms", name_, TO_MS(TIME_DURATION_US(start_, TIME_NOW))); }
+
+private:
+  const char* name_;
+  std::chrono::high_resolution_clock::time_point start_;
+  std::chrono::high_resolution_clock::time_point last_;
+};
+
 extern std::atomic<int64_t> write_cnt;
 extern std::atomic<int64_t> latest_query_cnt;
 extern std::atomic<int64_t> time_range_query_cnt;
@@ -24,6 +45,8 @@ extern std::atomic<int64_t> time_range_query_time;
 
 extern std::atomic<int64_t> tr_memtable_blk_query_cnt;
 extern std::atomic<int64_t> disk_blk_access_cnt;
+extern std::atomic<int64_t> filter_skip_blk_cnt;
+extern std::atomic<int64_t> rollup_bucket_cnt;
 
 extern std::atomic<int64_t> origin_szs[];
 extern std::atomic<int64_t> compress_szs[];
@@ -55,7 +78,7 @@ extern std::atomic<int64_t> high_compress_cnt;
 #define RECORD_ARR_FETCH_ADD(nums, idx, delta)
 #endif
 
-void print_file_summary(ColumnType* columnsType, std::string* columnsName);
+void print_file_summary(int columnNum, ColumnType* columnsType, std::string* columnsName);
 void print_row(const Row& row, uint16_t vid);
 void print_memory_usage();
 void print_performance_statistic();
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "struct/Vin.h"
+#include "util/likely.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+/**
+ * vin -> vid 的字典，vid从0开始连续分配
+ * 开放寻址(线性探测)，key直接是17个字节的vin，不构造std::string
+ * 只插入不删除，所以读可以完全无锁：slot先写好vin，再用release语义发布vid，读的时候acquire读到vid之后vin一定是完整的
+ * 插入很少（每个vin只有第一次写入的时候），用一把互斥锁串行化
+ */
+class VinDict {
+public:
+  static constexpr uint16_t kInvalidVid = UINT16_MAX;
+
+  VinDict() { Clear(); }
+
+  // 查找vin对应的vid，不存在返回kInvalidVid
+  uint16_t Get(const char* vin) const {
+    uint32_t pos = hash(vin) & kSlotMask;
+    while (true) {
+      const Slot& slot = slots_[pos];
+      uint32_t state = slot.state.load(std::memory_order_acquire);
+      if (state == 0) {
+        return kInvalidVid;
+      }
+      if (equal(slot.vin, vin)) {
+        return state - 1;
+      }
+      pos = (pos + 1) & kSlotMask;
+    }
+  }
+
+  // 查找vin对应的vid，不存在则分配一个新的vid
+  uint16_t GetOrInsert(const char* vin) {
+    uint16_t vid = Get(vin);
+    if (LIKELY(vid != kInvalidVid)) {
+      return vid;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    vid = Get(vin);
+    if (vid != kInvalidVid) {
+      return vid;
+    }
+    vid = size_.load(std::memory_order_relaxed);
+    insert(vin, vid);
+    return vid;
+  }
+
+  // 从持久化文件恢复一个映射关系
+  void Restore(const char* vin, uint16_t vid) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    LOG_ASSERT(Get(vin) == kInvalidVid, "duplicate vin");
+    insert(vin, vid);
+  }
+
+  // vid -> vin，返回的指针指向VIN_LENGTH个字节，不以'\0'结尾
+  const char* GetVin(uint16_t vid) const {
+    LOG_ASSERT(vid < kVinNum, "vid = %d", vid);
+    return vins_[vid];
+  }
+
+  // 已分配的vid个数，vid的范围是[0, Size())
+  uint16_t Size() const { return size_.load(std::memory_order_acquire); }
+
+  void Clear() {
+    for (auto& slot : slots_) {
+      slot.state.store(0, std::memory_order_relaxed);
+    }
+    size_.store(0, std::memory_order_release);
+  }
+
+private:
+  // 负载因子不超过 kVinNum / kSlotNum < 1/3
+  static constexpr uint32_t kSlotNum = [] {
+    uint32_t n = 1;
+    while (n < 3 * kVinNum) n <<= 1;
+    return n;
+  }();
+  static constexpr uint32_t kSlotMask = kSlotNum - 1;
+
+  // 一个slot 32字节，两个slot一条cacheline
+  struct alignas(32) Slot {
+    char vin[VIN_LENGTH];
+    std::atomic<uint32_t> state{0}; // 0表示空，否则为vid + 1
+  };
+
+  static uint32_t hash(const char* vin) {
+    uint64_t a, b;
+    memcpy(&a, vin, sizeof(a));
+    memcpy(&b, vin + 8, sizeof(b));
+    uint64_t h = (a * 0x9E3779B97F4A7C15ULL) ^ (b + (uint8_t)vin[16]);
+    h *= 0xC2B2AE3D27D4EB4FULL;
+    return h >> 32;
+  }
+
+  static bool equal(const char* a, const char* b) {
+#ifdef __SSE2__
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF && a[16] == b[16];
+#else
+    return memcmp(a, b, VIN_LENGTH) == 0;
+#endif
+  }
+
+  // 调用者持有mutex_
+  void insert(const char* vin, uint16_t vid) {
+    LOG_ASSERT(vid < kVinNum, "too many vins, vid = %d", vid);
+    memcpy(vins_[vid], vin, VIN_LENGTH);
+    uint32_t pos = hash(vin) & kSlotMask;
+    while (slots_[pos].state.load(std::memory_order_relaxed) != 0) {
+      pos = (pos + 1) & kSlotMask;
+    }
+    memcpy(slots_[pos].vin, vin, VIN_LENGTH);
+    slots_[pos].state.store(vid + 1, std::memory_order_release);
+    if (vid >= size_.load(std::memory_order_relaxed)) {
+      size_.store(vid + 1, std::memory_order_release);
+    }
+  }
+
+  Slot slots_[kSlotNum];
+  char vins_[kVinNum][VIN_LENGTH];
+  std::atomic<uint16_t> size_{0};
+  std::mutex mutex_;
+};
+
+} // namespace LindormContest
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "TSDBEngine.hpp"
+#include "coroutine/coro_cond.h"
+#include "io/file.h"
+
+namespace LindormContest {
+
+/**
+ * 写前日志，每个调度线程一个文件，只在该线程的协程中使用，不需要加锁
+ * 同一个线程上并发提交的写入合并成一组（group commit），一组只做一次512对齐的O_DIRECT顺序追加
+ * 文件需要以O_DSYNC打开，写完成即落盘（包括追加之后的文件长度），Sync返回时这一组已经持久化
+ * 文件格式: [WalGroupHeader][payload][补0到512对齐] ...
+ *   payload由若干行组成，每行: vin[17] ts[8] 按列号顺序的列值(int 4字节，double 8字节，string 4字节长度+内容)
+ */
+struct WalGroupHeader {
+  static constexpr uint32_t kMagic = 0x4C41574C; // "LWAL"
+  uint32_t magic;
+  uint32_t payload_len;
+  uint64_t checksum; // payload的校验和
+  uint32_t row_cnt;
+  uint32_t reserved;
+};
+
+class WalWriter {
+public:
+  explicit WalWriter(AsyncWriteFile* file) : file_(file) {}
+
+  ~WalWriter();
+
+  // 把一行编码到当前组，不会让出协程
+  void Append(const Row& row);
+
+  // 等待之前Append的行落盘，第一个到达的协程负责刷写，其他协程等待
+  void Sync();
+
+  // 已经写入文件的字节数
+  uint64_t Size() { return file_->getFileSz(); }
+
+  AsyncWriteFile* file() const { return file_; }
+
+private:
+  void flushGroup();
+
+  AsyncWriteFile* file_;
+  std::string pending_; // 正在攒的组
+  uint32_t pending_rows_{0};
+  uint64_t next_group_{0};      // 正在攒的组号
+  uint64_t committed_group_{0}; // 已经落盘的组数
+  bool flushing_{false};
+  CoroCV cv_;
+  char* io_buf_{nullptr};
+  size_t io_buf_cap_{0};
+};
+
+// 顺序读取一个日志文件，遇到残缺的组（崩溃时没有写完）就认为日志结束
+class WalReader {
+public:
+  WalReader(const std::string& filename, int column_num, const ColumnType* types, const std::string* names)
+      : file_(filename), column_num_(column_num), types_(types), names_(names) {}
+
+  // 读出下一组的所有行，返回false表示日志结束
+  bool Next(std::vector<Row>& rows);
+
+private:
+  SequentialReadFile file_;
+  int column_num_;
+  const ColumnType* types_;
+  const std::string* names_;
+  std::string buf_;
+};
+
+} // namespace LindormContest
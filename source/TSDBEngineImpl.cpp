@@ -7,17 +7,25 @@
 
 #include "TSDBEngineImpl.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <sstream>
 #include <utility>
 
+#include "agg_kernels.h"
 #include "common.h"
+#include "config.h"
 #include "filename.h"
 #include "io/file.h"
 #include "io/io_manager.h"
@@ -28,6 +36,7 @@
 #include "util/logging.h"
 #include "util/stat.h"
 #include "util/waitgroup.h"
+#include "wal.h"
 
 std::once_flag start_coro;
 
@@ -41,6 +50,12 @@ bool write_phase = false;
  */
 TSDBEngineImpl::TSDBEngineImpl(const std::string& dataDirPath) : TSDBEngine(dataDirPath) {}
 
+// 从WalFileName生成的文件名中解析出gen和tid
+static bool parseWalFileName(const std::string& filename, uint32_t& gen, int& tid) {
+  std::string name = std::filesystem::path(filename).filename().string();
+  return sscanf(name.c_str() + kTableName.size(), "_%u_%d.wal", &gen, &tid) == 2;
+}
+
 void TSDBEngineImpl::loadSchema() {
   LOG_INFO("start Load Schema");
   // Read schema.
@@ -55,27 +70,174 @@ void TSDBEngineImpl::loadSchema() {
   write_phase = false;
   int magic = 0;
   schemaFin >> magic;
-  if (magic != kColumnNum) {
+  if (magic <= 0 || magic > kMaxColumnNum) {
     std::cerr << "Unexpected columns' num: [" << magic << "]" << std::endl;
     schemaFin.close();
     throw std::exception();
   }
-  std::cout << "Found pre-written data with columns' num: [" << kColumnNum << "]" << std::endl;
+  std::cout << "Found pre-written data with columns' num: [" << magic << "]" << std::endl;
 
-  columns_type_ = new ColumnType[kColumnNum];
-  columns_name_ = new std::string[kColumnNum];
+  column_num_ = magic;
+  columns_type_ = new ColumnType[column_num_];
+  columns_name_ = new std::string[column_num_];
 
-  for (int i = 0; i < kColumnNum; ++i) {
+  for (int i = 0; i < column_num_; ++i) {
     schemaFin >> columns_name_[i];
     int32_t columnTypeInt;
     schemaFin >> columnTypeInt;
     columns_type_[i] = (ColumnType)columnTypeInt;
     column_idx_.emplace(columns_name_[i], i);
   }
-  RemoveFile(getDataPath() + "/schema");
+  block_layout_.Build(columns_type_, column_num_);
   LOG_INFO("Load Schema finished");
 }
 
+void TSDBEngineImpl::loadConfig() {
+  EngineConfig config;
+  config.Load(dataDirPath);
+
+  if (manifest_.Valid()) {
+    int shard_bits = manifest_.Last().shard_bits;
+    int memtable_row_num = manifest_.Last().memtable_row_num;
+    if ((config.shard_bits != 0 && config.shard_bits != shard_bits) ||
+        (config.memtable_row_num != 0 && config.memtable_row_num != memtable_row_num)) {
+      LOG_ERROR("shard_bits and memtable_row_num are fixed by the existing data, ignore the configured values");
+    }
+    config.shard_bits = shard_bits;
+    config.memtable_row_num = memtable_row_num;
+  }
+
+  config.Finalize();
+  g_config = config;
+  LOG_INFO("engine config: %s", g_config.ToString().c_str());
+}
+
+void TSDBEngineImpl::loadManifest() {
+  LOG_INFO("start load manifest");
+  ENSURE((int)manifest_.Last().column_num == column_num_, "manifest has %u columns, schema has %d",
+         manifest_.Last().column_num, column_num_);
+  ENSURE(manifest_.Last().block_stride == block_layout_.Stride(), "manifest block stride %u, schema needs %zu",
+         manifest_.Last().block_stride, block_layout_.Stride());
+  // 索引项按shard分组，之后每个shard在自己的调度线程上并行挂载block、解析最新行
+  std::vector<std::vector<const Manifest::BlockIndex*>> blocks(g_config.shard_num);
+  std::vector<std::vector<const Manifest::LatestIndex*>> latest(g_config.shard_num);
+  for (auto& edit : manifest_.Edits()) {
+    const Manifest::Footer& footer = *edit.footer;
+    for (uint32_t i = 0; i < footer.vin_cnt; i++) {
+      vin_dict_.Restore(edit.vins + i * VIN_LENGTH, footer.first_vid + i);
+    }
+    for (uint32_t i = 0; i < footer.block_index_cnt; i++) {
+      blocks[sharding(edit.blocks[i].vid)].push_back(&edit.blocks[i]);
+    }
+    for (uint32_t i = 0; i < footer.latest_cnt; i++) {
+      latest[sharding(edit.latest[i].vid)].push_back(&edit.latest[i]);
+    }
+  }
+  forEachShard([&](int i) {
+    for (auto idx : blocks[i]) {
+      shards_[i]->MapBlocks(idx->vid, manifest_.At(idx->off), idx->cnt);
+    }
+    // 按编辑的顺序，同一个vid以最后一次为准
+    for (auto idx : latest[i]) {
+      shards_[i]->LoadLatestRow(idx->vid, manifest_.At(idx->off));
+    }
+  });
+  manifest_vin_num_ = vin_dict_.Size();
+  manifest_footer_ = manifest_.LastOffset();
+  LOG_INFO("load manifest finished, %zu edits, %u vins", manifest_.Edits().size(), manifest_vin_num_);
+}
+
+void TSDBEngineImpl::saveManifest() {
+  // 每个shard并行编码自己的部分，再按shard顺序合并
+  std::vector<ManifestEditBuilder> parts(g_config.shard_num, ManifestEditBuilder(block_layout_, 0));
+  forEachShard([&](int i) { shards_[i]->AppendManifestEdit(parts[i]); });
+  // 所有的日志都已经没用了
+  appendManifest(parts, wal_gen_ + 1, Manifest::kClosed);
+}
+
+void TSDBEngineImpl::appendManifest(const std::vector<ManifestEditBuilder>& parts, uint32_t wal_gen, uint32_t flags) {
+  // parts中的block所属的vid在编码之前就分配好了，一定小于现在的vin数
+  ManifestEditBuilder edit(block_layout_, manifest_vin_num_);
+  uint16_t vin_num = vin_dict_.Size();
+  for (uint16_t vid = manifest_vin_num_; vid < vin_num; vid++) {
+    edit.AddVin(vin_dict_.GetVin(vid));
+  }
+  for (auto& part : parts) {
+    edit.Merge(part);
+  }
+
+  // 数据文件是O_DIRECT写的，文件长度等元数据还没有落盘，manifest提交之前用一次syncfs代替逐个文件fsync
+  int dir_fd = open(dataDirPath.c_str(), O_RDONLY | O_DIRECTORY);
+  ENSURE(dir_fd >= 0 && syncfs(dir_fd) == 0, "sync data dir %s failed", dataDirPath.c_str());
+  close(dir_fd);
+
+  manifest_footer_ = edit.AppendTo(ManifestFileName(dataDirPath, kTableName), manifest_footer_, wal_gen, flags);
+  manifest_vin_num_ = vin_num;
+}
+
+void TSDBEngineImpl::forEachShard(const std::function<void(int)>& func) {
+  WaitGroup wg(g_config.shard_num);
+  for (int i = 0; i < g_config.shard_num; i++) {
+    coro_pool_->enqueue(
+      [&wg, &func, i]() {
+        func(i);
+        wg.Done();
+      },
+      shard2tid(i));
+  }
+  wg.Wait();
+}
+
+void TSDBEngineImpl::forEachVid(const std::vector<uint16_t>& vids, const std::function<void(size_t)>& func) {
+  // 协程数是固定的，每个vin的查询还要再起读block的协程，同时执行的vin不能占满所有协程，
+  // 否则等待block的协程永远分配不到协程。调用方的协程自己也领取vin，另外起的协程和同一个调度线程上
+  // 其他批量查询的一起不超过协程数的1/4，并发的批量查询多了也不会把协程池占满
+  if (vids.empty()) {
+    return;
+  }
+  thread_local int vin_workers = 0; // 只在当前调度线程上访问
+  int quota = std::max(1, g_config.coroutine_per_thread / 4);
+  int worker_num = std::clamp<int>(quota - vin_workers, 0, (int)vids.size() - 1);
+  size_t next = 0;
+  auto loop = [&func, &vids, &next]() {
+    while (next < vids.size()) {
+      func(next++);
+    }
+  };
+  // 调用方在loop中还会等自己读block的协程，只能在loop结束之后再被唤醒
+  int running = worker_num;
+  bool father_waiting = false;
+  vin_workers += worker_num;
+  for (int k = 0; k < worker_num; k++) {
+    this_coroutine::coro_scheduler()->addTask(
+      [&loop, &running, &father_waiting, father = this_coroutine::current()]() {
+        loop();
+        vin_workers--;
+        if (--running == 0 && father_waiting) {
+          father->wakeup_once();
+        }
+      });
+  }
+  loop();
+  if (running > 0) {
+    father_waiting = true;
+    this_coroutine::co_wait();
+  }
+}
+
+void TSDBEngineImpl::forEachTid(const std::function<void(int)>& func) {
+  WaitGroup wg(g_config.worker_thread);
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
+    coro_pool_->enqueue(
+      [&wg, &func, tid]() {
+        func(tid);
+        wg.Done();
+      },
+      tid);
+  }
+  wg.Wait();
+}
+
 int TSDBEngineImpl::connect() {
 #ifdef ENABLE_STAT
   cache_hit = 0;
@@ -83,82 +245,123 @@ int TSDBEngineImpl::connect() {
   data_wait_cnt = 0;
   lru_wait_cnt = 0;
 #endif
+  PhaseTimer timer("connect");
   print_memory_usage();
   loadSchema();
-  io_mgr_ = new IOManager();
-  for (int i = 0; i < kShardNum; i++) {
-    shards_[i] = new ShardImpl(i, this);
-  }
-  coro_pool_ = new CoroutinePool(kWorkerThread, kCoroutinePerThread);
-  // 初始化shard
-  for (int i = 0; i < kShardNum; i++) {
-    shards_[i]->Init();
-  }
-
-  // load vin2vid
-  {
-    vin2vid_lck_.wlock();
-    std::string filename = Vin2vidFileName(dataDirPath, kTableName);
-    if (io_mgr_->Exist(filename)) {
-      LOG_INFO("start load vin2vid");
-      SequentialReadFile file(filename);
-      int num;
-      file.read((char*)&num, sizeof(num));
-      for (int i = 0; i < num; i++) {
-        char vin[VIN_LENGTH] = {0};
-        uint16_t vid;
-        file.read(vin, VIN_LENGTH);
-        file.read((char*)&vid, sizeof(vid));
-        std::string vin_str(vin, VIN_LENGTH);
-        vin2vid_.emplace(std::make_pair(vin_str, vid));
-        vid2vin_.emplace(std::make_pair(vid, vin_str));
-      }
-      LOG_INFO("load vin2vid finished");
+  manifest_footer_ = Manifest::kNoPrev;
+  wal_gen_ = 0;
+  checkpoint_wanted_ = false;
+  // 写阶段正常shutdown的最后一次manifest编辑带kClosed，有schema但是没有这样的编辑说明上一次写阶段崩溃了，需要用日志恢复
+  bool has_manifest = !write_phase && manifest_.Open(ManifestFileName(dataDirPath, kTableName));
+  bool recovery = !write_phase && !(has_manifest && (manifest_.Last().flags & Manifest::kClosed));
+  std::vector<std::string> old_wals = listTableFiles({".wal"});
+  if (recovery) {
+    write_phase = true;
+    // 写阶段的rollup只在正常shutdown的时候写入，残留的都是旧的
+    for (auto& filename : listTableFiles({".rollup"})) {
       RemoveFile(filename);
     }
-    vin2vid_lck_.unlock();
-  }
-
-  // load block meta
-  LOG_INFO("start load block meta");
-  for (int i = 0; i < kShardNum; i++) {
-    std::string filename = ShardMetaFileName(dataDirPath, kTableName, i);
-    if (io_mgr_->Exist(filename)) {
-      SequentialReadFile file(filename);
-      shards_[i]->LoadBlockMeta(&file);
-      // 删除文件
-      RemoveFile(filename);
+    if (has_manifest) {
+      // 最后一次checkpoint之前的数据都在manifest中，只回放之后的日志
+      wal_gen_ = manifest_.Last().wal_gen;
+      auto covered = [this](const std::string& filename) {
+        uint32_t gen = 0;
+        int tid = 0;
+        return parseWalFileName(filename, gen, tid) && gen < wal_gen_;
+      };
+      for (auto& filename : old_wals) {
+        if (covered(filename)) {
+          RemoveFile(filename);
+        }
+      }
+      old_wals.erase(std::remove_if(old_wals.begin(), old_wals.end(), covered), old_wals.end());
+      LOG_INFO("last write phase was not shutdown cleanly, recover from checkpoint and %zu wal files",
+               old_wals.size());
+    } else {
+      LOG_INFO("last write phase was not shutdown cleanly, recover from %zu wal files", old_wals.size());
+      // 所有数据都从日志重建
+      for (auto& filename : listTableFiles({".data", ".manifest"})) {
+        RemoveFile(filename);
+      }
     }
-  }
-  LOG_INFO("load block meta finished");
-
-  // load latest row cache
-  LOG_INFO("start load latest row cache");
-  for (int i = 0; i < kShardNum; i++) {
-    std::string filename = LatestRowFileName(dataDirPath, kTableName, i);
-    if (io_mgr_->Exist(filename)) {
-      SequentialReadFile file(filename);
-      shards_[i]->LoadLatestRowCache(&file);
+  } else {
+    // 新库或者正常shutdown之后的库，残留的日志都已经没有用了
+    for (auto& filename : old_wals) {
       RemoveFile(filename);
     }
+    old_wals.clear();
   }
-  LOG_INFO("load latest row cache finished");
+  loadConfig();
+  if (column_num_ > 0) {
+    g_config.FinalizeMemtable(column_num_);
+  }
+  if (recovery && has_manifest) {
+    // checkpoint之前的行不会再经过memtable，rollup不完整，这次写阶段不维护rollup，查询直接读block
+    g_config.rollup.clear();
+  }
+  SelectAggKernels();
+  timer.Phase("load schema and config");
+  for (int i = 0; i < kVinNum; i++) {
+    submitted_seq_[i].store(0, std::memory_order_relaxed);
+    applied_seq_[i].store(0, std::memory_order_relaxed);
+  }
+  io_mgr_ = new IOManager();
+  shards_.assign(g_config.shard_num, nullptr);
+  for (int i = 0; i < g_config.shard_num; i++) {
+    shards_[i] = new ShardImpl(i, this);
+  }
+  coro_pool_ = new CoroutinePool(g_config.worker_thread, g_config.coroutine_per_thread, g_config.cpu_set);
+  coro_pool_->registerPollingFunc(std::bind(&IOManager::PollingIOEvents, io_mgr_));
+  coro_pool_->start();
+
+  // 每个shard在自己的调度线程上打开文件、创建aio context
+  forEachShard([this](int i) { shards_[i]->Init(); });
+  timer.Phase("init shards");
 
   // mem_pool_addr_ = std::aligned_alloc(512, kMemoryPoolSz);
   // ENSURE(mem_pool_addr_ != nullptr, "invalid mem_pool_addr");
   // InitMemPool(mem_pool_addr_, kMemoryPoolSz, 2 * MB);
 
-  coro_pool_->registerPollingFunc(std::bind(&IOManager::PollingIOEvents, io_mgr_));
-  coro_pool_->start();
+  manifest_vin_num_ = 0;
+  if (manifest_.Valid()) {
+    loadManifest();
+    timer.Phase("load manifest");
+  }
+
+  if (recovery) {
+    ingest_plan_.Build(columns_type_, column_num_);
+    replayWal(old_wals);
+    timer.Phase("replay wal");
+  }
+
+  if (write_phase && g_config.wal_mode != WalMode::OFF) {
+    openWal(old_wals);
+    timer.Phase("open wal");
+  }
   LOG_INFO("======== Finish connect!========");
   return 0;
 }
 
 int TSDBEngineImpl::createTable(const std::string& tableName, const Schema& schema) {
   LOG_INFO("start create table %s", tableName.c_str());
-  LOG_ASSERT(kColumnNum == (int32_t)schema.columnTypeMap.size(), "schema.column.num != 60");
-  columns_name_ = new std::string[kColumnNum];
-  columns_type_ = new ColumnType[kColumnNum];
+  if (columns_type_ != nullptr) {
+    // 从日志恢复出来的或者读阶段已经加载的表，schema必须和已有的一致
+    bool same = (int)schema.columnTypeMap.size() == column_num_;
+    int i = 0;
+    for (auto it = schema.columnTypeMap.cbegin(); same && it != schema.columnTypeMap.cend(); ++it, ++i) {
+      same = it->first == columns_name_[i] && it->second == columns_type_[i];
+    }
+    if (!same) {
+      LOG_ERROR("table %s already exists with a different schema", tableName.c_str());
+      return -1;
+    }
+    LOG_INFO("table %s already exists", tableName.c_str());
+    return 0;
+  }
+  column_num_ = schema.columnTypeMap.size();
+  LOG_ASSERT(column_num_ > 0 && column_num_ <= kMaxColumnNum, "invalid schema.column.num %d", column_num_);
+  columns_name_ = new std::string[column_num_];
+  columns_type_ = new ColumnType[column_num_];
   int i = 0;
   for (auto it = schema.columnTypeMap.cbegin(); it != schema.columnTypeMap.cend(); ++it) {
     column_idx_.emplace(it->first, i);
@@ -166,9 +369,11 @@ int TSDBEngineImpl::createTable(const std::string& tableName, const Schema& sche
     columns_type_[i++] = it->second;
   }
 
-  for (int i = 0; i < kShardNum; i++) {
-    shards_[i]->InitMemTable();
-  }
+  ingest_plan_.Build(columns_type_, column_num_);
+  block_layout_.Build(columns_type_, column_num_);
+  g_config.FinalizeMemtable(column_num_);
+  // 崩溃恢复需要schema才能解析日志
+  saveSchema();
 
   LOG_INFO("create table %s finished", tableName.c_str());
   return 0;
@@ -176,12 +381,12 @@ int TSDBEngineImpl::createTable(const std::string& tableName, const Schema& sche
 
 void TSDBEngineImpl::saveSchema() {
   // Persist the schema.
-  if (kColumnNum > 0) {
+  if (column_num_ > 0) {
     std::ofstream schemaFout;
-    schemaFout.open(getDataPath() + "/schema", std::ios::out);
-    schemaFout << kColumnNum;
+    schemaFout.open(getDataPath() + "/schema", std::ios::out | std::ios::trunc);
+    schemaFout << column_num_;
     schemaFout << " ";
-    for (int i = 0; i < kColumnNum; ++i) {
+    for (int i = 0; i < column_num_; ++i) {
       schemaFout << columns_name_[i] << " ";
       schemaFout << (int32_t)columns_type_[i] << " ";
     }
@@ -191,7 +396,18 @@ void TSDBEngineImpl::saveSchema() {
 
 int TSDBEngineImpl::shutdown() {
   LOG_INFO("start shutdown");
+  PhaseTimer timer("shutdown");
+  // 等后台的checkpoint结束，它还会切换日志和写manifest
+  if (checkpoint_thread_.joinable()) {
+    checkpoint_thread_.join();
+  }
   inflight_write_.Wait();
+  for (auto wal : wal_) {
+    delete wal;
+  }
+  wal_.clear();
+  wal_gate_.clear();
+  timer.Phase("wait inflight writes");
   // Close all resources, assuming all writing and reading process has finished.
   // No mutex is fetched by assumptions.
   // save schema
@@ -200,53 +416,35 @@ int TSDBEngineImpl::shutdown() {
 
   // flush memtable
   LOG_INFO("Start flush memtable");
-  WaitGroup wg(kShardNum);
-  for (int i = 0; i < kShardNum; i++) {
-    coro_pool_->enqueue(
-      [&wg, this, i]() {
-        for (int svid = 0 ; svid < kVinNumPerShard; svid++) {
-          shards_[i]->Flush(svid, true);
-        }
-        wg.Done();
-      },
-      shard2tid(i));
-  }
-  wg.Wait();
+  forEachShard([this](int i) {
+    for (int svid = 0; svid < g_config.vin_num_per_shard; svid++) {
+      shards_[i]->Flush(svid);
+    }
+    shards_[i]->FlushWriteBuffer();
+  });
+  timer.Phase("flush memtables");
 
   if (write_phase) {
-    print_file_summary(columns_type_, columns_name_);
+    print_file_summary(column_num_, columns_type_, columns_name_);
   }
   print_performance_statistic();
 
-  // save block meta
-  for (int i = 0; i < kShardNum; i++) {
-    std::string filename = ShardMetaFileName(dataDirPath, kTableName, i);
-    File* file = io_mgr_->Open(filename, NORMAL_FLAG);
-    shards_[i]->SaveBlockMeta(file);
-  }
-
-  // save latest row cache
-  for (int i = 0; i < kShardNum; i++) {
-    std::string filename = LatestRowFileName(dataDirPath, kTableName, i);
-    File* file = io_mgr_->Open(filename, NORMAL_FLAG);
-    shards_[i]->SaveLatestRowCache(file);
-  }
-
-  // save vin2vid
-  {
-    vin2vid_lck_.wlock();
-    std::string filename = Vin2vidFileName(dataDirPath, kTableName);
-    File* file = io_mgr_->Open(filename, NORMAL_FLAG);
-    int num = vin2vid_.size();
-    file->write((char*)&num, sizeof(num));
-    for (auto& pair : vin2vid_) {
-      LOG_ASSERT(pair.first.size() == VIN_LENGTH, "size = %zu", pair.first.size());
-      file->write(pair.first.c_str(), VIN_LENGTH);
-      file->write((char*)&pair.second, sizeof(pair.second));
+  // 读阶段没有修改元数据，manifest不变
+  if (write_phase) {
+    forEachShard([this](int i) { shards_[i]->SaveRollups(); });
+    timer.Phase("save rollups");
+    // manifest的编辑完整写入就表示写阶段正常结束，之后日志就没用了
+    saveManifest();
+    for (auto& filename : listTableFiles({".wal"})) {
+      RemoveFile(filename);
     }
-    vin2vid_lck_.unlock();
+    timer.Phase("save manifest");
   }
 
+  // 每个调度线程并行关闭自己的异步文件
+  forEachTid([this](int tid) { io_mgr_->CloseAsyncFiles(tid); });
+  timer.Phase("close files");
+
   if (coro_pool_ != nullptr) {
     delete coro_pool_;
     coro_pool_ = nullptr;
@@ -262,17 +460,25 @@ int TSDBEngineImpl::shutdown() {
     columns_name_ = nullptr;
   }
 
+  WriteBatch* batch = nullptr;
+  while (write_batch_pool_.try_dequeue(batch)) {
+    delete batch;
+  }
+
   if (io_mgr_ != nullptr) {
     delete io_mgr_;
     io_mgr_ = nullptr;
   }
 
-  for (int i = 0; i < kShardNum; i++) {
+  for (int i = 0; i < g_config.shard_num; i++) {
     if (shards_[i] != nullptr) {
       delete shards_[i];
       shards_[i] = nullptr;
     }
   }
+  // shard中的BlockMeta可能指向manifest的映射，shard释放之后才能解除映射
+  manifest_.Close();
+  timer.Phase("release");
 
   // DestroyMemPool();
   // std::free(mem_pool_addr_);
@@ -281,49 +487,240 @@ int TSDBEngineImpl::shutdown() {
   return 0;
 }
 
-std::mutex mm;
 int TSDBEngineImpl::write(const WriteRequest& writeRequest) {
   RECORD_FETCH_ADD(write_cnt, writeRequest.rows.size());
-  std::vector<std::vector<Row>> rows(kWorkerThread);
-  for (auto& row : writeRequest.rows) {
-    uint16_t vid = getVidForWrite(row.vin);
-#ifdef ENABLE_STAT
-    // if (print_row_cnt.fetch_add(1) <= 100) {
-    //   mm.lock();
-    //   print_row(row, vid);
-    //   mm.unlock();
-    // }
-#endif
-    int shard = sharding(vid);
-    int tid = shard2tid(shard);
-    rows[tid].emplace_back(std::move(row));
-
-    LOG_ASSERT(vid != UINT16_MAX, "error");
+  if (!wal_.empty() && g_config.wal_mode == WalMode::SYNC) {
+    WaitGroup durable;
+    submitWrite(writeRequest.rows, true, &durable);
+    durable.Wait();
+  } else {
+    submitWrite(writeRequest.rows, !wal_.empty(), nullptr);
+  }
+  if (UNLIKELY(checkpoint_wanted_.load(std::memory_order_relaxed)) && !checkpointing_.exchange(true)) {
+    // checkpoint在后台线程上做，write只等自己的行落盘；每个调度线程上的写入只在这个线程的memtable下刷期间等待
+    if (checkpoint_thread_.joinable()) {
+      checkpoint_thread_.join(); // 上一次checkpoint已经结束，只是线程还没有回收
+    }
+    checkpoint_thread_ = std::thread([this]() {
+      checkpoint();
+      checkpointing_.store(false);
+    });
   }
+  return 0;
+}
 
-  if (UNLIKELY(write_phase)) {
-    while (sync_) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void TSDBEngineImpl::submitWrite(const std::vector<Row>& rows, bool log, WaitGroup* durable) {
+  // 按scheduler拆分，每一行只查一次vid，之后带着vid一路传下去
+  // 这里不会让出，可以用thread_local的数组
+  thread_local std::vector<WriteBatch*> batches;
+  batches.assign(g_config.worker_thread, nullptr);
+  for (auto& row : rows) {
+    uint16_t vid = getVidForWrite(row.vin);
+    LOG_ASSERT(vid != UINT16_MAX, "error");
+    int tid = shard2tid(sharding(vid));
+    if (batches[tid] == nullptr) {
+      batches[tid] = allocWriteBatch();
+      batches[tid]->log = log;
+      batches[tid]->durable = durable;
     }
+    batches[tid]->rows.emplace_back(vid, row);
+    submitted_seq_[vid].fetch_add(1, std::memory_order_relaxed);
   }
 
-  for (int tid = 0; tid < kWorkerThread; tid++) {
-    if (rows[tid].empty()) {
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
+    if (batches[tid] == nullptr) {
       continue;
     }
     inflight_write_.Add();
+    if (durable != nullptr) {
+      durable->Add();
+    }
     coro_pool_->enqueue(
-      [this, rs = std::move(rows[tid])]() {
-        for (auto& r : rs) {
-          uint16_t vid = getVidForRead(r.vin);
-          int shard = sharding(vid);
-          shards_[shard]->Write(vid, r);
+      [this, tid, batch = batches[tid]]() {
+        bool log = batch->log;
+        if (log) {
+          // checkpoint切换日志的时候等待；开始写日志之后，checkpoint要等这一批写进memtable
+          WalGate& gate = wal_gate_[tid];
+          while (gate.closed) {
+            gate.cv.wait();
+          }
+          gate.active++;
+          // 先写日志再写memtable，同一个线程上并发的写入共享一次落盘
+          WalWriter* wal = wal_[tid];
+          for (auto& r : batch->rows) {
+            wal->Append(r.second);
+          }
+          wal->Sync();
+          if (wal->Size() >= g_config.wal_checkpoint_size / g_config.worker_thread) {
+            checkpoint_wanted_.store(true, std::memory_order_relaxed);
+          }
+        }
+        if (batch->durable != nullptr) {
+          batch->durable->Done();
+        }
+
+        auto& sorted = batch->sorted;
+        for (auto& r : batch->rows) {
+          sorted.emplace_back(r.first, &r.second);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < sorted.size();) {
+          uint16_t vid = sorted[i].first;
+          batch->group.clear();
+          for (; i < sorted.size() && sorted[i].first == vid; i++) {
+            batch->group.push_back(sorted[i].second);
+          }
+          shards_[sharding(vid)]->WriteRows(vid, batch->group.data(), batch->group.size());
+          applied_seq_[vid].fetch_add(batch->group.size(), std::memory_order_release);
         }
+        if (log) {
+          WalGate& gate = wal_gate_[tid];
+          if (--gate.active == 0 && gate.closed) {
+            gate.cv.notify();
+          }
+        }
+        freeWriteBatch(batch);
         inflight_write_.Done();
       },
       tid);
   }
-  return 0;
+}
+
+TSDBEngineImpl::WriteBatch* TSDBEngineImpl::allocWriteBatch() {
+  WriteBatch* batch = nullptr;
+  if (!write_batch_pool_.try_dequeue(batch)) {
+    batch = new WriteBatch();
+  }
+  return batch;
+}
+
+void TSDBEngineImpl::freeWriteBatch(WriteBatch* batch) {
+  // 只析构Row，保留vector的容量给下一次复用
+  batch->rows.clear();
+  batch->sorted.clear();
+  batch->group.clear();
+  batch->log = true;
+  batch->durable = nullptr;
+  write_batch_pool_.enqueue(batch);
+}
+
+std::vector<std::string> TSDBEngineImpl::listTableFiles(const std::vector<std::string>& exts) {
+  std::vector<std::string> files;
+  std::error_code ec;
+  for (auto& entry : std::filesystem::directory_iterator(dataDirPath, ec)) {
+    const auto& path = entry.path();
+    std::string name = path.filename().string();
+    if (name.compare(0, kTableName.size(), kTableName) != 0) {
+      continue;
+    }
+    if (std::find(exts.begin(), exts.end(), path.extension().string()) != exts.end()) {
+      files.push_back(path.string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+void TSDBEngineImpl::openWal(const std::vector<std::string>& old_wals) {
+  // 从checkpoint恢复的时候，manifest中记录的gen之前的日志都已经删除了
+  uint32_t gen = wal_gen_;
+  for (auto& filename : old_wals) {
+    uint32_t old_gen = 0;
+    int tid = 0;
+    if (parseWalFileName(filename, old_gen, tid)) {
+      gen = std::max(gen, old_gen + 1);
+    }
+  }
+  // 旧的日志在下一次checkpoint或者正常shutdown之前都要保留，新的写入记到新的一代日志里
+  wal_gen_ = gen;
+  wal_.assign(g_config.worker_thread, nullptr);
+  wal_gate_ = std::vector<WalGate>(g_config.worker_thread);
+  forEachTid([this, gen](int tid) {
+    // O_DSYNC：每一组写完成的时候已经落盘，不需要再fdatasync
+    auto file = io_mgr_->OpenAsyncWriteFile(WalFileName(dataDirPath, kTableName, gen, tid), tid, O_DSYNC);
+    wal_[tid] = new WalWriter(static_cast<AsyncWriteFile*>(file));
+  });
+}
+
+void TSDBEngineImpl::replayWal(const std::vector<std::string>& wals) {
+  LOG_INFO("start replay wal");
+  std::map<uint32_t, std::vector<std::string>> gens;
+  for (auto& filename : wals) {
+    uint32_t gen = 0;
+    int tid = 0;
+    if (!parseWalFileName(filename, gen, tid)) {
+      LOG_ERROR("unexpected wal file %s, ignore it", filename.c_str());
+      continue;
+    }
+    gens[gen].push_back(filename);
+  }
+  // 按代从旧到新回放，一代的行全部写入memtable之后才开始下一代；同一代中每个调度线程一个文件，并行回放
+  std::atomic<size_t> total{0};
+  for (auto& [gen, files] : gens) {
+    std::vector<std::thread> readers;
+    for (auto& filename : files) {
+      readers.emplace_back([this, &filename, &total]() {
+        WalReader reader(filename, column_num_, columns_type_, columns_name_);
+        std::vector<Row> rows;
+        while (reader.Next(rows)) {
+          submitWrite(rows, false, nullptr);
+          total += rows.size();
+        }
+      });
+    }
+    for (auto& reader : readers) {
+      reader.join();
+    }
+    inflight_write_.Wait();
+  }
+  LOG_INFO("replay wal finished, %zu rows from %zu files in %zu generations", total.load(), wals.size(), gens.size());
+}
+
+void TSDBEngineImpl::checkpoint() {
+  PhaseTimer timer("checkpoint");
+  uint32_t gen = wal_gen_ + 1;
+  std::vector<ManifestEditBuilder> parts(g_config.shard_num, ManifestEditBuilder(block_layout_, 0));
+  forEachTid([this, gen, &parts](int tid) {
+    WalGate& gate = wal_gate_[tid];
+    gate.closed = true;
+    while (gate.active > 0) {
+      gate.cv.wait();
+    }
+    // 旧日志中的行都已经写进memtable，之后的写入记到新的一代日志里
+    AsyncWriteFile* old_file = wal_[tid]->file();
+    delete wal_[tid];
+    io_mgr_->CloseAsyncFile(old_file, tid);
+    auto file = io_mgr_->OpenAsyncWriteFile(WalFileName(dataDirPath, kTableName, gen, tid), tid, O_DSYNC);
+    wal_[tid] = new WalWriter(static_cast<AsyncWriteFile*>(file));
+
+    // 关口打开之前下刷，编辑中的数据正好是旧日志中的所有行
+    for (int i = 0; i < g_config.shard_num; i++) {
+      if (shard2tid(i) != tid) {
+        continue;
+      }
+      for (int svid = 0; svid < g_config.vin_num_per_shard; svid++) {
+        shards_[i]->Flush(svid);
+      }
+      shards_[i]->FlushWriteBuffer();
+      shards_[i]->AppendManifestEdit(parts[i]);
+    }
+    gate.closed = false;
+    gate.cv.notify();
+  });
+  wal_gen_ = gen;
+  checkpoint_wanted_.store(false, std::memory_order_relaxed);
+  timer.Phase("flush memtables");
+
+  appendManifest(parts, wal_gen_, 0);
+  for (auto& filename : listTableFiles({".wal"})) {
+    uint32_t file_gen = 0;
+    int tid = 0;
+    if (parseWalFileName(filename, file_gen, tid) && file_gen < wal_gen_) {
+      RemoveFile(filename);
+    }
+  }
+  timer.Phase("append manifest");
 }
 
 int TSDBEngineImpl::executeLatestQuery(const LatestQueryRequest& pReadReq, std::vector<Row>& pReadRes) {
@@ -335,7 +732,7 @@ int TSDBEngineImpl::executeLatestQuery(const LatestQueryRequest& pReadReq, std::
 
   WaitGroup wg;
   std::mutex mt;
-  std::vector<std::vector<uint16_t>> vids(kWorkerThread);
+  std::vector<std::vector<uint16_t>> vids(g_config.worker_thread);
   for (const auto& vin : pReadReq.vins) {
     uint16_t vid = getVidForRead(vin);
     if (vid == UINT16_MAX) {
@@ -344,9 +741,10 @@ int TSDBEngineImpl::executeLatestQuery(const LatestQueryRequest& pReadReq, std::
     int shard = sharding(vid);
     int tid = shard2tid(shard);
     vids[tid].push_back(vid);
+    waitWritesApplied(vid);
   }
 
-  for (int tid = 0; tid < kWorkerThread; tid++) {
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
     if (vids[tid].empty()) {
       continue;
     }
@@ -390,13 +788,7 @@ int TSDBEngineImpl::executeTimeRangeQuery(const TimeRangeQueryRequest& trReadReq
   }
 #endif
 
-  if (UNLIKELY(write_phase)) {
-    sync_ = true;
-    while (inflight_write_.Cnt() != 0) {
-      std::this_thread::yield();
-    }
-    write_phase_sync.fetch_add(1);
-  }
+  waitWritesApplied(vid);
 
   int shard = sharding(vid);
   WaitGroup wg(1);
@@ -408,11 +800,154 @@ int TSDBEngineImpl::executeTimeRangeQuery(const TimeRangeQueryRequest& trReadReq
     shard2tid(shard));
   wg.Wait();
 
-  if (UNLIKELY(write_phase)) {
-    if (write_phase_sync.fetch_sub(1) == 1) {
-      sync_ = false;
+  return 0;
+}
+
+int TSDBEngineImpl::executeTimeRangeQueryColumnar(const TimeRangeQueryRequest& trReadReq, ColumnBatch& trReadRes) {
+  RECORD_FETCH_ADD(time_range_query_cnt, 1);
+  std::vector<int> colids;
+  fillColids(trReadReq.requestedColumns, colids);
+
+  trReadRes.Clear();
+  trReadRes.vin = trReadReq.vin;
+  trReadRes.columns.reserve(colids.size());
+  for (auto colid : colids) {
+    trReadRes.columns.emplace_back(columns_name_[colid], columns_type_[colid]);
+  }
+
+  uint16_t vid = getVidForRead(trReadReq.vin);
+  if (UNLIKELY(vid == UINT16_MAX)) {
+    return 0;
+  }
+
+  waitWritesApplied(vid);
+
+  int shard = sharding(vid);
+  WaitGroup wg(1);
+  coro_pool_->enqueue(
+    [this, shard, vid, &trReadReq, &colids, &trReadRes, &wg]() {
+      shards_[shard]->GetColumnsFromTimeRange(vid, trReadReq.timeLowerBound, trReadReq.timeUpperBound, colids,
+                                              trReadRes);
+      wg.Done();
+    },
+    shard2tid(shard));
+  wg.Wait();
+
+  return 0;
+}
+
+int TSDBEngineImpl::executeTimeRangeFilteredQuery(const TimeRangeFilteredQueryRequest& trReadReq,
+                                                  std::vector<Row>& trReadRes) {
+  RECORD_FETCH_ADD(time_range_query_cnt, 1);
+  auto iter = column_idx_.find(trReadReq.filterColumnName);
+  if (UNLIKELY(iter == column_idx_.end())) {
+    LOG_ERROR("request invalid filter column name.");
+    return -1;
+  }
+  int filter_colid = iter->second;
+  std::vector<int> colids;
+  fillColids(trReadReq.requestedColumns, colids);
+
+  uint16_t vid = getVidForRead(trReadReq.vin);
+  if (UNLIKELY(vid == UINT16_MAX)) {
+    return 0;
+  }
+
+  waitWritesApplied(vid);
+
+  int shard = sharding(vid);
+  WaitGroup wg(1);
+  coro_pool_->enqueue(
+    [this, shard, vid, &trReadReq, &colids, filter_colid, &trReadRes, &wg]() {
+      shards_[shard]->GetFilteredRowsFromTimeRange(vid, trReadReq.timeLowerBound, trReadReq.timeUpperBound, colids,
+                                                   filter_colid, trReadReq.columnFilter, trReadRes);
+      wg.Done();
+    },
+    shard2tid(shard));
+  wg.Wait();
+
+  return 0;
+}
+
+int TSDBEngineImpl::executeTimeRangeBatchQuery(const TimeRangeBatchQueryRequest& trReadReq,
+                                               std::vector<Row>& trReadRes) {
+  RECORD_FETCH_ADD(time_range_query_cnt, trReadReq.vins.size());
+  std::vector<int> colids;
+  fillColids(trReadReq.requestedColumns, colids);
+
+  std::vector<std::vector<uint16_t>> vids;
+  std::vector<std::vector<int>> idxs;
+  groupVinsByTid(trReadReq.vins, vids, idxs);
+
+  waitWritesApplied(vids);
+
+  // 每个vin的结果先放到自己的位置，最后按请求中vin的顺序合并，不需要加锁
+  std::vector<std::vector<Row>> vin_rows(trReadReq.vins.size());
+  WaitGroup wg;
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
+    if (vids[tid].empty()) {
+      continue;
+    }
+    wg.Add();
+    coro_pool_->enqueue(
+      [this, &vs = vids[tid], &is = idxs[tid], &trReadReq, &colids, &wg, &vin_rows]() {
+        forEachVid(vs, [&](size_t i) {
+          shards_[sharding(vs[i])]->GetRowsFromTimeRange(vs[i], trReadReq.timeLowerBound, trReadReq.timeUpperBound,
+                                                         colids, vin_rows[is[i]]);
+        });
+        wg.Done();
+      },
+      tid);
+  }
+  wg.Wait();
+
+  for (auto& rows : vin_rows) {
+    trReadRes.insert(trReadRes.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+  }
+  return 0;
+}
+
+int TSDBEngineImpl::executeTimeRangeBatchQueryColumnar(const TimeRangeBatchQueryRequest& trReadReq,
+                                                       std::vector<ColumnBatch>& trReadRes) {
+  RECORD_FETCH_ADD(time_range_query_cnt, trReadReq.vins.size());
+  std::vector<int> colids;
+  fillColids(trReadReq.requestedColumns, colids);
+
+  trReadRes.clear();
+  trReadRes.resize(trReadReq.vins.size());
+  for (size_t i = 0; i < trReadReq.vins.size(); i++) {
+    trReadRes[i].vin = trReadReq.vins[i];
+    trReadRes[i].columns.reserve(colids.size());
+    for (auto colid : colids) {
+      trReadRes[i].columns.emplace_back(columns_name_[colid], columns_type_[colid]);
     }
   }
+
+  std::vector<std::vector<uint16_t>> vids;
+  std::vector<std::vector<int>> idxs;
+  groupVinsByTid(trReadReq.vins, vids, idxs);
+
+  waitWritesApplied(vids);
+
+  // 每个vin写自己的batch，不需要加锁
+  WaitGroup wg;
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
+    if (vids[tid].empty()) {
+      continue;
+    }
+    wg.Add();
+    coro_pool_->enqueue(
+      [this, &vs = vids[tid], &is = idxs[tid], &trReadReq, &colids, &wg, &trReadRes]() {
+        forEachVid(vs, [&](size_t i) {
+          shards_[sharding(vs[i])]->GetColumnsFromTimeRange(vs[i], trReadReq.timeLowerBound,
+                                                            trReadReq.timeUpperBound, colids, trReadRes[is[i]]);
+        });
+        wg.Done();
+      },
+      tid);
+  }
+  wg.Wait();
+
   return 0;
 }
 
@@ -435,6 +970,7 @@ int TSDBEngineImpl::executeAggregateQuery(const TimeRangeAggregationRequest& agg
   }
 #endif
   int colid = column_idx_.at(aggregationReq.columnName);
+  waitWritesApplied(vid);
 
   int shard = sharding(vid);
   WaitGroup wg(1);
@@ -476,6 +1012,7 @@ int TSDBEngineImpl::executeDownsampleQuery(const TimeRangeDownsampleRequest& dow
 #endif
 
   int colid = column_idx_.at(downsampleReq.columnName);
+  waitWritesApplied(vid);
 
   int shard = sharding(vid);
   WaitGroup wg(1);
@@ -497,53 +1034,152 @@ int TSDBEngineImpl::executeDownsampleQuery(const TimeRangeDownsampleRequest& dow
   return 0;
 }
 
+int TSDBEngineImpl::executeAggregateBatchQuery(const TimeRangeAggregationBatchRequest& aggregationReq,
+                                               std::vector<std::vector<Row>>& aggregationRes) {
+  RECORD_FETCH_ADD(agg_query_cnt, aggregationReq.items.size());
+  std::vector<const AggregationItem*> items;
+  items.reserve(aggregationReq.items.size());
+  for (auto& item : aggregationReq.items) {
+    items.push_back(&item);
+  }
+  std::vector<const CompareExpression*> filters(items.size(), nullptr);
+  batchAggregate(items, filters, aggregationReq.timeLowerBound, aggregationReq.timeUpperBound,
+                 aggregationReq.timeUpperBound - aggregationReq.timeLowerBound, aggregationRes);
+  return 0;
+}
+
+int TSDBEngineImpl::executeDownsampleBatchQuery(const TimeRangeDownsampleBatchRequest& downsampleReq,
+                                                std::vector<std::vector<Row>>& downsampleRes) {
+  RECORD_FETCH_ADD(downsample_query_cnt, downsampleReq.items.size());
+  std::vector<const AggregationItem*> items;
+  std::vector<const CompareExpression*> filters;
+  items.reserve(downsampleReq.items.size());
+  filters.reserve(downsampleReq.items.size());
+  for (auto& item : downsampleReq.items) {
+    items.push_back(&item);
+    filters.push_back(&item.columnFilter);
+  }
+  batchAggregate(items, filters, downsampleReq.timeLowerBound, downsampleReq.timeUpperBound, downsampleReq.interval,
+                 downsampleRes);
+  return 0;
+}
+
+void TSDBEngineImpl::batchAggregate(const std::vector<const AggregationItem*>& items,
+                                    const std::vector<const CompareExpression*>& filters, int64_t lowerInclusive,
+                                    int64_t upperExclusive, int64_t interval, std::vector<std::vector<Row>>& res) {
+  res.clear();
+  res.resize(items.size());
+  if (UNLIKELY(interval <= 0 || upperExclusive <= lowerInclusive)) {
+    return;
+  }
+
+  // 按scheduler分组，组内再按vid排序，同一个vid的项一起交给shard执行
+  std::vector<std::vector<std::pair<uint16_t, ShardImpl::BatchAggItem>>> groups(g_config.worker_thread);
+  for (size_t i = 0; i < items.size(); i++) {
+    uint16_t vid = getVidForRead(items[i]->vin);
+    if (vid == UINT16_MAX) {
+      continue;
+    }
+    auto iter = column_idx_.find(items[i]->columnName);
+    if (UNLIKELY(iter == column_idx_.end())) {
+      LOG_ERROR("request invalid column name.");
+      continue;
+    }
+    ShardImpl::BatchAggItem item{iter->second, items[i]->aggregator, filters[i], &res[i]};
+    groups[shard2tid(sharding(vid))].emplace_back(vid, item);
+    waitWritesApplied(vid);
+  }
+
+  WaitGroup wg;
+  for (int tid = 0; tid < g_config.worker_thread; tid++) {
+    auto& group = groups[tid];
+    if (group.empty()) {
+      continue;
+    }
+    std::stable_sort(group.begin(), group.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    wg.Add();
+    coro_pool_->enqueue(
+      [this, &group, lowerInclusive, upperExclusive, interval, &wg]() {
+        // 同一个vid的项是group中连续的一段[begins[k], begins[k + 1])，不同的vid并发执行
+        std::vector<uint16_t> vids;
+        std::vector<size_t> begins;
+        for (size_t i = 0; i < group.size(); i++) {
+          if (i == 0 || group[i].first != group[i - 1].first) {
+            vids.push_back(group[i].first);
+            begins.push_back(i);
+          }
+        }
+        begins.push_back(group.size());
+        forEachVid(vids, [&](size_t k) {
+          std::vector<ShardImpl::BatchAggItem> vid_items;
+          for (size_t i = begins[k]; i < begins[k + 1]; i++) {
+            vid_items.push_back(group[i].second);
+          }
+          shards_[sharding(vids[k])]->BatchAggregateQuery(vids[k], lowerInclusive, upperExclusive, interval,
+                                                          vid_items);
+        });
+        wg.Done();
+      },
+      tid);
+  }
+  wg.Wait();
+}
+
 TSDBEngineImpl::~TSDBEngineImpl() = default;
 
 uint16_t TSDBEngineImpl::getVidForRead(const Vin& vin) {
-  vin2vid_lck_.rlock();
-  std::string str(vin.vin, VIN_LENGTH);
-  auto it = vin2vid_.find(str);
-  if (it == vin2vid_.end()) {
-    vin2vid_lck_.unlock();
+  uint16_t vid = vin_dict_.Get(vin.vin);
+  if (UNLIKELY(vid == VinDict::kInvalidVid)) {
     LOG_ERROR("lookup invalid VIN");
     return UINT16_MAX;
   }
-  uint16_t vid = it->second;
-  vin2vid_lck_.unlock();
-
   return vid;
 }
 
 uint16_t TSDBEngineImpl::getVidForWrite(const Vin& vin) {
-  uint16_t vid = UINT16_MAX;
-  std::string str(vin.vin, VIN_LENGTH);
-  vin2vid_lck_.rlock();
-  auto it = vin2vid_.find(str);
-  if (LIKELY(it != vin2vid_.cend())) {
-    vid = it->second;
-    vin2vid_lck_.unlock();
-  } else {
-    vin2vid_lck_.unlock();
-    vin2vid_lck_.wlock();
-    it = vin2vid_.find(str);
-    if (LIKELY(it == vin2vid_.cend())) {
-      vid = vid_cnt_;
-#ifdef ENABLE_STAT
-      if (vid % 10000 == 9999) {
-        LOG_INFO("vid %d", vid);
+  uint16_t vid = vin_dict_.GetOrInsert(vin.vin);
+  LOG_ASSERT(vid != UINT16_MAX, "vid == UINT16_MAX");
+  return vid;
+}
+
+void TSDBEngineImpl::waitWritesApplied(uint16_t vid) {
+  if (UNLIKELY(write_phase)) {
+    // 在调用者线程上等待，不占用协程：这个vid的写入任务可能还排在调度器的队列里
+    uint64_t target = submitted_seq_[vid].load(std::memory_order_acquire);
+    if (applied_seq_[vid].load(std::memory_order_acquire) >= target) {
+      return;
+    }
+    RECORD_FETCH_ADD(write_phase_sync, 1);
+    while (applied_seq_[vid].load(std::memory_order_acquire) < target) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TSDBEngineImpl::waitWritesApplied(const std::vector<std::vector<uint16_t>>& vids) {
+  if (UNLIKELY(write_phase)) {
+    for (auto& vs : vids) {
+      for (auto vid : vs) {
+        waitWritesApplied(vid);
       }
-#endif
-      vid2vin_.emplace(std::make_pair(vid_cnt_, str));
-      vin2vid_.emplace(std::make_pair(str, vid_cnt_++));
-      vin2vid_lck_.unlock();
-    } else {
-      vid = it->second;
-      vin2vid_lck_.unlock();
     }
-    LOG_ASSERT(vid != UINT16_MAX, "vid == UINT16_MAX");
   }
+}
 
-  return vid;
+void TSDBEngineImpl::groupVinsByTid(const std::vector<Vin>& vins, std::vector<std::vector<uint16_t>>& vids,
+                                    std::vector<std::vector<int>>& idxs) {
+  vids.assign(g_config.worker_thread, {});
+  idxs.assign(g_config.worker_thread, {});
+  for (size_t i = 0; i < vins.size(); i++) {
+    uint16_t vid = getVidForRead(vins[i]);
+    if (vid == UINT16_MAX) {
+      continue;
+    }
+    int tid = shard2tid(sharding(vid));
+    vids[tid].push_back(vid);
+    idxs[tid].push_back(i);
+  }
 }
 
 void TSDBEngineImpl::fillColids(const std::set<std::string>& requestedColumns, std::vector<int>& colids) {
@@ -558,7 +1194,7 @@ void TSDBEngineImpl::fillColids(const std::set<std::string>& requestedColumns, s
 
   if (UNLIKELY(colids.empty())) {
     // LOG_DEBUG("request all columns");
-    for (int i = 0; i < kColumnNum; i++) {
+    for (int i = 0; i < column_num_; i++) {
       colids.emplace_back(i);
     }
   }
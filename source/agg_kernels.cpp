@@ -0,0 +1,359 @@
+#include "agg_kernels.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "util/logging.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AGG_KERNELS_X86
+#endif
+
+namespace LindormContest {
+
+namespace {
+
+// 标量实现，也用来处理SIMD循环剩下的尾部，从第i行开始
+void rangeMaskFrom(const int64_t* tss, int i, int n, int64_t lo, int64_t hi, uint8_t* mask) {
+  for (; i < n; i++) {
+    mask[i] = lo <= tss[i] && tss[i] < hi ? 0xff : 0;
+  }
+}
+
+template <typename T>
+void filterMaskFrom(const T* data, int i, int n, CompareOp op, T val, uint8_t* mask) {
+  for (; i < n; i++) {
+    bool pass = op == GREATER ? data[i] > val : data[i] == val;
+    mask[i] &= pass ? 0xff : 0;
+  }
+}
+
+template <typename T>
+void aggregateFrom(const T* data, const uint8_t* mask, int i, int n, MaskedAgg<T>& res) {
+  for (; i < n; i++) {
+    if (mask[i] == 0) continue;
+    T v = data[i];
+    res.cnt++;
+    res.sum += v;
+    res.max = std::max(res.max, v);
+    res.min = std::min(res.min, v);
+  }
+}
+
+void rangeMaskScalar(const int64_t* tss, int n, int64_t lo, int64_t hi, uint8_t* mask) {
+  rangeMaskFrom(tss, 0, n, lo, hi, mask);
+}
+
+void filterMaskIntScalar(const int* data, int n, CompareOp op, int val, uint8_t* mask) {
+  filterMaskFrom(data, 0, n, op, val, mask);
+}
+
+void filterMaskDoubleScalar(const double* data, int n, CompareOp op, double val, uint8_t* mask) {
+  filterMaskFrom(data, 0, n, op, val, mask);
+}
+
+void aggregateIntScalar(const int* data, const uint8_t* mask, int n, MaskedAgg<int>& res) {
+  aggregateFrom(data, mask, 0, n, res);
+}
+
+void aggregateDoubleScalar(const double* data, const uint8_t* mask, int n, MaskedAgg<double>& res) {
+  aggregateFrom(data, mask, 0, n, res);
+}
+
+const AggKernels kScalarKernels = {
+  "scalar",           rangeMaskScalar,    filterMaskIntScalar, filterMaskDoubleScalar,
+  aggregateIntScalar, aggregateDoubleScalar,
+};
+
+#ifdef AGG_KERNELS_X86
+
+// movemask得到的每个比特展开成一个字节的掩码
+struct ExpandTable {
+  uint64_t v[256];
+  constexpr ExpandTable() : v() {
+    for (int bits = 0; bits < 256; bits++) {
+      for (int k = 0; k < 8; k++) {
+        if (bits >> k & 1) v[bits] |= 0xffULL << (8 * k);
+      }
+    }
+  }
+};
+constexpr ExpandTable kExpand;
+
+// 掩码每个选中的行是8个比特
+inline int maskCount(uint64_t m) { return __builtin_popcountll(m) / 8; }
+
+// AVX2，一次处理4个时间戳、8个int或者4个double
+
+__attribute__((target("avx2,popcnt"))) void rangeMaskAvx2(const int64_t* tss, int n, int64_t lo, int64_t hi,
+                                                          uint8_t* mask) {
+  __m256i vlo = _mm256_set1_epi64x(lo);
+  __m256i vhi = _mm256_set1_epi64x(hi);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tss + i));
+    __m256i in = _mm256_andnot_si256(_mm256_cmpgt_epi64(vlo, t), _mm256_cmpgt_epi64(vhi, t));
+    uint32_t m = kExpand.v[_mm256_movemask_pd(_mm256_castsi256_pd(in))];
+    memcpy(mask + i, &m, 4);
+  }
+  rangeMaskFrom(tss, i, n, lo, hi, mask);
+}
+
+__attribute__((target("avx2,popcnt"))) void filterMaskIntAvx2(const int* data, int n, CompareOp op, int val,
+                                                              uint8_t* mask) {
+  __m256i v = _mm256_set1_epi32(val);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i c = op == GREATER ? _mm256_cmpgt_epi32(x, v) : _mm256_cmpeq_epi32(x, v);
+    uint64_t m;
+    memcpy(&m, mask + i, 8);
+    m &= kExpand.v[_mm256_movemask_ps(_mm256_castsi256_ps(c))];
+    memcpy(mask + i, &m, 8);
+  }
+  filterMaskFrom(data, i, n, op, val, mask);
+}
+
+__attribute__((target("avx2,popcnt"))) void filterMaskDoubleAvx2(const double* data, int n, CompareOp op, double val,
+                                                                 uint8_t* mask) {
+  __m256d v = _mm256_set1_pd(val);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(data + i);
+    __m256d c = op == GREATER ? _mm256_cmp_pd(x, v, _CMP_GT_OQ) : _mm256_cmp_pd(x, v, _CMP_EQ_OQ);
+    uint32_t m;
+    memcpy(&m, mask + i, 4);
+    m &= kExpand.v[_mm256_movemask_pd(c)];
+    memcpy(mask + i, &m, 4);
+  }
+  filterMaskFrom(data, i, n, op, val, mask);
+}
+
+__attribute__((target("avx2,popcnt"))) void aggregateIntAvx2(const int* data, const uint8_t* mask, int n,
+                                                             MaskedAgg<int>& res) {
+  const __m256i kMin = _mm256_set1_epi32(INT_MIN);
+  const __m256i kMax = _mm256_set1_epi32(INT_MAX);
+  __m256i vsum = _mm256_setzero_si256(); // 4个int64
+  __m256i vmax = kMin;
+  __m256i vmin = kMax;
+  int64_t cnt = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t m8;
+    memcpy(&m8, mask + i, 8);
+    if (m8 == 0) continue;
+    __m256i m = _mm256_cvtepi8_epi32(_mm_cvtsi64_si128(m8));
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i xs = _mm256_and_si256(x, m);
+    vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(xs)));
+    vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(xs, 1)));
+    vmax = _mm256_max_epi32(vmax, _mm256_blendv_epi8(kMin, x, m));
+    vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(kMax, x, m));
+    cnt += maskCount(m8);
+  }
+  int64_t sums[4];
+  int maxs[8];
+  int mins[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), vsum);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+  res.cnt += cnt;
+  res.sum += sums[0] + sums[1] + sums[2] + sums[3];
+  res.max = std::max(res.max, *std::max_element(maxs, maxs + 8));
+  res.min = std::min(res.min, *std::min_element(mins, mins + 8));
+  aggregateFrom(data, mask, i, n, res);
+}
+
+__attribute__((target("avx2,popcnt"))) void aggregateDoubleAvx2(const double* data, const uint8_t* mask, int n,
+                                                                MaskedAgg<double>& res) {
+  const __m256d kMin = _mm256_set1_pd(std::numeric_limits<double>::lowest());
+  const __m256d kMax = _mm256_set1_pd(std::numeric_limits<double>::max());
+  double sum = res.sum;
+  __m256d vmax = kMin;
+  __m256d vmin = kMax;
+  int64_t cnt = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m4;
+    memcpy(&m4, mask + i, 4);
+    if (m4 == 0) continue;
+    __m256d m = _mm256_castsi256_pd(_mm256_cvtepi8_epi64(_mm_cvtsi32_si128(m4)));
+    __m256d x = _mm256_loadu_pd(data + i);
+    // double的加法不满足结合律，和标量实现一样按行的顺序累加，没有选中的行是0
+    double xs[4];
+    _mm256_storeu_pd(xs, _mm256_and_pd(x, m));
+    sum += xs[0];
+    sum += xs[1];
+    sum += xs[2];
+    sum += xs[3];
+    vmax = _mm256_max_pd(vmax, _mm256_blendv_pd(kMin, x, m));
+    vmin = _mm256_min_pd(vmin, _mm256_blendv_pd(kMax, x, m));
+    cnt += maskCount(m4);
+  }
+  double maxs[4];
+  double mins[4];
+  _mm256_storeu_pd(maxs, vmax);
+  _mm256_storeu_pd(mins, vmin);
+  res.cnt += cnt;
+  res.sum = sum;
+  res.max = std::max(res.max, *std::max_element(maxs, maxs + 4));
+  res.min = std::min(res.min, *std::min_element(mins, mins + 4));
+  aggregateFrom(data, mask, i, n, res);
+}
+
+const AggKernels kAvx2Kernels = {
+  "avx2",           rangeMaskAvx2,      filterMaskIntAvx2, filterMaskDoubleAvx2,
+  aggregateIntAvx2, aggregateDoubleAvx2,
+};
+
+// SSE4.2，一次处理2个时间戳、4个int或者2个double
+
+__attribute__((target("sse4.2,popcnt"))) void rangeMaskSse(const int64_t* tss, int n, int64_t lo, int64_t hi,
+                                                           uint8_t* mask) {
+  __m128i vlo = _mm_set1_epi64x(lo);
+  __m128i vhi = _mm_set1_epi64x(hi);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tss + i));
+    __m128i in = _mm_andnot_si128(_mm_cmpgt_epi64(vlo, t), _mm_cmpgt_epi64(vhi, t));
+    uint16_t m = kExpand.v[_mm_movemask_pd(_mm_castsi128_pd(in))];
+    memcpy(mask + i, &m, 2);
+  }
+  rangeMaskFrom(tss, i, n, lo, hi, mask);
+}
+
+__attribute__((target("sse4.2,popcnt"))) void filterMaskIntSse(const int* data, int n, CompareOp op, int val,
+                                                               uint8_t* mask) {
+  __m128i v = _mm_set1_epi32(val);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i c = op == GREATER ? _mm_cmpgt_epi32(x, v) : _mm_cmpeq_epi32(x, v);
+    uint32_t m;
+    memcpy(&m, mask + i, 4);
+    m &= kExpand.v[_mm_movemask_ps(_mm_castsi128_ps(c))];
+    memcpy(mask + i, &m, 4);
+  }
+  filterMaskFrom(data, i, n, op, val, mask);
+}
+
+__attribute__((target("sse4.2,popcnt"))) void filterMaskDoubleSse(const double* data, int n, CompareOp op, double val,
+                                                                  uint8_t* mask) {
+  __m128d v = _mm_set1_pd(val);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d x = _mm_loadu_pd(data + i);
+    __m128d c = op == GREATER ? _mm_cmpgt_pd(x, v) : _mm_cmpeq_pd(x, v);
+    uint16_t m;
+    memcpy(&m, mask + i, 2);
+    m &= kExpand.v[_mm_movemask_pd(c)];
+    memcpy(mask + i, &m, 2);
+  }
+  filterMaskFrom(data, i, n, op, val, mask);
+}
+
+__attribute__((target("sse4.2,popcnt"))) void aggregateIntSse(const int* data, const uint8_t* mask, int n,
+                                                              MaskedAgg<int>& res) {
+  const __m128i kMin = _mm_set1_epi32(INT_MIN);
+  const __m128i kMax = _mm_set1_epi32(INT_MAX);
+  __m128i vsum = _mm_setzero_si128(); // 2个int64
+  __m128i vmax = kMin;
+  __m128i vmin = kMax;
+  int64_t cnt = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m4;
+    memcpy(&m4, mask + i, 4);
+    if (m4 == 0) continue;
+    __m128i m = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(m4));
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i xs = _mm_and_si128(x, m);
+    vsum = _mm_add_epi64(vsum, _mm_cvtepi32_epi64(xs));
+    vsum = _mm_add_epi64(vsum, _mm_cvtepi32_epi64(_mm_srli_si128(xs, 8)));
+    vmax = _mm_max_epi32(vmax, _mm_blendv_epi8(kMin, x, m));
+    vmin = _mm_min_epi32(vmin, _mm_blendv_epi8(kMax, x, m));
+    cnt += maskCount(m4);
+  }
+  int64_t sums[2];
+  int maxs[4];
+  int mins[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), vsum);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+  res.cnt += cnt;
+  res.sum += sums[0] + sums[1];
+  res.max = std::max(res.max, *std::max_element(maxs, maxs + 4));
+  res.min = std::min(res.min, *std::min_element(mins, mins + 4));
+  aggregateFrom(data, mask, i, n, res);
+}
+
+__attribute__((target("sse4.2,popcnt"))) void aggregateDoubleSse(const double* data, const uint8_t* mask, int n,
+                                                                 MaskedAgg<double>& res) {
+  const __m128d kMin = _mm_set1_pd(std::numeric_limits<double>::lowest());
+  const __m128d kMax = _mm_set1_pd(std::numeric_limits<double>::max());
+  double sum = res.sum;
+  __m128d vmax = kMin;
+  __m128d vmin = kMax;
+  int64_t cnt = 0;
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint16_t m2;
+    memcpy(&m2, mask + i, 2);
+    if (m2 == 0) continue;
+    __m128d m = _mm_castsi128_pd(_mm_cvtepi8_epi64(_mm_cvtsi32_si128(m2)));
+    __m128d x = _mm_loadu_pd(data + i);
+    // 和AVX2一样按行的顺序累加
+    double xs[2];
+    _mm_storeu_pd(xs, _mm_and_pd(x, m));
+    sum += xs[0];
+    sum += xs[1];
+    vmax = _mm_max_pd(vmax, _mm_blendv_pd(kMin, x, m));
+    vmin = _mm_min_pd(vmin, _mm_blendv_pd(kMax, x, m));
+    cnt += maskCount(m2);
+  }
+  double maxs[2];
+  double mins[2];
+  _mm_storeu_pd(maxs, vmax);
+  _mm_storeu_pd(mins, vmin);
+  res.cnt += cnt;
+  res.sum = sum;
+  res.max = std::max(res.max, std::max(maxs[0], maxs[1]));
+  res.min = std::min(res.min, std::min(mins[0], mins[1]));
+  aggregateFrom(data, mask, i, n, res);
+}
+
+const AggKernels kSseKernels = {
+  "sse4.2",        rangeMaskSse,      filterMaskIntSse, filterMaskDoubleSse,
+  aggregateIntSse, aggregateDoubleSse,
+};
+
+#endif // AGG_KERNELS_X86
+
+} // namespace
+
+const AggKernels* g_agg_kernels = &kScalarKernels;
+
+const AggKernels* GetAggKernels(SimdLevel simd) {
+#ifdef AGG_KERNELS_X86
+  if ((simd == SimdLevel::AUTO || simd == SimdLevel::AVX2) && __builtin_cpu_supports("avx2")) {
+    return &kAvx2Kernels;
+  }
+  if (simd != SimdLevel::SCALAR && __builtin_cpu_supports("sse4.2")) {
+    return &kSseKernels;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+void SelectAggKernels() {
+  g_agg_kernels = GetAggKernels(g_config.simd);
+  if (g_config.simd != SimdLevel::AUTO && g_config.simd != SimdLevel::SCALAR &&
+      g_agg_kernels == &kScalarKernels) {
+    LOG_ERROR("the configured simd level is not supported by the cpu, fall back to scalar");
+  }
+  LOG_INFO("aggregate kernels: %s", g_agg_kernels->name);
+}
+
+} // namespace LindormContest
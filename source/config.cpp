@@ -0,0 +1,350 @@
+#include "config.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "common.h"
+#include "io/aio_context.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+EngineConfig g_config = [] {
+  EngineConfig config;
+  config.Finalize();
+  // 没有connect时（单独使用memtable等结构）按默认schema的列数
+  config.FinalizeMemtable(kColumnNum);
+  return config;
+}();
+
+static const char* kConfigKeys[] = {
+  "shard_bits", "worker_thread", "coroutine_per_thread", "memtable_row_num", "write_buffer_size", "read_cache_size",
+  "segment_size", "cpu_set", "wal", "wal_checkpoint_size", "io_backend", "sqpoll", "simd", "rollup",
+};
+
+static std::string trim(const std::string& s) {
+  size_t b = 0;
+  size_t e = s.size();
+  while (b < e && std::isspace((unsigned char)s[b])) b++;
+  while (e > b && std::isspace((unsigned char)s[e - 1])) e--;
+  return s.substr(b, e - b);
+}
+
+// 支持 K/M/G 后缀
+static bool parseSize(const std::string& value, size_t& res) {
+  char* end = nullptr;
+  unsigned long long num = std::strtoull(value.c_str(), &end, 10);
+  if (end == value.c_str()) return false;
+  switch (std::toupper((unsigned char)*end)) {
+    case '\0':
+      break;
+    case 'K':
+      num *= KB;
+      break;
+    case 'M':
+      num *= MB;
+      break;
+    case 'G':
+      num *= 1024ULL * MB;
+      break;
+    default:
+      return false;
+  }
+  res = num;
+  return true;
+}
+
+static bool parseCpuSet(const std::string& value, std::vector<int>& cpus) {
+  cpus.clear();
+  if (value == "none") return true;
+  std::stringstream ss(value);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    item = trim(item);
+    if (item.empty()) continue;
+    int lo, hi;
+    auto dash = item.find('-');
+    try {
+      lo = std::stoi(item.substr(0, dash));
+      hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+    } catch (...) {
+      return false;
+    }
+    if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return false;
+    for (int cpu = lo; cpu <= hi; cpu++) cpus.push_back(cpu);
+  }
+  return true;
+}
+
+// 逗号分隔的时间长度，支持 ms/s/m/h/d 后缀，没有后缀是ms，结果从小到大去重
+static bool parseDurations(const std::string& value, std::vector<int64_t>& res) {
+  res.clear();
+  if (value == "none") return true;
+  std::stringstream ss(value);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    item = trim(item);
+    if (item.empty()) continue;
+    char* end = nullptr;
+    long long num = std::strtoll(item.c_str(), &end, 10);
+    if (end == item.c_str() || num <= 0) return false;
+    std::string unit = end;
+    if (unit == "d") {
+      num *= 24 * 3600 * 1000LL;
+    } else if (unit == "h") {
+      num *= 3600 * 1000LL;
+    } else if (unit == "m") {
+      num *= 60 * 1000LL;
+    } else if (unit == "s") {
+      num *= 1000LL;
+    } else if (unit != "" && unit != "ms") {
+      return false;
+    }
+    res.push_back(num);
+  }
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+  return true;
+}
+
+// 向下取整到2的幂
+static size_t floorPow2(size_t x) {
+  size_t res = 1;
+  while (res * 2 <= x) res *= 2;
+  return res;
+}
+
+bool EngineConfig::Set(const std::string& key, const std::string& value) {
+  size_t num = 0;
+  if (key == "cpu_set") {
+    if (!parseCpuSet(value, cpu_set)) return false;
+    cpu_set_given = true;
+    return true;
+  }
+  if (key == "wal") {
+    if (value == "off") {
+      wal_mode = WalMode::OFF;
+    } else if (value == "async") {
+      wal_mode = WalMode::ASYNC;
+    } else if (value == "sync") {
+      wal_mode = WalMode::SYNC;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  if (key == "io_backend") {
+    if (value == "auto") {
+      io_backend = IOBackend::AUTO;
+    } else if (value == "libaio") {
+      io_backend = IOBackend::LIBAIO;
+    } else if (value == "io_uring") {
+      io_backend = IOBackend::IO_URING;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  if (key == "simd") {
+    if (value == "auto") {
+      simd = SimdLevel::AUTO;
+    } else if (value == "scalar") {
+      simd = SimdLevel::SCALAR;
+    } else if (value == "sse4.2") {
+      simd = SimdLevel::SSE4_2;
+    } else if (value == "avx2") {
+      simd = SimdLevel::AVX2;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  if (key == "rollup") {
+    std::vector<int64_t> res;
+    if (!parseDurations(value, res)) return false;
+    rollup = std::move(res);
+    return true;
+  }
+  if (key == "sqpoll") {
+    if (value != "on" && value != "off") return false;
+    sqpoll = value == "on";
+    return true;
+  }
+  if (!parseSize(value, num) || num == 0) return false;
+  if (key == "shard_bits") {
+    shard_bits = num;
+  } else if (key == "worker_thread") {
+    worker_thread = num;
+  } else if (key == "coroutine_per_thread") {
+    coroutine_per_thread = num;
+  } else if (key == "memtable_row_num") {
+    memtable_row_num = num;
+  } else if (key == "write_buffer_size") {
+    write_buffer_size = num;
+  } else if (key == "read_cache_size") {
+    read_cache_size = num;
+  } else if (key == "segment_size") {
+    segment_size = num;
+  } else if (key == "wal_checkpoint_size") {
+    wal_checkpoint_size = num;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void EngineConfig::Load(const std::string& data_dir) {
+  std::ifstream fin(data_dir + "/engine.conf");
+  std::string line;
+  while (fin.is_open() && std::getline(fin, line)) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    auto eq = line.find('=');
+    if (eq == std::string::npos || !Set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)))) {
+      LOG_ERROR("invalid config line: %s", line.c_str());
+    }
+  }
+
+  for (auto key : kConfigKeys) {
+    std::string env = "LINDORM_";
+    for (const char* p = key; *p; p++) env.push_back(std::toupper((unsigned char)*p));
+    const char* value = std::getenv(env.c_str());
+    if (value != nullptr && !Set(key, value)) {
+      LOG_ERROR("invalid config %s=%s", env.c_str(), value);
+    }
+  }
+}
+
+std::vector<int> EngineConfig::AvailableCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+  if (cpus.empty()) {
+    int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+size_t EngineConfig::AvailableMemory() {
+  size_t mem = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGE_SIZE);
+  // cgroup v2 / v1 的内存限制
+  for (auto path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"}) {
+    std::ifstream fin(path);
+    size_t limit;
+    if (fin >> limit && limit > 0 && limit < mem) {
+      mem = limit;
+    }
+  }
+  return mem;
+}
+
+void EngineConfig::Finalize() {
+  std::vector<int> cpus = AvailableCpus();
+  size_t mem = AvailableMemory();
+
+  if (worker_thread == 0) {
+    worker_thread = std::min<int>(cpus.size(), 64);
+  }
+  if (coroutine_per_thread == 0) {
+    // 读block的协程一次发出时间戳和几个列的读，按每个协程4个IO算：
+    // 一个调度线程的aio context最多kMaxIONum个IO，再多的协程只会等IOC；
+    // 所有线程加起来在途的IO不超过4个context，线程多的时候每个线程少一些；
+    // 至少32个，forEachVid用1/4同时扫描vin，剩下的给读block的协程
+    constexpr int kIOPerCoroutine = 4;
+    int per_context = AIOContext::kMaxIONum / kIOPerCoroutine;
+    int per_thread = 4 * AIOContext::kMaxIONum / kIOPerCoroutine / worker_thread;
+    coroutine_per_thread = std::clamp(std::min(per_context, per_thread), 32, per_context);
+  }
+  if (shard_bits == 0) {
+    // 每个调度线程负责16个shard左右，8核的时候是128个shard
+    shard_bits = 3;
+    while ((1 << shard_bits) < 16 * worker_thread && shard_bits < 10) shard_bits++;
+  }
+  shard_num = 1 << shard_bits;
+  if (write_buffer_size == 0) {
+    // 所有写缓冲区最多用1/8的内存
+    size_t sz = mem / 8 / shard_num;
+    write_buffer_size = std::clamp<size_t>(floorPow2(std::max<size_t>(sz, 1)), 256 * KB, 4 * MB);
+  }
+  if (segment_size == 0) {
+    segment_size = 256 * MB;
+  }
+  if (wal_checkpoint_size == 0) {
+    // 比所有memtable的总量大得多，checkpoint的时候大部分memtable已经正常下刷过
+    wal_checkpoint_size = 4096ULL * MB;
+  }
+  vin_num_per_shard = kVinNum / shard_num + 1;
+  if (read_cache_size == 0) {
+    // 所有shard的读缓存最多用1/4的内存
+    read_cache_size = std::clamp<size_t>(mem / 4 / shard_num, 4 * MB, 256 * MB);
+  }
+  if (!cpu_set_given) {
+    // 核够用的时候才绑核，否则交给系统调度
+    cpu_set.clear();
+    if (worker_thread <= (int)cpus.size()) {
+      cpu_set.assign(cpus.begin(), cpus.begin() + worker_thread);
+    }
+  }
+
+  ENSURE(shard_bits > 0 && shard_bits <= 12, "invalid shard_bits %d", shard_bits);
+  ENSURE(worker_thread > 0 && worker_thread <= shard_num, "invalid worker_thread %d", worker_thread);
+  ENSURE(coroutine_per_thread > 0, "invalid coroutine_per_thread %d", coroutine_per_thread);
+  ENSURE(memtable_row_num >= 0 && memtable_row_num <= kMaxMemtableRowNum, "invalid memtable_row_num %d",
+         memtable_row_num);
+  ENSURE(write_buffer_size >= 4 * KB && write_buffer_size % 512 == 0, "invalid write_buffer_size %d",
+         write_buffer_size);
+  ENSURE(segment_size >= (size_t)write_buffer_size, "invalid segment_size %zu", segment_size);
+}
+
+std::string EngineConfig::ToString() const {
+  std::ostringstream oss;
+  oss << "shard_bits=" << shard_bits << " worker_thread=" << worker_thread
+      << " coroutine_per_thread=" << coroutine_per_thread << " memtable_row_num=" << memtable_row_num
+      << " write_buffer_size=" << write_buffer_size << " segment_size=" << segment_size
+      << " read_cache_size=" << read_cache_size << " cpu_set=";
+  if (cpu_set.empty()) {
+    oss << "none";
+  }
+  for (size_t i = 0; i < cpu_set.size(); i++) {
+    oss << (i == 0 ? "" : ",") << cpu_set[i];
+  }
+  static const char* kWalModes[] = {"off", "async", "sync"};
+  oss << " wal=" << kWalModes[(int)wal_mode] << " wal_checkpoint_size=" << wal_checkpoint_size;
+  static const char* kIOBackends[] = {"auto", "libaio", "io_uring"};
+  oss << " io_backend=" << kIOBackends[(int)io_backend] << " sqpoll=" << (sqpoll ? "on" : "off");
+  static const char* kSimdLevels[] = {"auto", "scalar", "sse4.2", "avx2"};
+  oss << " simd=" << kSimdLevels[(int)simd] << " rollup=";
+  if (rollup.empty()) {
+    oss << "none";
+  }
+  for (size_t i = 0; i < rollup.size(); i++) {
+    oss << (i == 0 ? "" : ",") << rollup[i] << "ms";
+  }
+  return oss.str();
+}
+
+void EngineConfig::FinalizeMemtable(int column_num) {
+  if (memtable_row_num == 0) {
+    // 所有memtable最多用1/8的内存，vin数按上限算，每列每行按8字节估计
+    size_t rows = AvailableMemory() / 8 / ((size_t)kVinNum * std::max(column_num, 1) * sizeof(int64_t));
+    memtable_row_num = std::clamp<size_t>(floorPow2(std::max<size_t>(rows, 1)), 64, 256);
+    LOG_INFO("memtable_row_num %d for %d columns", memtable_row_num, column_num);
+  }
+  ENSURE(memtable_row_num > 0 && memtable_row_num <= kMaxMemtableRowNum, "invalid memtable_row_num %d",
+         memtable_row_num);
+}
+
+} // namespace LindormContest
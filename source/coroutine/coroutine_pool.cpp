@@ -3,10 +3,12 @@
 #include "coroutine/coroutine.h"
 #include "coroutine/scheduler.h"
 
-CoroutinePool::CoroutinePool(int thread_num, int coroutine_per_thread) : worker_num_(thread_num) {
+CoroutinePool::CoroutinePool(int thread_num, int coroutine_per_thread, const std::vector<int>& cpus)
+    : worker_num_(thread_num) {
   schedulers_.reserve(thread_num);
   for (int i = 0; i < thread_num; i++) {
-    schedulers_.emplace_back(new Scheduler(coroutine_per_thread, i));
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    schedulers_.emplace_back(new Scheduler(coroutine_per_thread, i, cpu));
   }
 };
 
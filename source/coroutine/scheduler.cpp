@@ -12,7 +12,8 @@ thread_local Scheduler* scheduler = nullptr;
 
 std::atomic_int id_generator{0};
 
-Scheduler::Scheduler(int coroutine_num, int tid) : Coroutine(-1, this), coro_num_(coroutine_num), tid_(tid) {
+Scheduler::Scheduler(int coroutine_num, int tid, int cpu)
+    : Coroutine(-1, this), coro_num_(coroutine_num), tid_(tid), cpu_(cpu) {
   // init coroutine
   coros_.reserve(coroutine_num);
   for (int i = 0; i < coroutine_num; i++) {
@@ -27,11 +28,13 @@ Scheduler::~Scheduler() { delete[] wakeup_buf_; }
 
 void Scheduler::scheduling() {
   // 绑核
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  CPU_SET(tid_, &cpuset);
-  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-  
+  if (cpu_ >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu_, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  }
+
   char tmp[20];
   ::sprintf(tmp, "scheduler_%d", tid_);
   pthread_setname_np(pthread_self(), tmp);
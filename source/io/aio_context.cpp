@@ -0,0 +1,350 @@
+#include "io/aio_context.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "config.h"
+#include "util/likely.h"
+#include "util/logging.h"
+#include "util/mem_pool.h"
+
+namespace LindormContest {
+
+AIOContext* AIOContext::New() {
+  if (g_config.io_backend != IOBackend::LIBAIO) {
+    auto uring = UringContext::Create(g_config.sqpoll);
+    if (uring != nullptr) {
+      return uring;
+    }
+    if (g_config.io_backend == IOBackend::IO_URING) {
+      LOG_ERROR("io_uring is not supported by the kernel, fall back to libaio");
+    }
+  }
+  return new LibaioContext();
+}
+
+AIOContext::AIOContext() {
+  free_list_.reserve(kMaxIONum);
+  for (int i = kMaxIONum - 1; i >= 0; i--) {
+    coros_[i] = nullptr;
+    free_list_.push_back(i);
+  }
+}
+
+void AIOContext::Prepare(bool write, int fd, int file_index, const char* buf, size_t length, off_t offset) {
+  LOG_ASSERT(!free_list_.empty(), "no available io context");
+  int slot = free_list_.back();
+  free_list_.pop_back();
+  coros_[slot] = this_coroutine::current();
+  queued_[coros_[slot]]++;
+  prepare(slot, write, fd, file_index, buf, length, offset);
+}
+
+int AIOContext::TakeQueued() {
+  auto it = queued_.find(this_coroutine::current());
+  if (it == queued_.end()) {
+    return 0;
+  }
+  int cnt = it->second;
+  queued_.erase(it);
+  return cnt;
+}
+
+void AIOContext::complete(int slot) {
+  coros_[slot]->wakeup_once();
+  coros_[slot] = nullptr;
+  free_list_.push_back(slot);
+}
+
+void* AIOContext::AllocBuffer(size_t sz) { return naive_alloc(sz); }
+
+void AIOContext::FreeBuffer(void* buf) { naive_free(buf); }
+
+// ---------------------------------- libaio ----------------------------------
+
+LibaioContext::LibaioContext() {
+  memset(&ctx_, 0, sizeof(io_context_t));
+  int ret = io_setup(kMaxIONum, &ctx_);
+  LOG_ASSERT(ret == 0, "io_setup error ret = %d", ret);
+  pending_.reserve(kMaxIONum);
+}
+
+LibaioContext::~LibaioContext() { io_destroy(ctx_); }
+
+void LibaioContext::prepare(int slot, bool write, int fd, int file_index, const char* buf, size_t length,
+                            off_t offset) {
+  iocb* cb = &cbs_[slot];
+  if (write) {
+    io_prep_pwrite(cb, fd, (void*)buf, length, offset);
+  } else {
+    io_prep_pread(cb, fd, (void*)buf, length, offset);
+  }
+  cb->data = reinterpret_cast<void*>((intptr_t)slot);
+  pending_.push_back(cb);
+}
+
+void LibaioContext::Poll() {
+  if (!pending_.empty()) {
+    int ret = io_submit(ctx_, pending_.size(), pending_.data());
+    // 队列满的时候可能只提交了一部分或者返回-EAGAIN，剩下的等完成一些之后再提交
+    ENSURE(ret >= 0 || ret == -EAGAIN, "io_submit failed, ret %d", ret);
+    if (ret > 0) {
+      pending_.erase(pending_.begin(), pending_.begin() + ret);
+    }
+  }
+  if (idle()) {
+    return;
+  }
+  timespec timeout = {0, 0};
+  int ev_cnt = io_getevents(ctx_, 1, kMaxIONum, events_, &timeout);
+  for (int i = 0; i < ev_cnt; i++) {
+    int slot = (int)reinterpret_cast<intptr_t>(events_[i].data);
+    long res = (long)events_[i].res;
+    ENSURE(res >= 0, "libaio io failed: %s", strerror(-res));
+    if (cbs_[slot].aio_lio_opcode == IO_CMD_PWRITE) {
+      ENSURE(res == (long)cbs_[slot].u.c.nbytes, "libaio short write, %ld of %lu bytes", res,
+             (unsigned long)cbs_[slot].u.c.nbytes);
+    }
+    complete(slot);
+  }
+  if (ev_cnt > 0) {
+    notifyIOC();
+  }
+}
+
+// --------------------------------- io_uring ---------------------------------
+
+static int uringSetup(unsigned entries, io_uring_params* p) { return syscall(__NR_io_uring_setup, entries, p); }
+
+static int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringContext* UringContext::Create(bool sqpoll) {
+  auto ctx = new UringContext();
+  if (!ctx->init(sqpoll)) {
+    delete ctx;
+    return nullptr;
+  }
+  return ctx;
+}
+
+bool UringContext::init(bool sqpoll) {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  if (sqpoll) {
+    p.flags |= IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = 2000; // ms
+  }
+  ring_fd_ = uringSetup(kMaxIONum, &p);
+  if (ring_fd_ < 0) {
+    return false;
+  }
+  sqpoll_ = sqpoll;
+  // 单次mmap同时映射sq和cq（5.4），NODROP保证cq不会丢完成事件
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+    return false;
+  }
+
+  // 需要IORING_OP_READ/WRITE（5.6）
+  size_t probe_sz = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  auto probe = reinterpret_cast<io_uring_probe*>(calloc(1, probe_sz));
+  bool supported = uringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                   probe->last_op >= IORING_OP_WRITE &&
+                   (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                   (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  if (!supported) {
+    return false;
+  }
+
+  ring_sz_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                      p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+  ring_ = mmap(nullptr, ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring_ == MAP_FAILED) {
+    ring_ = nullptr;
+    return false;
+  }
+  sqes_sz_ = p.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = reinterpret_cast<io_uring_sqe*>(sqes);
+
+  char* sq = reinterpret_cast<char*>(ring_);
+  char* cq = sq;
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sq_flags_ = reinterpret_cast<unsigned*>(sq + p.sq_off.flags);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+  // sq数组和sqe一一对应，之后只需要移动tail
+  unsigned* sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  for (unsigned i = 0; i < p.sq_entries; i++) {
+    sq_array[i] = i;
+  }
+  local_tail_ = *sq_tail_;
+
+  // 固定文件和固定缓冲区都是可选的，注册失败只是退回普通的读写
+  std::vector<int> fds(kMaxFileNum, -1);
+  if (uringRegister(ring_fd_, IORING_REGISTER_FILES, fds.data(), kMaxFileNum) == 0) {
+    fixed_files_ = true;
+    for (int i = kMaxFileNum - 1; i >= 0; i--) {
+      free_file_index_.push_back(i);
+    }
+  }
+  fixed_buf_ = reinterpret_cast<char*>(std::aligned_alloc(4096, kFixedBufferSize * kFixedBufferNum));
+  if (fixed_buf_ != nullptr) {
+    iovec iov{fixed_buf_, kFixedBufferSize * kFixedBufferNum};
+    fixed_buf_registered_ = uringRegister(ring_fd_, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    for (int i = kFixedBufferNum - 1; i >= 0; i--) {
+      free_fixed_buf_.push_back(i);
+    }
+  }
+  return true;
+}
+
+UringContext::~UringContext() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_sz_);
+  }
+  if (ring_ != nullptr) {
+    munmap(ring_, ring_sz_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+  free(fixed_buf_);
+}
+
+int UringContext::RegisterFile(int fd) {
+  if (!fixed_files_ || free_file_index_.empty()) {
+    return -1;
+  }
+  int index = free_file_index_.back();
+  io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = index;
+  update.fds = reinterpret_cast<uint64_t>(&fd);
+  if (uringRegister(ring_fd_, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+    return -1;
+  }
+  free_file_index_.pop_back();
+  return index;
+}
+
+void UringContext::UnregisterFile(int file_index) {
+  if (file_index < 0) {
+    return;
+  }
+  int fd = -1;
+  io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = file_index;
+  update.fds = reinterpret_cast<uint64_t>(&fd);
+  uringRegister(ring_fd_, IORING_REGISTER_FILES_UPDATE, &update, 1);
+  free_file_index_.push_back(file_index);
+}
+
+void* UringContext::AllocBuffer(size_t sz) {
+  if (sz <= kFixedBufferSize && !free_fixed_buf_.empty()) {
+    int idx = free_fixed_buf_.back();
+    free_fixed_buf_.pop_back();
+    return fixed_buf_ + idx * kFixedBufferSize;
+  }
+  return naive_alloc(sz);
+}
+
+void UringContext::FreeBuffer(void* buf) {
+  if (inFixedBuffer(buf)) {
+    free_fixed_buf_.push_back((reinterpret_cast<char*>(buf) - fixed_buf_) / kFixedBufferSize);
+    return;
+  }
+  naive_free(buf);
+}
+
+void UringContext::prepare(int slot, bool write, int fd, int file_index, const char* buf, size_t length,
+                           off_t offset) {
+  // 正在用的slot数不超过kMaxIONum，sq也是kMaxIONum项，所以不会满
+  io_uring_sqe* sqe = &sqes_[local_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  bool fixed_buf = fixed_buf_registered_ && inFixedBuffer(buf);
+  if (fixed_buf) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  } else {
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+  if (file_index >= 0) {
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->fd = file_index;
+  } else {
+    sqe->fd = fd;
+  }
+  sqe->off = offset;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = length;
+  sqe->user_data = slot;
+  write_len_[slot] = write ? length : 0;
+  local_tail_++;
+  to_submit_++;
+}
+
+void UringContext::Poll() {
+  if (to_submit_ > 0) {
+    __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+    if (sqpoll_) {
+      // 内核线程空闲太久会睡眠，需要唤醒
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+        uringEnter(ring_fd_, 0, 0, IORING_ENTER_SQ_WAKEUP);
+      }
+      to_submit_ = 0;
+    } else {
+      // 内核资源不足（EAGAIN）或者完成队列积压（EBUSY）时可能只提交一部分，剩下的等收割之后再提交
+      int ret = uringEnter(ring_fd_, to_submit_, 0, 0);
+      ENSURE(ret >= 0 || errno == EAGAIN || errno == EBUSY || errno == EINTR, "io_uring_enter failed, errno %d",
+             errno);
+      if (ret > 0) {
+        to_submit_ -= ret;
+      }
+    }
+  }
+  if (idle()) {
+    return;
+  }
+
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return;
+  }
+  for (; head != tail; head++) {
+    io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    int slot = (int)cqe->user_data;
+    ENSURE(cqe->res >= 0, "io_uring io failed: %s", strerror(-cqe->res));
+    ENSURE(write_len_[slot] == 0 || (uint32_t)cqe->res == write_len_[slot], "io_uring short write, %d of %u bytes",
+           cqe->res, write_len_[slot]);
+    complete(slot);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  notifyIOC();
+}
+
+} // namespace LindormContest
@@ -0,0 +1,247 @@
+#include "manifest.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "config.h"
+#include "io/file.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+static void pad8(std::string& buf) { buf.append((8 - buf.size() % 8) % 8, '\0'); }
+
+uint64_t Manifest::Checksum(const Footer& footer) {
+  const char* p = reinterpret_cast<const char*>(&footer);
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < offsetof(Footer, checksum); i++) {
+    h = (h ^ (uint8_t)p[i]) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+bool Manifest::Open(const std::string& filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Footer)) {
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  // 只建立映射，不预读，用到哪部分再缺页读进来
+  void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR("mmap manifest %s failed", filename.c_str());
+    size_ = 0;
+    return false;
+  }
+  base_ = reinterpret_cast<char*>(addr);
+
+  // 崩溃时最后一次编辑可能没有写完，往前找到最后一个完整的Footer
+  uint64_t off = (size_ - sizeof(Footer)) & ~7ULL;
+  while (!validFooter(off)) {
+    if (off == 0) {
+      LOG_ERROR("manifest %s has no complete edit", filename.c_str());
+      Close();
+      return false;
+    }
+    off -= 8;
+  }
+  if (off + sizeof(Footer) != size_) {
+    LOG_ERROR("manifest %s has a broken edit after %lu, ignore it", filename.c_str(), off);
+  }
+
+  // 从最后一个Footer开始沿着prev_footer往前找到所有的编辑
+  while (true) {
+    auto footer = reinterpret_cast<const Footer*>(base_ + off);
+    if (!validFooter(off)) {
+      LOG_ERROR("manifest %s has a broken edit at %lu", filename.c_str(), off);
+      Close();
+      return false;
+    }
+    if (footer->version != kVersion) {
+      LOG_ERROR("unsupported manifest version %u", footer->version);
+      Close();
+      return false;
+    }
+    LOG_ASSERT(footer->vin_off <= off && footer->block_index_off <= off && footer->latest_index_off <= off,
+               "invalid manifest footer");
+    Edit edit;
+    edit.footer = footer;
+    edit.vins = base_ + footer->vin_off;
+    edit.blocks = reinterpret_cast<const BlockIndex*>(base_ + footer->block_index_off);
+    edit.latest = reinterpret_cast<const LatestIndex*>(base_ + footer->latest_index_off);
+    edits_.push_back(edit);
+    if (footer->prev_footer == kNoPrev) {
+      break;
+    }
+    LOG_ASSERT(footer->prev_footer < off, "invalid prev footer");
+    off = footer->prev_footer;
+  }
+  std::reverse(edits_.begin(), edits_.end());
+  return true;
+}
+
+bool Manifest::validFooter(uint64_t off) const {
+  auto footer = reinterpret_cast<const Footer*>(base_ + off);
+  return footer->magic == kMagic && footer->checksum == Checksum(*footer);
+}
+
+void Manifest::Close() {
+  if (base_ != nullptr) {
+    munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+  }
+  edits_.clear();
+}
+
+void ManifestEditBuilder::AddVin(const char* vin) {
+  vins_.append(vin, VIN_LENGTH);
+  vin_cnt_++;
+}
+
+void ManifestEditBuilder::AddBlocks(uint16_t vid, const std::vector<BlockMeta*>& blocks) {
+  if (blocks.empty()) {
+    return;
+  }
+  block_index_.push_back({vid, 0, (uint32_t)blocks.size(), blocks_.size()});
+  for (auto meta : blocks) {
+    LOG_ASSERT(meta->column_num == column_num_, "column num mismatch");
+    blocks_.append(reinterpret_cast<const char*>(meta), block_stride_);
+  }
+}
+
+void ManifestEditBuilder::AddLatestRow(uint16_t vid, int64_t ts, const std::vector<ColumnValue>& cols) {
+  LOG_ASSERT(cols.size() == (size_t)column_num_, "invalid latest row");
+  size_t off = latest_.size();
+  latest_.append(reinterpret_cast<const char*>(&ts), sizeof(ts));
+  for (auto& col : cols) {
+    latest_.append(col.columnData, col.getRawDataSize());
+  }
+  uint32_t len = latest_.size() - off;
+  pad8(latest_);
+  latest_index_.push_back({vid, 0, len, off});
+}
+
+void ManifestEditBuilder::Merge(const ManifestEditBuilder& other) {
+  LOG_ASSERT(other.block_stride_ == block_stride_ && other.vin_cnt_ == 0, "invalid edit to merge");
+  for (auto idx : other.block_index_) {
+    idx.off += blocks_.size();
+    block_index_.push_back(idx);
+  }
+  blocks_ += other.blocks_;
+  for (auto idx : other.latest_index_) {
+    idx.off += latest_.size();
+    latest_index_.push_back(idx);
+  }
+  latest_ += other.latest_;
+}
+
+uint64_t ManifestEditBuilder::AppendTo(const std::string& filename, uint64_t prev_footer, uint32_t wal_gen,
+                                       uint32_t flags) {
+  AppendWriteFile file(filename, NORMAL_FLAG);
+  // 截掉上一次编辑之后没有写完的内容
+  uint64_t base = prev_footer == Manifest::kNoPrev ? 0 : prev_footer + sizeof(Manifest::Footer);
+  ENSURE(ftruncate(file.fd(), base) == 0, "truncate manifest %s failed", filename.c_str());
+  LOG_ASSERT(base % 8 == 0, "manifest is not aligned");
+
+  std::string body;
+  body.reserve(vins_.size() + blocks_.size() + latest_.size() + 64 * (block_index_.size() + latest_index_.size()));
+  uint64_t vin_off = base + body.size();
+  body += vins_;
+  pad8(body);
+
+  uint64_t block_off = base + body.size();
+  body += blocks_;
+  for (auto& idx : block_index_) {
+    idx.off += block_off;
+  }
+  uint64_t block_index_off = base + body.size();
+  body.append(reinterpret_cast<const char*>(block_index_.data()), sizeof(Manifest::BlockIndex) * block_index_.size());
+
+  uint64_t latest_off = base + body.size();
+  body += latest_;
+  for (auto& idx : latest_index_) {
+    idx.off += latest_off;
+  }
+  uint64_t latest_index_off = base + body.size();
+  body.append(reinterpret_cast<const char*>(latest_index_.data()),
+              sizeof(Manifest::LatestIndex) * latest_index_.size());
+
+  file.write(body.data(), body.size());
+  ENSURE(fdatasync(file.fd()) == 0, "sync manifest %s failed", filename.c_str());
+
+  Manifest::Footer footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.magic = Manifest::kMagic;
+  footer.version = Manifest::kVersion;
+  footer.column_num = column_num_;
+  footer.shard_bits = g_config.shard_bits;
+  footer.memtable_row_num = g_config.memtable_row_num;
+  footer.block_stride = block_stride_;
+  footer.flags = flags;
+  footer.prev_footer = prev_footer;
+  footer.wal_gen = wal_gen;
+  footer.first_vid = first_vid_;
+  footer.vin_cnt = vin_cnt_;
+  footer.vin_off = vin_off;
+  footer.block_index_cnt = block_index_.size();
+  footer.latest_cnt = latest_index_.size();
+  footer.block_index_off = block_index_off;
+  footer.latest_index_off = latest_index_off;
+  footer.checksum = Manifest::Checksum(footer);
+  file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+  ENSURE(fdatasync(file.fd()) == 0, "sync manifest %s failed", filename.c_str());
+  return base + body.size();
+}
+
+int64_t DecodeLatestRow(const char* image, int column_num, const ColumnType* types, std::vector<ColumnValue>& cols) {
+  int64_t ts;
+  memcpy(&ts, image, sizeof(ts));
+  const char* p = image + sizeof(ts);
+  cols.resize(column_num);
+  for (int i = 0; i < column_num; i++) {
+    switch (types[i]) {
+      case COLUMN_TYPE_INTEGER: {
+        int32_t val;
+        memcpy(&val, p, sizeof(val));
+        p += sizeof(val);
+        cols[i] = ColumnValue(val);
+        break;
+      }
+      case COLUMN_TYPE_DOUBLE_FLOAT: {
+        double_t val;
+        memcpy(&val, p, sizeof(val));
+        p += sizeof(val);
+        cols[i] = ColumnValue(val);
+        break;
+      }
+      case COLUMN_TYPE_STRING: {
+        int32_t len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        cols[i] = ColumnValue(p, len);
+        p += len;
+        break;
+      }
+      case COLUMN_TYPE_UNINITIALIZED:
+        LOG_ASSERT(false, "column %d uninitialized", i);
+        break;
+    }
+  }
+  return ts;
+}
+
+} // namespace LindormContest
@@ -1,5 +1,6 @@
 #include "memtable.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -18,8 +19,9 @@
 namespace LindormContest {
 
 void MemTable::Init() {
-  columnArrs_ = new ColumnArrWrapper*[kColumnNum];
-  for (int i = 0; i < kColumnNum; i++) {
+  column_num_ = engine_->column_num_;
+  columnArrs_ = new ColumnArrWrapper*[column_num_];
+  for (int i = 0; i < column_num_; i++) {
     switch (engine_->columns_type_[i]) {
       case COLUMN_TYPE_STRING:
         columnArrs_[i] = new StringArrWrapper(i);
@@ -34,23 +36,30 @@ void MemTable::Init() {
         break;
     }
   }
+  const IngestPlan& plan = engine_->ingest_plan_;
+  for (auto colid : plan.int_cols) {
+    int_data_.push_back(static_cast<IntArrWrapper*>(columnArrs_[colid])->GetDataArr());
+  }
+  for (auto colid : plan.double_cols) {
+    double_data_.push_back(static_cast<DoubleArrWrapper*>(columnArrs_[colid])->GetDataArr());
+  }
+  for (auto colid : plan.string_cols) {
+    string_arrs_.push_back(static_cast<StringArrWrapper*>(columnArrs_[colid]));
+  }
   // vid col
-  // svid_col_ = new VidArrWrapper(kColumnNum);
+  // svid_col_ = new VidArrWrapper(column_num_);
   // ts col
-  ts_col_ = new TsArrWrapper(kColumnNum);
+  ts_col_ = new TsArrWrapper(column_num_);
   // idx col
-  // idx_col_ = new IdxArrWrapper(kColumnNum + 2);
+  // idx_col_ = new IdxArrWrapper(column_num_ + 2);
 
-  for (int i = 0; i < kVinNumPerShard; i++) {
+  for (int i = 0; i < g_config.vin_num_per_shard; i++) {
     min_ts_ = INT64_MAX;
     max_ts_ = INT64_MIN;
     mem_latest_row_idx_ = -1;
     mem_latest_row_ts_ = -1;
-    for (int i = 0; i < kColumnNum; i++) {
-      max_val_[i] = 0;
-      sum_val_[i] = 0;
-    }
   }
+  stats_.Reset(column_num_);
 }
 
 void MemTable::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
@@ -72,7 +81,7 @@ void MemTable::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_
         // build res row
         Row resultRow;
         resultRow.timestamp = ts_col_->GetVal(idx);
-        memcpy(resultRow.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
+        memcpy(resultRow.vin.vin, engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
         for (const auto col_id : colids) {
           ColumnValue col;
           columnArrs_[col_id]->Get(idx, col);
@@ -84,66 +93,141 @@ void MemTable::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_
   }
 }
 
-bool MemTable::Write(uint16_t svid, const Row& row) {
-  //  更新本memtable中的最新row信息
-  if (mem_latest_row_ts_ < row.timestamp) {
-    mem_latest_row_ts_ = row.timestamp;
-    mem_latest_row_idx_ = cnt_;
-  }
-
-  int colid = 0;
-  for (auto& col : row.columns) {
-    LOG_ASSERT(col.first == engine_->columns_name_[colid], "invalid column");
-    columnArrs_[colid]->Add(col.second, cnt_);
-    auto& col_val = col.second;
-    switch (col_val.columnType) {
-      case COLUMN_TYPE_INTEGER: {
-        int cur;
-        col_val.getIntegerValue(cur);
-
-        int max = TO_INT(max_val_[colid]);
-        if (cur > max || cnt_ == 0) {
-          TO_INT(max_val_[colid]) = cur;
-        }
+void MemTable::GetColumnsFromTimeRange(int64_t lowerInclusive, int64_t upperExclusive, const std::vector<int>& colids,
+                                       ColumnBatch& batch) {
+  if (min_ts_ >= upperExclusive || max_ts_ < lowerInclusive) {
+    return;
+  }
+  uint16_t sel[kMaxMemtableRowNum];
+  int n = 0;
+  auto tss = ts_col_->GetDataArr();
+  for (int i = 0; i < cnt_; i++) {
+    if (inRange(tss[i], lowerInclusive, upperExclusive)) {
+      sel[n++] = i;
+    }
+  }
+  if (n == 0) {
+    return;
+  }
+  RECORD_FETCH_ADD(tr_memtable_blk_query_cnt, n);
+  for (int i = 0; i < n; i++) {
+    batch.timestamps.push_back(tss[sel[i]]);
+  }
+  for (size_t k = 0; k < colids.size(); k++) {
+    columnArrs_[colids[k]]->AppendTo(batch.columns[k], sel, n);
+  }
+}
 
-        // int64 防止溢出
-        int64_t sum = TO_INT64(sum_val_[colid]);
-        TO_INT64(sum_val_[colid]) = cur + sum;
-        break;
-      }
-      case COLUMN_TYPE_DOUBLE_FLOAT: {
-        double cur;
-        col_val.getDoubleFloatValue(cur);
+int MemTable::WriteRows(const Row* const* rows, int n) {
+  int m = std::min(n, g_config.memtable_row_num - cnt_);
+  if (UNLIKELY(m <= 0)) {
+    return 0;
+  }
+  const IngestPlan& plan = engine_->ingest_plan_;
 
-        double max = TO_DOUBLE(max_val_[colid]);
-        if (cur > max || cnt_ == 0) {
-          TO_DOUBLE(max_val_[colid]) = cur;
-        }
+  // 遍历一次每一行的map，按列存放ColumnValue的指针，后面按列拷贝
+  // 这里不会让出协程，所以可以用thread_local的缓冲区
+  thread_local std::vector<const ColumnValue*> vals;
+  vals.resize((size_t)column_num_ * m);
+  auto tss = ts_col_->GetDataArr();
+  for (int r = 0; r < m; r++) {
+    const Row& row = *rows[r];
+    LOG_ASSERT(row.columns.size() == (size_t)column_num_, "invalid row with %zu columns", row.columns.size());
+    int colid = 0;
+    for (auto& col : row.columns) {
+      vals[colid++ * m + r] = &col.second;
+    }
 
-        double sum = TO_DOUBLE(sum_val_[colid]);
-        TO_DOUBLE(sum_val_[colid]) = cur + sum;
-        break;
-      }
-      default:
-        break;
+    //  更新本memtable中的最新row信息
+    int idx = cnt_ + r;
+    if (mem_latest_row_ts_ < row.timestamp) {
+      mem_latest_row_ts_ = row.timestamp;
+      mem_latest_row_idx_ = idx;
     }
-    colid++;
+    if (row.timestamp < min_ts_) min_ts_ = row.timestamp;
+    if (row.timestamp > max_ts_) max_ts_ = row.timestamp;
+    tss[idx] = row.timestamp;
   }
 
-  // 写入vid列
-  // svid_col_->Add(svid, cnt_);
-
-  // 写入ts列
-  ts_col_->Add(row.timestamp, cnt_);
+  for (size_t k = 0; k < plan.int_cols.size(); k++) {
+    int* dst = int_data_[k] + cnt_;
+    const ColumnValue* const* src = &vals[plan.int_cols[k] * m];
+    for (int r = 0; r < m; r++) {
+      dst[r] = *reinterpret_cast<const int32_t*>(src[r]->columnData);
+    }
+  }
+  for (size_t k = 0; k < plan.double_cols.size(); k++) {
+    double* dst = double_data_[k] + cnt_;
+    const ColumnValue* const* src = &vals[plan.double_cols[k] * m];
+    for (int r = 0; r < m; r++) {
+      dst[r] = *reinterpret_cast<const double*>(src[r]->columnData);
+    }
+  }
+  for (size_t k = 0; k < plan.string_cols.size(); k++) {
+    StringArrWrapper* arr = string_arrs_[k];
+    const ColumnValue* const* src = &vals[plan.string_cols[k] * m];
+    for (int r = 0; r < m; r++) {
+      const char* data = src[r]->columnData;
+      arr->Append(data + sizeof(int32_t), *reinterpret_cast<const int32_t*>(data), cnt_ + r);
+    }
+  }
 
-  // 写入idx列
-  // idx_col_->Add(cnt_, cnt_);
+  cnt_ += m;
+  return m;
+}
 
-  updateTs(row.timestamp, svid);
-  cnt_++;
+void MemTable::ComputeStats() {
+  if (UNLIKELY(cnt_ == 0)) {
+    return;
+  }
+  // first/last是时间戳最小和最大的行，最大的就是最新行
+  auto tss = ts_col_->GetDataArr();
+  int first = 0;
+  for (int i = 1; i < cnt_; i++) {
+    first = tss[i] < tss[first] ? i : first;
+  }
+  int last = mem_latest_row_idx_;
 
-  return cnt_ >= kMemtableRowNum;
-};
+  const IngestPlan& plan = engine_->ingest_plan_;
+  for (size_t k = 0; k < plan.int_cols.size(); k++) {
+    const int* data = int_data_[k];
+    int max = data[0];
+    int min = data[0];
+    int64_t sum = 0; // int64 防止溢出
+    for (int i = 0; i < cnt_; i++) {
+      max = data[i] > max ? data[i] : max;
+      min = data[i] < min ? data[i] : min;
+      sum += data[i];
+    }
+    int colid = plan.int_cols[k];
+    stats_.max_val[colid] = 0;
+    stats_.min_val[colid] = 0;
+    stats_.first_val[colid] = 0;
+    stats_.last_val[colid] = 0;
+    TO_INT(stats_.max_val[colid]) = max;
+    TO_INT(stats_.min_val[colid]) = min;
+    TO_INT(stats_.first_val[colid]) = data[first];
+    TO_INT(stats_.last_val[colid]) = data[last];
+    TO_INT64(stats_.sum_val[colid]) = sum;
+  }
+  for (size_t k = 0; k < plan.double_cols.size(); k++) {
+    const double* data = double_data_[k];
+    double max = data[0];
+    double min = data[0];
+    double sum = 0;
+    for (int i = 0; i < cnt_; i++) {
+      max = data[i] > max ? data[i] : max;
+      min = data[i] < min ? data[i] : min;
+      sum += data[i];
+    }
+    int colid = plan.double_cols[k];
+    TO_DOUBLE(stats_.max_val[colid]) = max;
+    TO_DOUBLE(stats_.min_val[colid]) = min;
+    TO_DOUBLE(stats_.first_val[colid]) = data[first];
+    TO_DOUBLE(stats_.last_val[colid]) = data[last];
+    TO_DOUBLE(stats_.sum_val[colid]) = sum;
+  }
+}
 
 void MemTable::Reset() {
   min_ts_ = INT64_MAX;
@@ -151,11 +235,10 @@ void MemTable::Reset() {
   mem_latest_row_idx_ = -1;
   mem_latest_row_ts_ = -1;
   cnt_ = 0;
-  for (int i = 0; i < kColumnNum; i++) {
+  for (int i = 0; i < column_num_; i++) {
     columnArrs_[i]->Reset();
-    max_val_[i] = 0;
-    sum_val_[i] = 0;
   }
+  stats_.Reset(column_num_);
   ts_col_->Reset();
   in_flush_ = false;
 }
@@ -164,7 +247,7 @@ void MemTable::GetLatestRow(uint16_t svid, const std::vector<int>& colids, Row&
   // 最新的row在内存当中
   int mem_lat_idx = mem_latest_row_idx_;
   row.timestamp = mem_latest_row_ts_;
-  memcpy(row.vin.vin, engine_->vid2vin_[svid2vid(shard_id_, svid)].c_str(), VIN_LENGTH);
+  memcpy(row.vin.vin, engine_->vin_dict_.GetVin(svid2vid(shard_id_, svid)), VIN_LENGTH);
   for (auto col_id : colids) {
     ColumnValue col_value;
     auto& col_name = engine_->columns_name_[col_id];
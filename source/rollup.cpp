@@ -0,0 +1,209 @@
+#include "rollup.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+#include "common.h"
+#include "io/file.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+Rollup::Rollup(int64_t resolution, const ColumnType* types, int column_num, int vin_num)
+    : resolution_(resolution), types_(types), column_num_(column_num), slot_(column_num, -1), mem_(vin_num) {
+  LOG_ASSERT(resolution > 0, "invalid rollup resolution %ld", resolution);
+  int slot_num = 0;
+  for (int i = 0; i < column_num; i++) {
+    if (types[i] == COLUMN_TYPE_INTEGER || types[i] == COLUMN_TYPE_DOUBLE_FLOAT) {
+      slot_[i] = slot_num++;
+    }
+  }
+  stride_ = kHeadSize + slot_num * kStatSize;
+}
+
+Rollup::~Rollup() {
+  if (base_ != nullptr) {
+    munmap(base_, size_);
+  }
+}
+
+uint64_t Rollup::Checksum(const Footer& footer) {
+  const char* p = reinterpret_cast<const char*>(&footer);
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < offsetof(Footer, checksum); i++) {
+    h = (h ^ (uint8_t)p[i]) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+char* Rollup::bucket(uint16_t svid, int64_t ts) {
+  std::string& buf = mem_[svid];
+  size_t cnt = buf.size() / stride_;
+  // 数据基本按时间顺序写入，大多数时候是最后一个桶或者新的桶
+  size_t pos = cnt;
+  if (cnt != 0 && Ts(&buf[(cnt - 1) * stride_]) >= ts) {
+    size_t lo = 0;
+    size_t hi = cnt - 1;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (Ts(&buf[mid * stride_]) < ts) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    pos = lo;
+    if (Ts(&buf[pos * stride_]) == ts) {
+      return &buf[pos * stride_];
+    }
+  }
+
+  std::string rec(stride_, '\0');
+  memcpy(&rec[0], &ts, sizeof(ts));
+  for (int i = 0; i < column_num_; i++) {
+    if (types_[i] == COLUMN_TYPE_INTEGER) {
+      StoreStat(MaskedAgg<int>(), stat(&rec[0], i));
+    } else if (types_[i] == COLUMN_TYPE_DOUBLE_FLOAT) {
+      StoreStat(MaskedAgg<double>(), stat(&rec[0], i));
+    }
+  }
+  buf.insert(pos * stride_, rec);
+  return &buf[pos * stride_];
+}
+
+template <typename T, typename TWrapper>
+void Rollup::addStat(char* rec, int colid, ColumnArrWrapper* col, int begin, int end) {
+  static const std::vector<uint8_t> kAllRows(kMaxMemtableRowNum, 0xff);
+  char* p = stat(rec, colid);
+  MaskedAgg<T> m = LoadStat<T>(0, p);
+  MaskedAggregate(static_cast<TWrapper*>(col)->GetDataArr() + begin, kAllRows.data(), end - begin, m);
+  StoreStat(m, p);
+}
+
+void Rollup::Add(uint16_t svid, const int64_t* tss, int n, ColumnArrWrapper* const* cols) {
+  int i = 0;
+  while (i < n) {
+    // 连续落在同一个桶里的行一起聚合
+    int64_t ts = bucketOf(tss[i]);
+    int j = i + 1;
+    while (j < n && tss[j] >= ts && tss[j] < ts + resolution_) j++;
+    char* rec = bucket(svid, ts);
+    int64_t cnt = Cnt(rec) + (j - i);
+    memcpy(rec + sizeof(int64_t), &cnt, sizeof(cnt));
+    for (int colid = 0; colid < column_num_; colid++) {
+      if (types_[colid] == COLUMN_TYPE_INTEGER) {
+        addStat<int, IntArrWrapper>(rec, colid, cols[colid], i, j);
+      } else if (types_[colid] == COLUMN_TYPE_DOUBLE_FLOAT) {
+        addStat<double, DoubleArrWrapper>(rec, colid, cols[colid], i, j);
+      }
+    }
+    i = j;
+  }
+}
+
+void Rollup::Save(const std::string& filename) const {
+  RemoveFile(filename);
+  AppendWriteFile file(filename, NORMAL_FLAG);
+  std::vector<Index> index;
+  uint64_t off = 0;
+  for (size_t svid = 0; svid < mem_.size(); svid++) {
+    if (mem_[svid].empty()) continue;
+    Index idx;
+    idx.svid = svid;
+    idx.reserved = 0;
+    idx.cnt = mem_[svid].size() / stride_;
+    idx.off = off;
+    index.push_back(idx);
+    file.write(mem_[svid].data(), mem_[svid].size());
+    off += mem_[svid].size();
+  }
+  file.write(reinterpret_cast<const char*>(index.data()), sizeof(Index) * index.size());
+
+  Footer footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.magic = kMagic;
+  footer.version = kVersion;
+  footer.column_num = column_num_;
+  footer.resolution = resolution_;
+  footer.stride = stride_;
+  footer.index_cnt = index.size();
+  footer.index_off = off;
+  footer.checksum = Checksum(footer);
+  file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+  ENSURE(fdatasync(file.fd()) == 0, "sync rollup %s failed", filename.c_str());
+}
+
+bool Rollup::Load(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Footer)) {
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR("mmap rollup %s failed", filename.c_str());
+    size_ = 0;
+    return false;
+  }
+  base_ = reinterpret_cast<char*>(addr);
+
+  Footer footer;
+  memcpy(&footer, base_ + size_ - sizeof(Footer), sizeof(Footer));
+  if (footer.magic != kMagic || footer.checksum != Checksum(footer) || footer.version != kVersion ||
+      footer.column_num != (uint32_t)column_num_ || footer.resolution != resolution_ || footer.stride != stride_ ||
+      footer.index_off + sizeof(Index) * footer.index_cnt + sizeof(Footer) != size_) {
+    LOG_ERROR("rollup %s does not match the schema, ignore it", filename.c_str());
+    munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+    return false;
+  }
+  mapped_.assign(mem_.size(), nullptr);
+  mapped_cnt_.assign(mem_.size(), 0);
+  auto index = reinterpret_cast<const Index*>(base_ + footer.index_off);
+  for (uint32_t i = 0; i < footer.index_cnt; i++) {
+    LOG_ASSERT(index[i].svid < mapped_.size() && index[i].off + index[i].cnt * stride_ <= footer.index_off,
+               "invalid rollup index");
+    mapped_[index[i].svid] = base_ + index[i].off;
+    mapped_cnt_[index[i].svid] = index[i].cnt;
+  }
+  return true;
+}
+
+const char* Rollup::Find(uint16_t svid, int64_t lo, int64_t hi, int& n) const {
+  n = 0;
+  if (mapped_.empty() || mapped_cnt_[svid] == 0) {
+    return nullptr;
+  }
+  const char* base = mapped_[svid];
+  auto lowerBound = [&](int64_t ts) {
+    uint32_t l = 0;
+    uint32_t r = mapped_cnt_[svid];
+    while (l < r) {
+      uint32_t mid = (l + r) / 2;
+      if (Ts(base + mid * stride_) < ts) {
+        l = mid + 1;
+      } else {
+        r = mid;
+      }
+    }
+    return l;
+  };
+  uint32_t begin = lowerBound(lo);
+  n = lowerBound(hi) - begin;
+  return base + begin * stride_;
+}
+
+} // namespace LindormContest
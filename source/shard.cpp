@@ -1,14 +1,23 @@
 #include "shard.h"
 
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+
 #include "agg.h"
+#include "filename.h"
 #include "util/util.h"
 
 namespace LindormContest {
 
-void ReadCache::evictForPut() {
+bool ReadCache::evictForPut(bool wait) {
   while (total_sz_ >= max_sz_) {
     // 缓存已满
     while (lru_list_.empty()) {
+      if (!wait) {
+        return false;
+      }
       RECORD_FETCH_ADD(lru_wait_cnt, 1);
       lru_cv_.wait(); // 等别人Release了才能进行LRU剔除
     }
@@ -21,22 +30,36 @@ void ReadCache::evictForPut() {
     lru_list_.pop_back();
     cache_.erase(victim);
   }
+  return true;
 }
 
 Status ReadCache::PutColumn(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data) {
-  Col key = {.ptr = meta, .colid = colid};
   LOG_ASSERT(col_data->TotalSize() <= max_sz_, "ColumnArrWrapper is too big.");
 
   total_sz_ += col_data->TotalSize();
-  evictForPut();
+  evictForPut(true);
+  prepare(meta, colid, col_data);
+  return Status::OK;
+}
+
+bool ReadCache::TryPutColumn(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data) {
+  total_sz_ += col_data->TotalSize();
+  if (!evictForPut(false)) {
+    total_sz_ -= col_data->TotalSize();
+    return false;
+  }
+  prepare(meta, colid, col_data);
+  return true;
+}
 
+void ReadCache::prepare(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* col_data) {
+  Col key = {.ptr = meta, .colid = colid};
   // 插入新元素到缓存和链表头部
   prepared_list_.push_front(key);
   cache_[key] = prepared_list_.begin();
   cache_[key]->column_arr = col_data;
   cache_[key]->ref = 1;
   cache_[key]->filling = true;
-  return Status::OK;
 }
 
 ColumnArrWrapper* ReadCache::GetColumn(BlockMeta* meta, uint8_t colid) {
@@ -83,148 +106,202 @@ void ReadCache::Release(BlockMeta* meta, uint8_t colid, ColumnArrWrapper* data)
 };
 
 void ShardImpl::Init() {
-  for (int i = 0; i < kVinNumPerShard; i++) {
-    if (write_phase) {
-      data_file_[i] = engine_->io_mgr_->OpenAsyncWriteFile(
-        VinFileName(engine_->dataDirPath, kTableName, svid2vid(shard_id_, i)), shard2tid(shard_id_));
-    } else {
-      data_file_[i] = engine_->io_mgr_->OpenAsyncReadFile(
-        VinFileName(engine_->dataDirPath, kTableName, svid2vid(shard_id_, i)), shard2tid(shard_id_));
-    }
-    block_mgr_[i] = new BlockMetaManager();
-    write_buf_[i] = nullptr;
-    memtable_[i] = nullptr;
+  // 段文件、aio context、写缓冲和memtable都在第一次用到的时候再创建，没有数据的vin不占资源
+  for (int i = 0; i < g_config.vin_num_per_shard; i++) {
+    // 写阶段connect的时候还没有schema，layout在createTable的时候才建好
+    block_mgr_[i] = new BlockMetaManager(&engine_->block_layout_, &block_arena_);
   }
 
-  size_t read_cache_sz = write_phase ? kReadCacheSize / 8 : kReadCacheSize;
+  size_t read_cache_sz = write_phase ? g_config.read_cache_size / 8 : g_config.read_cache_size;
   read_cache_ = new ReadCache(read_cache_sz);
 
-  if (write_phase) {
-    for (int i = 0; i < kVinNumPerShard; i++) {
-      write_buf_[i] = new AlignedWriteBuffer(data_file_[i]);
-      memtable_[i] = new MemTable(shard_id_, engine_);
+  // 读阶段加载上一次写阶段生成的rollup，缺失或者和配置、schema不一致的不用
+  if (!write_phase && engine_->column_num_ > 0) {
+    for (int64_t resolution : g_config.rollup) {
+      auto rollup = new Rollup(resolution, engine_->columns_type_, engine_->column_num_, g_config.vin_num_per_shard);
+      if (rollup->Load(RollupFileName(engine_->dataDirPath, kTableName, shard_id_, resolution))) {
+        rollups_.push_back(rollup);
+      } else {
+        delete rollup;
+      }
     }
   }
 };
 
-void ShardImpl::SaveLatestRowCache(File* file) { // vin ts columns
-  // columns就按照colid顺序存，除了string先存一个4字节的长度，再存字符串之后，其他字段都是固定长度，直接根据类型进行解析即可
-  for (int i = 0; i < kVinNumPerShard; i++) {
-    // 需要存kVinNumPerShard个row
-    if (latest_ts_cache_[i] == -1) {
-      continue;
+void ShardImpl::SaveRollups() {
+  for (size_t i = 0; i < g_config.rollup.size(); i++) {
+    std::string filename = RollupFileName(engine_->dataDirPath, kTableName, shard_id_, g_config.rollup[i]);
+    if (i < rollups_.size()) {
+      rollups_[i]->Save(filename);
+    } else {
+      // shard中没有数据，删除可能残留的旧文件
+      RemoveFile(filename);
     }
-    file->write((char*)&i, sizeof(i));
-    file->write((char*)(&latest_ts_cache_[i]), sizeof(latest_ts_cache_[i]));
-    for (int k = 0; k < kColumnNum; k++) {
-      auto& col = latest_ts_cols_[i][k];
-      switch (engine_->columns_type_[k]) {
-        case COLUMN_TYPE_STRING: {
-          std::pair<int32_t, const char*> lengthStrPair;
-          col.getStringValue(lengthStrPair);
-          file->write((char*)&lengthStrPair.first, sizeof(lengthStrPair.first));
-          file->write(lengthStrPair.second, lengthStrPair.first);
-        } break;
-        case COLUMN_TYPE_INTEGER: {
-          int num;
-          col.getIntegerValue(num);
-          file->write((char*)&num, sizeof(num));
-        } break;
-        case COLUMN_TYPE_DOUBLE_FLOAT: {
-          double num;
-          col.getDoubleFloatValue(num);
-          file->write((char*)&num, sizeof(num));
-        } break;
-        case COLUMN_TYPE_UNINITIALIZED:
-          LOG_ASSERT(false, "error");
-          break;
-      }
+  }
+}
+
+MemTable* ShardImpl::memTable(uint16_t svid) {
+  if (UNLIKELY(memtable_[svid] == nullptr)) {
+    LOG_ASSERT(write_phase && engine_->column_num_ > 0, "memtable should be created after createTable");
+    memtable_[svid] = new MemTable(shard_id_, engine_);
+    memtable_[svid]->Init();
+  }
+  return memtable_[svid];
+}
+
+File* ShardImpl::segmentFile(uint32_t segment) {
+  // 写阶段的异步文件是只写的，查询另外打开一个同步读的文件
+  std::vector<File*>& files = write_phase ? segment_read_file_ : segment_file_;
+  if (segment >= files.size()) {
+    files.resize(segment + 1, nullptr);
+  }
+  if (UNLIKELY(files[segment] == nullptr)) {
+    std::string file_name = SegmentFileName(engine_->dataDirPath, kTableName, shard_id_, segment);
+    if (write_phase) {
+      files[segment] = new RandomAccessFile(file_name);
+    } else {
+      files[segment] = engine_->io_mgr_->OpenAsyncReadFile(file_name, shard2tid(shard_id_));
     }
   }
-};
+  return files[segment];
+}
 
-void ShardImpl::LoadLatestRowCache(File* file) {
-  for (int i = 0; i < kVinNumPerShard; i++) {
-    if (file->read((char*)&i, sizeof(i)) == Status::END) break;
-    // 需要存kVinNumPerShard个row
-    file->read((char*)(&latest_ts_cache_[i]), sizeof(latest_ts_cache_[i]));
-    for (int k = 0; k < kColumnNum; k++) {
-      auto& col = latest_ts_cols_[i][k];
-      switch (engine_->columns_type_[k]) {
-        case COLUMN_TYPE_STRING: {
-          int32_t len;
-          file->read((char*)&len, sizeof(len));
-          char buf[len];
-          file->read(buf, len);
-          col = std::move(ColumnValue(buf, len));
-        } break;
-        case COLUMN_TYPE_INTEGER: {
-          int num;
-          file->read((char*)&num, sizeof(num));
-          col = std::move(ColumnValue(num));
-        } break;
-        case COLUMN_TYPE_DOUBLE_FLOAT: {
-          double num;
-          file->read((char*)&num, sizeof(num));
-          col = std::move(ColumnValue(num));
-        } break;
-        case COLUMN_TYPE_UNINITIALIZED:
-          LOG_ASSERT(false, "error");
-          break;
-      }
+uint32_t ShardImpl::acquireSegment() {
+  // 一个block的所有列必须落在同一个段里，所以只有没人在写的时候才能切换到新的段
+  while (write_buf_ == nullptr || write_buf_->WrittenSz() >= g_config.segment_size) {
+    if (segment_writers_ > 0 || rolling_) {
+      segment_cv_.wait();
+      continue;
     }
+    rollSegment();
   }
-};
+  segment_writers_++;
+  return active_segment_;
+}
+
+void ShardImpl::releaseSegment() {
+  segment_writers_--;
+  if (segment_writers_ == 0) {
+    segment_cv_.notify();
+  }
+}
+
+void ShardImpl::rollSegment() {
+  rolling_ = true;
+  if (write_buf_ != nullptr) {
+    if (!write_buf_->empty()) {
+      write_buf_->flush();
+    }
+    delete write_buf_;
+    write_buf_ = nullptr;
+  }
+
+  // 之前运行写的段保持不变，新的段号跳过已经存在的文件
+  uint32_t segment = active_segment_ + 1;
+  while (engine_->io_mgr_->Exist(SegmentFileName(engine_->dataDirPath, kTableName, shard_id_, segment))) {
+    segment++;
+  }
+  auto file = engine_->io_mgr_->OpenAsyncWriteFile(
+    SegmentFileName(engine_->dataDirPath, kTableName, shard_id_, segment), shard2tid(shard_id_));
+  // 预先分配整个段的空间，尽量让段在磁盘上连续，不改变文件长度，文件系统不支持就算了
+  fallocate(file->fd(), FALLOC_FL_KEEP_SIZE, 0, g_config.segment_size);
+  write_buf_ = new AlignedWriteBuffer(file);
+  active_segment_ = segment;
+
+  rolling_ = false;
+  segment_cv_.notify();
+}
 
-void ShardImpl::Write(uint16_t vid, const Row& row) {
-  // LOG_DEBUG("write shard %d vid", vid);
+void ShardImpl::FlushWriteBuffer() {
+  if (write_buf_ != nullptr && !write_buf_->empty()) {
+    write_buf_->flush();
+  }
+}
+
+void ShardImpl::LoadLatestRow(uint16_t vid, const char* image) {
   int svid = vid2svid(vid);
-  while (memtable_[svid]->in_flush_) { // 有可能不停的有协程在flush,所以要用while保证是可用的memtable
-    RECORD_FETCH_ADD(write_wait_cnt, 1);
-    memtable_[svid]->cv_.wait();
+  latest_ts_cache_[svid] = DecodeLatestRow(image, engine_->column_num_, engine_->columns_type_, latest_ts_cols_[svid]);
+}
+
+void ShardImpl::AppendManifestEdit(ManifestEditBuilder& edit) {
+  std::vector<BlockMeta*> blocks;
+  for (int svid = 0; svid < g_config.vin_num_per_shard; svid++) {
+    block_mgr_[svid]->TakeUnpersisted(blocks);
+    if (blocks.empty() && !latest_dirty_[svid]) {
+      continue;
+    }
+    uint16_t vid = svid2vid(shard_id_, svid);
+    edit.AddBlocks(vid, blocks);
+    if (latest_dirty_[svid]) {
+      edit.AddLatestRow(vid, latest_ts_cache_[svid], latest_ts_cols_[svid]);
+      latest_dirty_[svid] = false;
+    }
   }
-  if (memtable_[svid]->Write(svid, row)) {
-    // flush memtable to file
-    auto rc = Flush(svid);
-    LOG_ASSERT(rc == Status::OK, "flush memtable failed");
+}
+
+void ShardImpl::WriteRows(uint16_t vid, const Row* const* rows, int n) {
+  int svid = vid2svid(vid);
+  MemTable* mmt = memTable(svid);
+  while (n > 0) {
+    while (mmt->in_flush_) {
+      RECORD_FETCH_ADD(write_wait_cnt, 1);
+      mmt->cv_.wait();
+    }
+    int written = mmt->WriteRows(rows, n);
+    rows += written;
+    n -= written;
+    if (mmt->Full()) {
+      auto rc = Flush(svid);
+      LOG_ASSERT(rc == Status::OK, "flush memtable failed");
+    }
   }
 };
 
-Status ShardImpl::Flush(uint16_t svid, bool shutdown) {
-  if (memtable_[svid] == nullptr) {
+Status ShardImpl::Flush(uint16_t svid) {
+  // 空的memtable不用下刷，也不能标记in_flush_，否则之后的写入会一直等待
+  if (memtable_[svid] == nullptr || memtable_[svid]->cnt_ == 0) {
     return Status::OK;
   }
   MemTable* immutable_mmt = memtable_[svid];
   immutable_mmt->in_flush_ = true;
 
   // 如果memtable中的row是更新的，则用memtable的最新来设置缓存的latest row
-  if (LIKELY(immutable_mmt->cnt_ != 0)) {
-    if (immutable_mmt->mem_latest_row_ts_ > latest_ts_cache_[svid]) {
-      latest_ts_cache_[svid] = immutable_mmt->mem_latest_row_ts_;
-      int idx = immutable_mmt->mem_latest_row_idx_;
-      for (int colid = 0; colid < kColumnNum; colid++) {
-        immutable_mmt->columnArrs_[colid]->Get(idx, latest_ts_cols_[svid][colid]);
-      }
+  if (immutable_mmt->mem_latest_row_ts_ > latest_ts_cache_[svid]) {
+    latest_ts_cache_[svid] = immutable_mmt->mem_latest_row_ts_;
+    latest_dirty_[svid] = true;
+    latest_ts_cols_[svid].resize(immutable_mmt->column_num_);
+    int idx = immutable_mmt->mem_latest_row_idx_;
+    for (int colid = 0; colid < immutable_mmt->column_num_; colid++) {
+      immutable_mmt->columnArrs_[colid]->Get(idx, latest_ts_cols_[svid][colid]);
     }
+  }
 
-    BlockMeta* meta =
-      block_mgr_[svid]->NewVinBlockMeta(immutable_mmt->cnt_, immutable_mmt->min_ts_, immutable_mmt->max_ts_,
-                                        immutable_mmt->max_val_, immutable_mmt->sum_val_);
-
-    // 刷写数据列
-    for (int i = 0; i < kColumnNum; i++) {
-      immutable_mmt->columnArrs_[i]->Flush(write_buf_[svid], immutable_mmt->cnt_, meta);
-    }
-    immutable_mmt->ts_col_->Flush(write_buf_[svid], immutable_mmt->cnt_, meta);
+  immutable_mmt->ComputeStats();
+  BlockMeta* meta = block_mgr_[svid]->NewVinBlockMeta(immutable_mmt->cnt_, immutable_mmt->min_ts_,
+                                                      immutable_mmt->max_ts_, immutable_mmt->stats_);
 
-    immutable_mmt->cnt_ = 0;
-    immutable_mmt->Reset();
-    immutable_mmt->cv_.notify();
+  // 刷写数据列，shard中所有vin的block都追加到同一个段里
+  meta->segment = acquireSegment();
+  meta->base_off = write_buf_->WrittenSz();
+  for (int i = 0; i < immutable_mmt->column_num_; i++) {
+    immutable_mmt->columnArrs_[i]->Flush(write_buf_, immutable_mmt->cnt_, meta);
   }
+  immutable_mmt->ts_col_->Flush(write_buf_, immutable_mmt->cnt_, meta);
+  releaseSegment();
 
-  if (shutdown) {
-    write_buf_[svid]->flush();
+  if (UNLIKELY(rollups_.empty())) {
+    for (int64_t resolution : g_config.rollup) {
+      rollups_.push_back(
+        new Rollup(resolution, engine_->columns_type_, engine_->column_num_, g_config.vin_num_per_shard));
+    }
   }
+  for (auto rollup : rollups_) {
+    rollup->Add(svid, immutable_mmt->ts_col_->GetDataArr(), immutable_mmt->cnt_, immutable_mmt->columnArrs_);
+  }
+
+  immutable_mmt->cnt_ = 0;
+  immutable_mmt->Reset();
+  immutable_mmt->cv_.notify();
 
   return Status::OK;
 };
@@ -233,14 +310,15 @@ void ShardImpl::GetLatestRow(uint16_t vid, const std::vector<int>& colids, OUT R
   int svid = vid2svid(vid);
 
   // in the memtable
-  if (UNLIKELY(write_phase && memtable_[svid]->mem_latest_row_ts_ > latest_ts_cache_[svid])) {
+  if (UNLIKELY(write_phase && memtable_[svid] != nullptr &&
+               memtable_[svid]->mem_latest_row_ts_ > latest_ts_cache_[svid])) {
     memtable_[svid]->GetLatestRow(svid, colids, row);
     return;
   }
 
   // in the latest cache
   row.timestamp = latest_ts_cache_[svid];
-  memcpy(row.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
+  memcpy(row.vin.vin, engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
   for (auto col_id : colids) {
     //    ColumnValue col_value;
     auto& col_name = engine_->columns_name_[col_id];
@@ -250,79 +328,212 @@ void ShardImpl::GetLatestRow(uint16_t vid, const std::vector<int>& colids, OUT R
   LOG_ASSERT(row.timestamp != -1, "???");
 };
 
+ColumnArrWrapper* ShardImpl::fetchColumn(BlockMeta* blk_meta, int colid, bool& hit) {
+  if (colid == engine_->column_num_) {
+    return read_cache_->FetchDataArr<TsArrWrapper>(blk_meta, colid, hit);
+  }
+  switch (engine_->columns_type_[colid]) {
+    case COLUMN_TYPE_STRING:
+      return read_cache_->FetchDataArr<StringArrWrapper>(blk_meta, colid, hit);
+    case COLUMN_TYPE_INTEGER:
+      return read_cache_->FetchDataArr<IntArrWrapper>(blk_meta, colid, hit);
+    case COLUMN_TYPE_DOUBLE_FLOAT:
+      return read_cache_->FetchDataArr<DoubleArrWrapper>(blk_meta, colid, hit);
+    case COLUMN_TYPE_UNINITIALIZED:
+      LOG_ASSERT(false, "error");
+      break;
+  }
+  return nullptr;
+}
+
+ColumnArrWrapper* ShardImpl::reserveColumn(BlockMeta* blk_meta, int colid) {
+  if (colid == engine_->column_num_) {
+    return read_cache_->TryReserveDataArr<TsArrWrapper>(blk_meta, colid);
+  }
+  switch (engine_->columns_type_[colid]) {
+    case COLUMN_TYPE_STRING:
+      return read_cache_->TryReserveDataArr<StringArrWrapper>(blk_meta, colid);
+    case COLUMN_TYPE_INTEGER:
+      return read_cache_->TryReserveDataArr<IntArrWrapper>(blk_meta, colid);
+    case COLUMN_TYPE_DOUBLE_FLOAT:
+      return read_cache_->TryReserveDataArr<DoubleArrWrapper>(blk_meta, colid);
+    case COLUMN_TYPE_UNINITIALIZED:
+      LOG_ASSERT(false, "error");
+      break;
+  }
+  return nullptr;
+}
+
+// 顺序预读的参数
+static constexpr size_t kReadaheadMinBlocks = 2;           // 至少扫描这么多个block才预读
+static constexpr size_t kReadaheadMaxGap = 32 * 1024;      // 两段数据之间的空洞不超过这么大就合并成一次读
+static constexpr size_t kReadaheadMaxIOSize = 1024 * 1024; // 合并之后一次读的上限
+
+void ShardImpl::readaheadBlocks(const std::vector<BlockMeta*>& blk_metas, const std::vector<int>& colids) {
+  if (write_phase || blk_metas.size() < kReadaheadMinBlocks) {
+    return;
+  }
+  // 占住的列在填充完之前不能被剔除，只预读cache的一部分，剩下的block还是由各自的协程去读。
+  // 占位不等待LRU：其他扫描的协程可能也在等这里已经占住的列，等下去会互相卡死
+  size_t budget = read_cache_->Capacity() / 4;
+  size_t reserved = 0;
+  bool full = false;
+  std::vector<ReadaheadExtent> extents;
+  for (auto blk_meta : blk_metas) {
+    if (reserved >= budget || full) {
+      break;
+    }
+    for (size_t k = 0; k <= colids.size(); k++) {
+      int colid = k < colids.size() ? colids[k] : engine_->column_num_;
+      if (read_cache_->Contains(blk_meta, colid)) {
+        continue;
+      }
+      auto col = reserveColumn(blk_meta, colid);
+      if (col == nullptr) {
+        full = true;
+        break;
+      }
+      reserved += col->TotalSize();
+      uint64_t off = blk_meta->Offset(colid);
+      extents.push_back({blk_meta, col, off, off + blk_meta->CompressSz(colid)});
+    }
+  }
+  if (!extents.empty()) {
+    readahead(extents);
+  }
+}
+
+void ShardImpl::readahead(std::vector<ReadaheadExtent>& extents) {
+  std::sort(extents.begin(), extents.end(), [](const ReadaheadExtent& a, const ReadaheadExtent& b) {
+    return a.meta->segment != b.meta->segment ? a.meta->segment < b.meta->segment : a.off < b.off;
+  });
+
+  // 同一个段文件中相邻的范围合并成一次读，[begin, end)是extents中的下标
+  struct Run {
+    size_t begin;
+    size_t end;
+    uint64_t start;
+    uint64_t len;
+    AsyncFile* file;
+    char* buf;
+  };
+  std::vector<Run> runs;
+  for (size_t i = 0; i < extents.size(); i++) {
+    auto& e = extents[i];
+    uint64_t start = rounddown512(e.off);
+    uint64_t end = roundup512(e.end);
+    if (!runs.empty()) {
+      auto& run = runs.back();
+      if (extents[run.begin].meta->segment == e.meta->segment && start <= run.start + run.len + kReadaheadMaxGap &&
+          end - run.start <= kReadaheadMaxIOSize) {
+        run.len = std::max(run.len, end - run.start);
+        run.end = i + 1;
+        continue;
+      }
+    }
+    runs.push_back({i, i + 1, start, end - start, nullptr, nullptr});
+  }
+
+  for (auto& run : runs) {
+    run.file = dynamic_cast<AsyncFile*>(segmentFile(extents[run.begin].meta->segment));
+    ENSURE(run.file != nullptr, "empty async_file");
+    run.buf = reinterpret_cast<char*>(run.file->aio()->AllocBuffer(run.len));
+    run.file->async_read(run.buf, run.len, run.start);
+  }
+  // 同一个线程上的文件共用aio context，一次等待所有的读
+  runs.front().file->burst();
+
+  for (auto& run : runs) {
+    for (size_t i = run.begin; i < run.end; i++) {
+      auto& e = extents[i];
+      e.col->Decompressed(run.buf + (rounddown512(e.off) - run.start), e.meta);
+      read_cache_->Release(e.meta, e.col->GetColid(), e.col);
+      auto string_col = dynamic_cast<StringArrWrapper*>(e.col);
+      if (UNLIKELY(string_col != nullptr)) {
+        // 后面的列还占着，这里也不能等待
+        read_cache_->ReviseCacheSize(string_col, false);
+      }
+    }
+    run.file->aio()->FreeBuffer(run.buf);
+  }
+}
+
+TsArrWrapper* ShardImpl::fetchColumns(BlockMeta* blk_meta, const std::vector<int>& colids, ColumnArrWrapper** cols,
+                                      std::vector<ColumnArrWrapper*>& need_read_from_file) {
+  bool hit;
+  auto ts_col = dynamic_cast<TsArrWrapper*>(fetchColumn(blk_meta, engine_->column_num_, hit));
+  if (!hit) need_read_from_file.push_back(ts_col);
+
+  for (size_t i = 0; i < colids.size(); i++) {
+    cols[i] = fetchColumn(blk_meta, colids[i], hit);
+    if (!hit) need_read_from_file.push_back(cols[i]);
+  }
+
+  if (need_read_from_file.empty()) {
+    return ts_col;
+  }
+  File* rfile = segmentFile(blk_meta->segment);
+  if (UNLIKELY(write_phase)) {
+    for (auto& col : need_read_from_file) {
+      // 异步非Batch IO
+      col->Read(rfile, writeBuffer(blk_meta->segment), blk_meta);
+    }
+  } else {
+    // 所有列的读请求一起放进调度线程的aio队列，和同一个线程上其他协程的IO一起提交
+    auto async_rfile = dynamic_cast<AsyncFile*>(rfile);
+    ENSURE(async_rfile != nullptr, "empty async_file");
+    char* bufs[need_read_from_file.size()];
+    for (size_t i = 0; i < need_read_from_file.size(); i++) {
+      bufs[i] = need_read_from_file[i]->AsyncReadCompressed(async_rfile, blk_meta);
+    }
+    async_rfile->burst();
+    for (size_t i = 0; i < need_read_from_file.size(); i++) {
+      need_read_from_file[i]->Decompressed(bufs[i], blk_meta);
+      async_rfile->aio()->FreeBuffer(bufs[i]);
+    }
+  }
+  return ts_col;
+}
+
+void ShardImpl::releaseColumns(BlockMeta* blk_meta, const std::vector<int>& colids, TsArrWrapper* ts_col,
+                               ColumnArrWrapper** cols, const std::vector<ColumnArrWrapper*>& need_read_from_file) {
+  read_cache_->Release(blk_meta, engine_->column_num_, ts_col);
+  for (size_t i = 0; i < colids.size(); i++) {
+    read_cache_->Release(blk_meta, colids[i], cols[i]);
+  }
+
+  for (auto& col : need_read_from_file) {
+    auto string_col = dynamic_cast<StringArrWrapper*>(col);
+    if (UNLIKELY(string_col != nullptr)) {
+      read_cache_->ReviseCacheSize(string_col);
+    }
+  }
+}
+
 // TODO:
 // 如果需要从文件读取的列过多，可以考虑控制小batch读取，以免同时分配了过多cache外的内存，导致出现死锁状态，参考lru_wait_cnt指标
 void ShardImpl::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
                                      const std::vector<int>& colids, std::vector<Row>& results) {
   results.reserve((upperExclusive - lowerInclusive) / 1000);
   uint16_t svid = vid2svid(vid);
-  if (UNLIKELY(write_phase)) {
+  if (UNLIKELY(write_phase && memtable_[svid] != nullptr)) {
     memtable_[svid]->GetRowsFromTimeRange(vid, lowerInclusive, upperExclusive, colids, results);
   }
 
   std::vector<BlockMeta*> blk_metas;
   block_mgr_[svid]->GetVinBlockMetasByTimeRange(vid, lowerInclusive, upperExclusive, blk_metas);
 
-  File* rfile = data_file_[svid];
-  if (UNLIKELY(write_phase)) {
-    std::string file_name = VinFileName(engine_->dataDirPath, kTableName, vid);
-    rfile = new RandomAccessFile(file_name);
-  }
-
   if (!blk_metas.empty()) {
     RECORD_FETCH_ADD(disk_blk_access_cnt, blk_metas.size());
+    readaheadBlocks(blk_metas, colids);
+    size_t wait_cnt = blk_metas.size();
     for (auto blk_meta : blk_metas) {
-      auto func = [blk_meta, this, &colids, rfile, &results, vid, lowerInclusive, upperExclusive,
-                   father = this_coroutine::current(), svid]() {
+      auto func = [blk_meta, this, &colids, &results, vid, lowerInclusive, upperExclusive,
+                   father = this_coroutine::current()]() {
         // 去读对应列的block
         std::vector<ColumnArrWrapper*> need_read_from_file;
-
-        bool hit;
-        TsArrWrapper* tmp_ts_col = read_cache_->FetchDataArr<TsArrWrapper>(blk_meta, kColumnNum, hit);
-        if (!hit) need_read_from_file.push_back(tmp_ts_col);
-
         ColumnArrWrapper* cols[colids.size()];
-
-        int icol_idx = 0;
-        for (const auto col_id : colids) {
-          switch (engine_->columns_type_[col_id]) {
-            case COLUMN_TYPE_STRING:
-              cols[icol_idx] = read_cache_->FetchDataArr<StringArrWrapper>(blk_meta, col_id, hit);
-              if (!hit) need_read_from_file.push_back(cols[icol_idx]);
-              break;
-            case COLUMN_TYPE_INTEGER:
-              cols[icol_idx] = read_cache_->FetchDataArr<IntArrWrapper>(blk_meta, col_id, hit);
-              if (!hit) need_read_from_file.push_back(cols[icol_idx]);
-              break;
-            case COLUMN_TYPE_DOUBLE_FLOAT:
-              cols[icol_idx] = read_cache_->FetchDataArr<DoubleArrWrapper>(blk_meta, col_id, hit);
-              if (!hit) need_read_from_file.push_back(cols[icol_idx]);
-              break;
-            case COLUMN_TYPE_UNINITIALIZED:
-              LOG_ASSERT(false, "error");
-              break;
-          }
-          icol_idx++;
-        }
-
-        if (UNLIKELY(write_phase)) {
-          for (auto& col : need_read_from_file) {
-            // 异步非Batch IO
-            col->Read(rfile, write_buf_[svid], blk_meta);
-          }
-        } else {
-          // 分成多个文件之后操作系统能创建的IO上下文不够了，这里就没法批量了
-          auto async_rfile = dynamic_cast<AsyncFile*>(rfile);
-          ENSURE(async_rfile != nullptr, "empty async_file");
-          for (auto& col : need_read_from_file) {
-            while (async_rfile->avalibaleIOC() <= 0) {
-              async_rfile->waitIOC();
-            }
-            auto buf = col->AsyncReadCompressed(async_rfile, blk_meta);
-            async_rfile->burst();
-            col->Decompressed(buf, blk_meta);
-          }
-        }
+        TsArrWrapper* tmp_ts_col = fetchColumns(blk_meta, colids, cols, need_read_from_file);
 
         auto tss = tmp_ts_col->GetDataArr();
         if (lowerInclusive <= blk_meta->min_ts && blk_meta->max_ts < upperExclusive) {
@@ -331,7 +542,7 @@ void ShardImpl::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64
             // build res row
             Row resultRow;
             resultRow.timestamp = tss[i];
-            memcpy(resultRow.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
+            memcpy(resultRow.vin.vin, engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
             for (size_t k = 0; k < colids.size(); k++) {
               ColumnValue col;
               cols[k]->Get(i, col);
@@ -345,7 +556,7 @@ void ShardImpl::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64
             if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
               Row resultRow;
               resultRow.timestamp = tss[i];
-              memcpy(resultRow.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
+              memcpy(resultRow.vin.vin, engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
               for (size_t k = 0; k < colids.size(); k++) {
                 ColumnValue col;
                 cols[k]->Get(i, col);
@@ -356,132 +567,482 @@ void ShardImpl::GetRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64
           }
         }
 
-        read_cache_->Release(blk_meta, kColumnNum, tmp_ts_col);
-        for (size_t i = 0; i < colids.size(); i++) {
-          read_cache_->Release(blk_meta, colids[i], cols[i]);
+        releaseColumns(blk_meta, colids, tmp_ts_col, cols, need_read_from_file);
+        father->wakeup_once();
+      };
+      this_coroutine::coro_scheduler()->addTask(std::move(func));
+    }
+    this_coroutine::co_wait(wait_cnt);
+  }
+};
+
+void ShardImpl::GetFilteredRowsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                                             const std::vector<int>& colids, int filter_colid,
+                                             const CompareExpression& cmp, std::vector<Row>& results) {
+  // 过滤列没有被请求的时候放在最后一起读出来，只用来过滤
+  std::vector<int> read_colids(colids);
+  bool filter_requested = std::find(colids.begin(), colids.end(), filter_colid) != colids.end();
+  if (!filter_requested) {
+    read_colids.push_back(filter_colid);
+  }
+  int filter_pos = std::find(read_colids.begin(), read_colids.end(), filter_colid) - read_colids.begin();
+
+  uint16_t svid = vid2svid(vid);
+  if (UNLIKELY(write_phase && memtable_[svid] != nullptr)) {
+    const std::string& filter_name = engine_->columns_name_[filter_colid];
+    std::vector<Row> rows;
+    memtable_[svid]->GetRowsFromTimeRange(vid, lowerInclusive, upperExclusive, read_colids, rows);
+    for (auto& row : rows) {
+      if (!cmp.doCompare(row.columns.at(filter_name))) {
+        continue;
+      }
+      if (!filter_requested) {
+        row.columns.erase(filter_name);
+      }
+      results.push_back(std::move(row));
+    }
+  }
+
+  std::vector<BlockMeta*> blk_metas;
+  block_mgr_[svid]->GetVinBlockMetasByTimeRange(vid, lowerInclusive, upperExclusive, blk_metas);
+  // 没有行满足过滤条件的block不读，所有行都满足的block不用逐行判断
+  std::vector<BlockMeta*> read_metas;
+  std::vector<bool> all_pass;
+  for (auto blk_meta : blk_metas) {
+    BlockFilter res = blockFilter(blk_meta, filter_colid, cmp);
+    if (res == BlockFilter::kNonePass) {
+      RECORD_FETCH_ADD(filter_skip_blk_cnt, 1);
+      continue;
+    }
+    read_metas.push_back(blk_meta);
+    all_pass.push_back(res == BlockFilter::kAllPass);
+  }
+  if (read_metas.empty()) {
+    return;
+  }
+
+  RECORD_FETCH_ADD(disk_blk_access_cnt, read_metas.size());
+  readaheadBlocks(read_metas, read_colids);
+  size_t wait_cnt = read_metas.size();
+  for (size_t b = 0; b < read_metas.size(); b++) {
+    auto func = [blk_meta = read_metas[b], all_pass = all_pass[b], this, &colids, &read_colids, filter_pos,
+                 filter_colid, &cmp, &results, vid, lowerInclusive, upperExclusive,
+                 father = this_coroutine::current()]() {
+      std::vector<ColumnArrWrapper*> need_read_from_file;
+      ColumnArrWrapper* cols[read_colids.size()];
+      TsArrWrapper* tmp_ts_col = fetchColumns(blk_meta, read_colids, cols, need_read_from_file);
+
+      auto tss = tmp_ts_col->GetDataArr();
+      uint16_t sel[kMaxMemtableRowNum];
+      int n = 0;
+      for (int i = 0; i < blk_meta->num; i++) {
+        if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
+          sel[n++] = i;
+        }
+      }
+      if (!all_pass) {
+        n = filterRows(cols[filter_pos], filter_colid, cmp, sel, n);
+      }
+      for (int k = 0; k < n; k++) {
+        Row resultRow;
+        resultRow.timestamp = tss[sel[k]];
+        memcpy(resultRow.vin.vin, engine_->vin_dict_.GetVin(vid), VIN_LENGTH);
+        for (size_t c = 0; c < colids.size(); c++) {
+          ColumnValue col;
+          cols[c]->Get(sel[k], col);
+          resultRow.columns.insert(std::make_pair(engine_->columns_name_[colids[c]], std::move(col)));
+        }
+        results.push_back(std::move(resultRow));
+      }
+
+      releaseColumns(blk_meta, read_colids, tmp_ts_col, cols, need_read_from_file);
+      father->wakeup_once();
+    };
+    this_coroutine::coro_scheduler()->addTask(std::move(func));
+  }
+  this_coroutine::co_wait(wait_cnt);
+}
+
+int ShardImpl::filterRows(ColumnArrWrapper* col, int colid, const CompareExpression& cmp, uint16_t* sel, int n) {
+  ColumnValueWrapper wrapper(&cmp.value);
+  switch (engine_->columns_type_[colid]) {
+    case COLUMN_TYPE_INTEGER:
+      return filterRows(static_cast<IntArrWrapper*>(col)->GetDataArr(), cmp.compareOp,
+                        wrapper.getFixedSizeValue<int>(), sel, n);
+    case COLUMN_TYPE_DOUBLE_FLOAT:
+      return filterRows(static_cast<DoubleArrWrapper*>(col)->GetDataArr(), cmp.compareOp,
+                        wrapper.getFixedSizeValue<double>(), sel, n);
+    default: {
+      int m = 0;
+      for (int i = 0; i < n; i++) {
+        ColumnValue val;
+        col->Get(sel[i], val);
+        if (cmp.doCompare(val)) {
+          sel[m++] = sel[i];
         }
+      }
+      return m;
+    }
+  }
+}
+
+void ShardImpl::GetColumnsFromTimeRange(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                                        const std::vector<int>& colids, ColumnBatch& batch) {
+  uint16_t svid = vid2svid(vid);
+  if (UNLIKELY(write_phase && memtable_[svid] != nullptr)) {
+    memtable_[svid]->GetColumnsFromTimeRange(lowerInclusive, upperExclusive, colids, batch);
+  }
+
+  std::vector<BlockMeta*> blk_metas;
+  block_mgr_[svid]->GetVinBlockMetasByTimeRange(vid, lowerInclusive, upperExclusive, blk_metas);
+  if (blk_metas.empty()) {
+    return;
+  }
 
-        for (auto& col : need_read_from_file) {
-          auto string_col = dynamic_cast<StringArrWrapper*>(col);
-          if (UNLIKELY(string_col != nullptr)) {
-            read_cache_->ReviseCacheSize(string_col);
+  // 预估行数，避免append的时候反复扩容
+  size_t rows = batch.RowNum();
+  for (auto blk_meta : blk_metas) {
+    rows += blk_meta->num;
+  }
+  batch.timestamps.reserve(rows);
+  for (auto& col : batch.columns) {
+    col.Reserve(rows);
+  }
+
+  RECORD_FETCH_ADD(disk_blk_access_cnt, blk_metas.size());
+  readaheadBlocks(blk_metas, colids);
+  size_t wait_cnt = blk_metas.size();
+  for (auto blk_meta : blk_metas) {
+    auto func = [blk_meta, this, &colids, &batch, lowerInclusive, upperExclusive,
+                 father = this_coroutine::current()]() {
+      std::vector<ColumnArrWrapper*> need_read_from_file;
+      ColumnArrWrapper* cols[colids.size()];
+      TsArrWrapper* tmp_ts_col = fetchColumns(blk_meta, colids, cols, need_read_from_file);
+
+      // 直接从解压好的数组拷贝到batch中，中间不会让出协程，所以一个block的行在batch里是连续的
+      auto tss = tmp_ts_col->GetDataArr();
+      if (lowerInclusive <= blk_meta->min_ts && blk_meta->max_ts < upperExclusive) {
+        batch.timestamps.insert(batch.timestamps.end(), tss, tss + blk_meta->num);
+        for (size_t k = 0; k < colids.size(); k++) {
+          cols[k]->AppendTo(batch.columns[k], nullptr, blk_meta->num);
+        }
+      } else {
+        uint16_t sel[kMaxMemtableRowNum];
+        int n = 0;
+        for (int i = 0; i < blk_meta->num; i++) {
+          if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
+            sel[n++] = i;
           }
         }
+        for (int i = 0; i < n; i++) {
+          batch.timestamps.push_back(tss[sel[i]]);
+        }
+        for (size_t k = 0; k < colids.size(); k++) {
+          cols[k]->AppendTo(batch.columns[k], sel, n);
+        }
+      }
+
+      releaseColumns(blk_meta, colids, tmp_ts_col, cols, need_read_from_file);
+      father->wakeup_once();
+    };
+    this_coroutine::coro_scheduler()->addTask(std::move(func));
+  }
+  this_coroutine::co_wait(wait_cnt);
+}
+
+ShardImpl::BatchAggBase* ShardImpl::newBatchAgg(const BatchAggItem& item, int64_t lowerInclusive, int64_t interval,
+                                                int bucket_num) {
+  BatchAggBase* agg = nullptr;
+  bool ok = dispatchAgg(item.op, engine_->columns_type_[item.colid], item.filter, [&](auto kind) {
+    using K = decltype(kind);
+    agg = new BatchAgg<typename K::Op, typename K::Filter, typename K::Wrapper>(this, item.colid, lowerInclusive,
+                                                                                interval, bucket_num, item.filter);
+  });
+  if (!ok) {
+    LOG_ERROR("should not be STRING TYPE");
+  }
+  return agg;
+}
+
+void ShardImpl::scanBlocks(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t origin,
+                           int64_t interval, int bucket_num, const std::vector<BatchAggItem>& items,
+                           const std::vector<BatchAggBase*>& aggs, bool& has_data) {
+  uint16_t svid = vid2svid(vid);
+  if (UNLIKELY(write_phase && memtable_[svid] != nullptr)) {
+    MemTable* mmt = memtable_[svid];
+    if (mmt->cnt_ != 0 && !(mmt->min_ts_ >= upperExclusive || mmt->max_ts_ < lowerInclusive)) {
+      uint16_t sel[kMaxMemtableRowNum];
+      int n = 0;
+      auto tss = mmt->ts_col_->GetDataArr();
+      for (int i = 0; i < mmt->cnt_; i++) {
+        if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
+          sel[n++] = i;
+        }
+      }
+      has_data |= n > 0;
+      for (size_t i = 0; i < items.size(); i++) {
+        if (aggs[i] != nullptr) aggs[i]->AddRows(mmt->columnArrs_[items[i].colid], tss, sel, n);
+      }
+    }
+  }
+
+  std::vector<BlockMeta*> blk_metas;
+  block_mgr_[svid]->GetVinBlockMetasByTimeRange(vid, lowerInclusive, upperExclusive, blk_metas);
+
+  if (!blk_metas.empty()) {
+    RECORD_FETCH_ADD(disk_blk_access_cnt, blk_metas.size());
+    int sub_task_num = 0;
+    for (auto blk_meta : blk_metas) {
+      bool covered = lowerInclusive <= blk_meta->min_ts && blk_meta->max_ts < upperExclusive;
+      has_data |= covered;
+      // block在查询范围内的部分落在同一个桶里的时候不需要逐行算桶号，整个在范围内的时候
+      // 所有行都满足过滤条件的项直接用blockmeta统计值。没有行满足过滤条件的项直接跳过，
+      // 剩下的项用到的列去重之后每个block只读一次
+      int pos = position(origin, interval, std::max(blk_meta->min_ts, lowerInclusive));
+      bool one_bucket =
+        pos < bucket_num && pos == position(origin, interval, std::min(blk_meta->max_ts, upperExclusive - 1));
+      std::vector<int> colids;
+      std::vector<int> col_pos(items.size(), -1);
+      for (size_t i = 0; i < items.size(); i++) {
+        if (aggs[i] == nullptr) continue;
+        BlockFilter res = items[i].filter == nullptr ? BlockFilter::kAllPass
+                                                     : blockFilter(blk_meta, items[i].colid, *items[i].filter);
+        if (res == BlockFilter::kNonePass) {
+          RECORD_FETCH_ADD(filter_skip_blk_cnt, 1);
+          continue;
+        }
+        if (res == BlockFilter::kAllPass && covered && one_bucket) {
+          aggs[i]->AddBlockStat(blk_meta, pos);
+          continue;
+        }
+        auto iter = std::find(colids.begin(), colids.end(), items[i].colid);
+        col_pos[i] = iter - colids.begin();
+        if (iter == colids.end()) colids.push_back(items[i].colid);
+      }
+      // 没有项需要读数据，但是还不知道范围内有没有数据的时候只读时间戳列
+      if (colids.empty() && (covered || has_data)) {
+        continue;
+      }
+
+      auto func = [this, blk_meta, covered, one_bucket, pos, colids = std::move(colids), col_pos = std::move(col_pos),
+                   &items, &aggs, &has_data, lowerInclusive, upperExclusive, father = this_coroutine::current()]() {
+        std::vector<ColumnArrWrapper*> need_read_from_file;
+        ColumnArrWrapper* cols[colids.size() + 1];
+        TsArrWrapper* tmp_ts_col = fetchColumns(blk_meta, colids, cols, need_read_from_file);
+
+        auto tss = tmp_ts_col->GetDataArr();
+        int n = blk_meta->num;
+        if (one_bucket) {
+          // 范围内的行用掩码表示，交给聚合项的SIMD kernel
+          uint8_t mask[kMaxMemtableRowNum];
+          if (covered) {
+            memset(mask, 0xff, n);
+          } else {
+            RangeMask(tss, n, lowerInclusive, upperExclusive, mask);
+          }
+          has_data |= covered || std::find(mask, mask + n, 0xff) != mask + n;
+          for (size_t i = 0; i < items.size(); i++) {
+            if (col_pos[i] >= 0) aggs[i]->AddBucketRows(cols[col_pos[i]], tss, mask, n, pos);
+          }
+        } else {
+          uint16_t sel[kMaxMemtableRowNum];
+          if (!covered) {
+            n = 0;
+            for (int i = 0; i < blk_meta->num; i++) {
+              if (lowerInclusive <= tss[i] && tss[i] < upperExclusive) {
+                sel[n++] = i;
+              }
+            }
+          }
+          has_data |= n > 0;
+          for (size_t i = 0; i < items.size(); i++) {
+            if (col_pos[i] >= 0) aggs[i]->AddRows(cols[col_pos[i]], tss, covered ? nullptr : sel, n);
+          }
+        }
+
+        releaseColumns(blk_meta, colids, tmp_ts_col, cols, need_read_from_file);
         father->wakeup_once();
       };
       this_coroutine::coro_scheduler()->addTask(std::move(func));
+      sub_task_num++;
     }
-    this_coroutine::co_wait(blk_metas.size());
+    this_coroutine::co_wait(sub_task_num);
   }
+}
 
-  if (UNLIKELY(write_phase)) {
-    delete rfile;
+void ShardImpl::BatchAggregateQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
+                                    const std::vector<BatchAggItem>& items) {
+  int bucket_num = (upperExclusive - lowerInclusive) / interval;
+  if (UNLIKELY(bucket_num <= 0)) {
+    return;
   }
-};
+
+  // 每一项对应一个聚合状态，aggs[i]对应items[i]
+  std::vector<std::unique_ptr<BatchAggBase>> aggs;
+  aggs.reserve(items.size());
+  for (auto& item : items) {
+    aggs.emplace_back(newBatchAgg(item, lowerInclusive, interval, bucket_num));
+  }
+
+  if (std::all_of(aggs.begin(), aggs.end(), [](const auto& agg) { return agg == nullptr; })) {
+    return;
+  }
+  std::vector<BatchAggBase*> raw_aggs(aggs.size());
+  std::transform(aggs.begin(), aggs.end(), raw_aggs.begin(), [](const auto& agg) { return agg.get(); });
+
+  // 范围内是否有数据，和过滤条件无关，有数据的时候所有的桶都要输出
+  bool has_data = false;
+  const Rollup* rollup = pickRollup(lowerInclusive, upperExclusive, interval, items);
+  if (rollup != nullptr) {
+    rollupAggregate(rollup, vid, lowerInclusive, upperExclusive, interval, bucket_num, items, raw_aggs, has_data);
+  } else {
+    scanBlocks(vid, lowerInclusive, upperExclusive, lowerInclusive, interval, bucket_num, items, raw_aggs, has_data);
+  }
+
+  // 范围内没有数据就不返回结果
+  if (!has_data) {
+    return;
+  }
+  for (size_t i = 0; i < items.size(); i++) {
+    if (aggs[i] != nullptr) aggs[i]->Output(vid, *items[i].res);
+  }
+}
+
+const Rollup* ShardImpl::pickRollup(int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
+                                    const std::vector<BatchAggItem>& items) const {
+  // 写阶段的rollup还在内存中构建，不用来查询
+  if (write_phase || rollups_.empty() || (upperExclusive - lowerInclusive) % interval != 0) {
+    return nullptr;
+  }
+  // FIRST/LAST需要行的时间戳，桶中没有
+  for (auto& item : items) {
+    if (item.op == FIRST || item.op == LAST) {
+      return nullptr;
+    }
+  }
+  for (auto iter = rollups_.rbegin(); iter != rollups_.rend(); ++iter) {
+    int64_t resolution = (*iter)->Resolution();
+    if (interval % resolution == 0 && lowerInclusive % resolution == 0) {
+      return *iter;
+    }
+  }
+  return nullptr;
+}
+
+void ShardImpl::rollupAggregate(const Rollup* rollup, uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive,
+                                int64_t interval, int bucket_num, const std::vector<BatchAggItem>& items,
+                                const std::vector<BatchAggBase*>& aggs, bool& has_data) {
+  int n = 0;
+  const char* rec = rollup->Find(vid2svid(vid), lowerInclusive, upperExclusive, n);
+  // rollup包含了所有写入的行，没有桶就说明范围内没有数据
+  has_data |= n > 0;
+  RECORD_FETCH_ADD(rollup_bucket_cnt, n);
+
+  // 过滤条件需要逐行判断的桶，相邻并且需要扫描的项相同的合并成一个范围一起扫描
+  int64_t raw_lo = 0;
+  int64_t raw_hi = 0;
+  std::vector<BatchAggBase*> raw_aggs(items.size(), nullptr);
+  std::vector<BatchAggBase*> bucket_aggs(items.size(), nullptr);
+  auto scanRaw = [&]() {
+    if (raw_hi > raw_lo) {
+      scanBlocks(vid, raw_lo, raw_hi, lowerInclusive, interval, bucket_num, items, raw_aggs, has_data);
+    }
+    raw_lo = raw_hi = 0;
+  };
+  for (int k = 0; k < n; k++, rec += rollup->Stride()) {
+    int64_t ts = Rollup::Ts(rec);
+    int pos = position(lowerInclusive, interval, ts);
+    bool partial = false;
+    for (size_t i = 0; i < items.size(); i++) {
+      bucket_aggs[i] = nullptr;
+      if (aggs[i] == nullptr) continue;
+      BlockFilter res = items[i].filter == nullptr ? BlockFilter::kAllPass
+                                                   : rollupFilter(rollup, rec, items[i].colid, *items[i].filter);
+      if (res == BlockFilter::kAllPass) {
+        aggs[i]->AddRollupStat(pos, Rollup::Cnt(rec), rollup->Stat(rec, items[i].colid));
+      } else if (res == BlockFilter::kPartial) {
+        bucket_aggs[i] = aggs[i];
+        partial = true;
+      }
+    }
+    if (raw_hi > raw_lo && (!partial || ts != raw_hi || bucket_aggs != raw_aggs)) {
+      scanRaw();
+    }
+    if (partial) {
+      if (raw_hi == raw_lo) {
+        raw_lo = ts;
+        raw_aggs = bucket_aggs;
+      }
+      raw_hi = ts + rollup->Resolution();
+    }
+  }
+  scanRaw();
+}
+
+ShardImpl::BlockFilter ShardImpl::rollupFilter(const Rollup* rollup, const char* rec, int colid,
+                                               const CompareExpression& cmp) {
+  ColumnValueWrapper wrapper(&cmp.value);
+  switch (engine_->columns_type_[colid]) {
+    case COLUMN_TYPE_INTEGER: {
+      auto m = Rollup::LoadStat<int>(0, rollup->Stat(rec, colid));
+      return blockFilter(m.min, m.max, cmp.compareOp, wrapper.getFixedSizeValue<int>());
+    }
+    case COLUMN_TYPE_DOUBLE_FLOAT: {
+      auto m = Rollup::LoadStat<double>(0, rollup->Stat(rec, colid));
+      return blockFilter(m.min, m.max, cmp.compareOp, wrapper.getFixedSizeValue<double>());
+    }
+    default:
+      return BlockFilter::kPartial;
+  }
+}
+
+ShardImpl::BlockFilter ShardImpl::blockFilter(BlockMeta* meta, int colid, const CompareExpression& cmp) {
+  const BlockLayout& layout = engine_->block_layout_;
+  ColumnValueWrapper wrapper(&cmp.value);
+  switch (engine_->columns_type_[colid]) {
+    case COLUMN_TYPE_INTEGER:
+      return blockFilter(layout.Min<int>(meta, colid), layout.Max<int>(meta, colid), cmp.compareOp,
+                         wrapper.getFixedSizeValue<int>());
+    case COLUMN_TYPE_DOUBLE_FLOAT:
+      return blockFilter(layout.Min<double>(meta, colid), layout.Max<double>(meta, colid), cmp.compareOp,
+                         wrapper.getFixedSizeValue<double>());
+    default:
+      return BlockFilter::kPartial;
+  }
+}
 
 ShardImpl::~ShardImpl() {
   delete read_cache_;
-  for (int i = 0; i < kVinNumPerShard; i++) {
-    delete write_buf_[i];
+  delete write_buf_;
+  for (auto file : segment_read_file_) {
+    delete file;
+  }
+  for (int i = 0; i < g_config.vin_num_per_shard; i++) {
     delete memtable_[i];
     delete block_mgr_[i];
   }
-};
-
-void ShardImpl::InitMemTable() {
-  for (int i = 0; i < kVinNumPerShard; i++) {
-    memtable_[i]->Init();
+  for (auto rollup : rollups_) {
+    delete rollup;
   }
 };
 
-// TODO: 改成time range 过程中就计算，减少对row的构建
+// 只有一个桶的批量聚合
 void ShardImpl::AggregateQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int colid, Aggregator op,
                                std::vector<Row>& res) {
-  if (UNLIKELY(write_phase)) {
-    std::vector<Row> tmp_res;
-    GetRowsFromTimeRange(vid, lowerInclusive, upperExclusive, {colid}, tmp_res);
-    // 空范围
-    if (UNLIKELY(tmp_res.empty())) {
-      return;
-    }
-
-    std::string& col_name = engine_->columns_name_[colid];
-    ColumnType t = engine_->columns_type_[colid];
-    Row row;
-    if (op == AVG) {
-      if (t == COLUMN_TYPE_INTEGER) {
-        aggregateImpl<AvgAggregate<int>, int>(tmp_res, col_name, row);
-      } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-        aggregateImpl<AvgAggregate<double>, double>(tmp_res, col_name, row);
-      } else {
-        LOG_ERROR("should not be STRING TYPE");
-      }
-    } else if (op == MAX) {
-      if (t == COLUMN_TYPE_INTEGER) {
-        aggregateImpl<MaxAggreate<int>, int>(tmp_res, col_name, row);
-      } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-        aggregateImpl<MaxAggreate<double>, double>(tmp_res, col_name, row);
-      } else {
-        LOG_ERROR("should not be STRING TYPE");
-      }
-    }
-    row.timestamp = lowerInclusive;
-    ::memcpy(row.vin.vin, engine_->vid2vin_[vid].c_str(), VIN_LENGTH);
-    res.push_back(std::move(row));
-  } else {
-    std::string& col_name = engine_->columns_name_[colid];
-    ColumnType t = engine_->columns_type_[colid];
-    if (op == AVG) {
-      if (t == COLUMN_TYPE_INTEGER) {
-        aggregateImpl2<AvgAggregate<int64_t>, int64_t>(vid, lowerInclusive, upperExclusive, colid, res);
-      } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-        aggregateImpl2<AvgAggregate<double>, double>(vid, lowerInclusive, upperExclusive, colid, res);
-      } else {
-        LOG_ERROR("should not be STRING TYPE");
-      }
-    } else if (op == MAX) {
-      if (t == COLUMN_TYPE_INTEGER) {
-        aggregateImpl2<MaxAggreate<int>, int>(vid, lowerInclusive, upperExclusive, colid, res);
-      } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-        aggregateImpl2<MaxAggreate<double>, double>(vid, lowerInclusive, upperExclusive, colid, res);
-      } else {
-        LOG_ERROR("should not be STRING TYPE");
-      }
-    }
+  if (UNLIKELY(upperExclusive <= lowerInclusive)) {
+    return;
   }
-};
+  BatchAggregateQuery(vid, lowerInclusive, upperExclusive, upperExclusive - lowerInclusive,
+                      {{colid, op, nullptr, &res}});
+}
 
+// 和批量降采样走同一条列式的路径，不构建Row
 void ShardImpl::DownSampleQuery(uint64_t vid, int64_t lowerInclusive, int64_t upperExclusive, int64_t interval,
                                 int colid, Aggregator op, const CompareExpression& cmp, std::vector<Row>& res) {
-  std::vector<Row> tmp_res;
-  GetRowsFromTimeRange(vid, lowerInclusive, upperExclusive, {colid}, tmp_res);
-  // 空范围
-  if (UNLIKELY(tmp_res.empty())) {
+  if (UNLIKELY(interval <= 0)) {
     return;
   }
-
-  std::string& col_name = engine_->columns_name_[colid];
-  ColumnType t = engine_->columns_type_[colid];
-
-  if (op == AVG) {
-    if (t == COLUMN_TYPE_INTEGER) {
-      downsampleImpl<AvgAggregate<int>, int>(tmp_res, col_name, lowerInclusive, upperExclusive, interval, cmp, res);
-    } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-      downsampleImpl<AvgAggregate<double>, double>(tmp_res, col_name, lowerInclusive, upperExclusive, interval, cmp,
-                                                   res);
-    } else {
-      LOG_ERROR("should not be STRING TYPE");
-    }
-  } else if (op == MAX) {
-    if (t == COLUMN_TYPE_INTEGER) {
-      downsampleImpl<MaxAggreate<int>, int>(tmp_res, col_name, lowerInclusive, upperExclusive, interval, cmp, res);
-    } else if (t == COLUMN_TYPE_DOUBLE_FLOAT) {
-      downsampleImpl<MaxAggreate<double>, double>(tmp_res, col_name, lowerInclusive, upperExclusive, interval, cmp,
-                                                  res);
-    } else {
-      LOG_ERROR("should not be STRING TYPE");
-    }
-  }
+  BatchAggregateQuery(vid, lowerInclusive, upperExclusive, interval, {{colid, op, &cmp, &res}});
 }
 
-} // namespace LindormContest
\ No newline at end of file
+} // namespace LindormContest
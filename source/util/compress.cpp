@@ -121,7 +121,7 @@ int TsDiffCompress(int64_t ts_arr[], int cnt, int64_t min, int64_t max, char* &b
 int TsDiffDeCompress(int64_t ts_arr[], int &cnt, char* buf, uint64_t compress_size) {
   if (buf[0] != 1) return -1;
 
-  int int_ts_arr[kMemtableRowNum];
+  int int_ts_arr[kMaxMemtableRowNum];
   DiffDeCompress(int_ts_arr, cnt, buf, compress_size);
 
   for (int i = 0; i < cnt; i++) {
@@ -22,9 +22,11 @@ std::atomic<int64_t> time_range_query_time{0};
 
 std::atomic<int64_t> tr_memtable_blk_query_cnt{0}; // time range遍历的memtable中的block总数
 std::atomic<int64_t> disk_blk_access_cnt{0};       // time range遍历的磁盘块的总数
+std::atomic<int64_t> filter_skip_blk_cnt{0};       // 由min/max判断过滤条件之后不用读的磁盘块总数
+std::atomic<int64_t> rollup_bucket_cnt{0};         // 聚合/降采样直接使用的rollup桶的总数
 
-std::atomic<int64_t> origin_szs[kColumnNum + kExtraColNum];
-std::atomic<int64_t> compress_szs[kColumnNum + kExtraColNum];
+std::atomic<int64_t> origin_szs[kMaxColumnNum + kExtraColNum];
+std::atomic<int64_t> compress_szs[kMaxColumnNum + kExtraColNum];
 
 std::atomic<int64_t> cache_hit{0};
 std::atomic<int64_t> cache_cnt{0};
@@ -51,16 +53,16 @@ std::string types[] = {
   "double",
 };
 
-void print_file_summary(ColumnType* columnsType, std::string* columnsName) {
+void print_file_summary(int columnNum, ColumnType* columnsType, std::string* columnsName) {
   LOG_INFO("*********FILE SUMMARY*********");
   LOG_INFO("write_cnt: %ld, write wait cnt: %ld, flush wait cnt: %ld", write_cnt.load(), write_wait_cnt.load(),
            flush_wait_cnt.load());
-  for (int i = 0; i < kColumnNum; i++) {
+  for (int i = 0; i < columnNum; i++) {
     LOG_INFO("col %d col_name %s, col_type %s, origin_sz %ld MB, compress_sz %ld MB compress rate is %f", i,
              columnsName[i].c_str(), types[columnsType[i]].c_str(), origin_szs[i].load() / MB,
              compress_szs[i].load() / MB, (compress_szs[i] * 1.0) / (origin_szs[i] * 1.0));
   }
-  for (int i = kColumnNum; i < kColumnNum + kExtraColNum; i++) {
+  for (int i = columnNum; i < columnNum + kExtraColNum; i++) {
     LOG_INFO("col %d, origin_sz %ld MB, compress_sz %ld MB compress rate is %f", i, origin_szs[i].load() / MB,
              compress_szs[i].load() / MB, (compress_szs[i] * 1.0) / (origin_szs[i] * 1.0));
   }
@@ -74,11 +76,12 @@ void print_performance_statistic() {
     "%ld\n====================agg_query_cnt: %ld\n====================downsample_query_cnt: "
     "%ld\n====================ReadCache Hit: %ld, MISS: "
     "%ld, HitRate: %lf\n====================ReadCache data wait :%ld, lru wait %ld\n====================Alloc time: "
-    "%ld\n====================wait aio :%ld\n===================disk_blk_access_cnt :%ld"
+    "%ld\n====================wait aio :%ld\n===================disk_blk_access_cnt :%ld, filter_skip_blk_cnt :%ld, rollup_bucket_cnt :%ld"
     "\n===================all_equal_compress :%ld, int_diff_compress: %ld, zstd_compress: %ld, high_compress: %ld",
     latest_query_cnt.load(), time_range_query_cnt.load(), agg_query_cnt.load(), downsample_query_cnt.load(),
     cache_hit.load(), cache_cnt.load() - cache_hit.load(), cache_hit.load() * 1.0 / cache_cnt.load(),
-    data_wait_cnt.load(), lru_wait_cnt.load(), alloc_time.load(), wait_aio.load(), disk_blk_access_cnt.load(), 
+    data_wait_cnt.load(), lru_wait_cnt.load(), alloc_time.load(), wait_aio.load(), disk_blk_access_cnt.load(),
+    filter_skip_blk_cnt.load(), rollup_bucket_cnt.load(),
     all_equal_compress_cnt.load(), int_diff_compress_cnt.load(), zstd_compress_cnt.load(), high_compress_cnt.load());
   LOG_INFO("*******************************************");
   fflush(stdout);
@@ -149,6 +152,8 @@ void print_memory_usage() {
 
 void clear_performance_statistic() {
   disk_blk_access_cnt = 0; // time range遍历的磁盘块的总数
+  filter_skip_blk_cnt = 0;
+  rollup_bucket_cnt = 0;
   cache_hit = 0;
   cache_cnt = 0;
   data_wait_cnt = 0;
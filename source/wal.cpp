@@ -0,0 +1,157 @@
+#include "wal.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "util/likely.h"
+#include "util/logging.h"
+
+namespace LindormContest {
+
+static constexpr size_t kWalAlign = 512;
+// 单个组的上限，超过的认为是损坏的组
+static constexpr uint32_t kMaxPayloadLen = 1U << 30;
+
+// 8字节一组的FNV-1a变体，日志只需要识别崩溃时没写完的组
+static uint64_t checksum(const char* data, size_t len) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    h = (h ^ word) * 0x100000001B3ULL;
+  }
+  for (; i < len; i++) {
+    h = (h ^ (uint8_t)data[i]) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+WalWriter::~WalWriter() {
+  LOG_ASSERT(!flushing_, "wal is flushing");
+  free(io_buf_);
+}
+
+void WalWriter::Append(const Row& row) {
+  pending_.append(row.vin.vin, VIN_LENGTH);
+  pending_.append((const char*)&row.timestamp, sizeof(row.timestamp));
+  // Row中的map和schema都按列名排序，遍历顺序就是列号顺序
+  for (auto& col : row.columns) {
+    pending_.append(col.second.columnData, col.second.getRawDataSize());
+  }
+  pending_rows_++;
+}
+
+void WalWriter::Sync() {
+  uint64_t group = next_group_;
+  while (committed_group_ <= group) {
+    if (flushing_) {
+      cv_.wait();
+      continue;
+    }
+    flushGroup();
+  }
+}
+
+void WalWriter::flushGroup() {
+  flushing_ = true;
+  next_group_++;
+
+  size_t len = sizeof(WalGroupHeader) + pending_.size();
+  size_t io_sz = (len + kWalAlign - 1) / kWalAlign * kWalAlign;
+  if (io_sz > io_buf_cap_) {
+    free(io_buf_);
+    io_buf_cap_ = std::max(io_sz, io_buf_cap_ * 2);
+    io_buf_ = (char*)std::aligned_alloc(kWalAlign, io_buf_cap_);
+    ENSURE(io_buf_ != nullptr, "alloc wal buffer failed");
+  }
+  LOG_ASSERT(pending_.size() <= kMaxPayloadLen, "wal group too large %zu", pending_.size());
+
+  WalGroupHeader header;
+  header.magic = WalGroupHeader::kMagic;
+  header.payload_len = pending_.size();
+  header.checksum = checksum(pending_.data(), pending_.size());
+  header.row_cnt = pending_rows_;
+  header.reserved = 0;
+  memcpy(io_buf_, &header, sizeof(header));
+  memcpy(io_buf_ + sizeof(header), pending_.data(), pending_.size());
+  memset(io_buf_ + len, 0, io_sz - len);
+  pending_.clear();
+  pending_rows_ = 0;
+
+  // 刷写期间其他协程继续往pending_里攒下一组
+  file_->write(io_buf_, io_sz);
+
+  committed_group_++;
+  flushing_ = false;
+  cv_.notify();
+}
+
+bool WalReader::Next(std::vector<Row>& rows) {
+  rows.clear();
+  if (UNLIKELY(file_.fd() < 0)) {
+    return false;
+  }
+  WalGroupHeader header;
+  if (file_.read((char*)&header, sizeof(header)) != Status::OK) {
+    return false;
+  }
+  if (header.magic != WalGroupHeader::kMagic || header.payload_len > kMaxPayloadLen) {
+    return false;
+  }
+  size_t len = sizeof(WalGroupHeader) + header.payload_len;
+  size_t io_sz = (len + kWalAlign - 1) / kWalAlign * kWalAlign;
+  buf_.resize(io_sz - sizeof(WalGroupHeader));
+  if (file_.read(buf_.data(), buf_.size()) != Status::OK) {
+    return false;
+  }
+  if (checksum(buf_.data(), header.payload_len) != header.checksum) {
+    LOG_ERROR("wal %s has a broken group, ignore the rest", file_.getFileName().c_str());
+    return false;
+  }
+
+  const char* p = buf_.data();
+  const char* end = p + header.payload_len;
+  rows.resize(header.row_cnt);
+  for (auto& row : rows) {
+    LOG_ASSERT(p + VIN_LENGTH + sizeof(int64_t) <= end, "invalid wal group");
+    memcpy(row.vin.vin, p, VIN_LENGTH);
+    p += VIN_LENGTH;
+    memcpy(&row.timestamp, p, sizeof(int64_t));
+    p += sizeof(int64_t);
+    for (int i = 0; i < column_num_; i++) {
+      switch (types_[i]) {
+        case COLUMN_TYPE_INTEGER: {
+          int32_t val;
+          memcpy(&val, p, sizeof(val));
+          p += sizeof(val);
+          row.columns.emplace(names_[i], ColumnValue(val));
+          break;
+        }
+        case COLUMN_TYPE_DOUBLE_FLOAT: {
+          double_t val;
+          memcpy(&val, p, sizeof(val));
+          p += sizeof(val);
+          row.columns.emplace(names_[i], ColumnValue(val));
+          break;
+        }
+        case COLUMN_TYPE_STRING: {
+          int32_t sz;
+          memcpy(&sz, p, sizeof(sz));
+          p += sizeof(sz);
+          row.columns.emplace(names_[i], ColumnValue(p, sz));
+          p += sz;
+          break;
+        }
+        case COLUMN_TYPE_UNINITIALIZED:
+          LOG_ASSERT(false, "column %d uninitialized", i);
+          break;
+      }
+    }
+  }
+  LOG_ASSERT(p == end, "invalid wal group");
+  return true;
+}
+
+} // namespace LindormContest
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "agg_kernels.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+// 逐行计算的结果，不依赖任何kernel
+template <typename T>
+static MaskedAgg<T> oracle(const T* data, const uint8_t* mask, int n) {
+  MaskedAgg<T> res;
+  for (int i = 0; i < n; i++) {
+    if (mask[i] == 0) continue;
+    res.cnt++;
+    res.sum += data[i];
+    res.max = std::max(res.max, data[i]);
+    res.min = std::min(res.min, data[i]);
+  }
+  return res;
+}
+
+template <typename T>
+static void checkAgg(const MaskedAgg<T>& expect, const MaskedAgg<T>& got, const char* name, int n) {
+  ASSERT(expect.cnt == got.cnt, "%s n=%d cnt expect %ld, got %ld", name, n, expect.cnt, got.cnt);
+  if (expect.cnt == 0) return;
+  // double的和也按行的顺序累加，要求和逐行计算完全一样
+  ASSERT(expect.sum == got.sum, "%s n=%d sum expect %.17g, got %.17g", name, n, (double)expect.sum,
+         (double)got.sum);
+  ASSERT(expect.max == got.max, "%s n=%d max mismatch", name, n);
+  ASSERT(expect.min == got.min, "%s n=%d min mismatch", name, n);
+}
+
+int main() {
+  std::mt19937_64 rng(2023);
+  const AggKernels* scalar = GetAggKernels(SimdLevel::SCALAR);
+  const int kMaxN = 1024;
+  std::vector<int64_t> tss(kMaxN);
+  std::vector<int> ints(kMaxN);
+  std::vector<double> doubles(kMaxN);
+  uint8_t expect_mask[kMaxN];
+  uint8_t got_mask[kMaxN];
+
+  for (auto simd : {SimdLevel::SCALAR, SimdLevel::SSE4_2, SimdLevel::AVX2}) {
+    const AggKernels* k = GetAggKernels(simd);
+    if (k == scalar && simd != SimdLevel::SCALAR) {
+      continue;
+    }
+    for (int round = 0; round < 2000; round++) {
+      // 长度覆盖各种尾部，值域小一些让EQUAL能命中
+      int n = rng() % kMaxN + 1;
+      for (int i = 0; i < n; i++) {
+        tss[i] = (int64_t)(rng() % 100000) * 1000;
+        ints[i] = (int)(rng() % 200) - 100;
+        if (round % 7 == 0) ints[i] = (int)rng(); // 覆盖int的极值，检查int64累加
+        doubles[i] = (double)(rng() % 200) / 4 - 25;
+        // 数量级相差很大的值，累加的顺序不同结果就不同
+        if (round % 2 == 1) doubles[i] = std::ldexp((double)(int64_t)rng() / 0x1p63, (int)(rng() % 80) - 40);
+      }
+      int64_t lo = (int64_t)(rng() % 100000) * 1000;
+      int64_t hi = lo + (int64_t)(rng() % 100000) * 1000;
+
+      scalar->range_mask(tss.data(), n, lo, hi, expect_mask);
+      k->range_mask(tss.data(), n, lo, hi, got_mask);
+      ASSERT(memcmp(expect_mask, got_mask, n) == 0, "%s range mask mismatch n=%d", k->name, n);
+
+      for (CompareOp op : {GREATER, EQUAL}) {
+        int ival = ints[rng() % n];
+        double dval = doubles[rng() % n];
+
+        uint8_t expect_int[kMaxN];
+        uint8_t got_int[kMaxN];
+        memcpy(expect_int, expect_mask, n);
+        memcpy(got_int, expect_mask, n);
+        scalar->filter_mask_int(ints.data(), n, op, ival, expect_int);
+        k->filter_mask_int(ints.data(), n, op, ival, got_int);
+        ASSERT(memcmp(expect_int, got_int, n) == 0, "%s int filter mask mismatch n=%d", k->name, n);
+
+        uint8_t expect_double[kMaxN];
+        uint8_t got_double[kMaxN];
+        memcpy(expect_double, expect_mask, n);
+        memcpy(got_double, expect_mask, n);
+        scalar->filter_mask_double(doubles.data(), n, op, dval, expect_double);
+        k->filter_mask_double(doubles.data(), n, op, dval, got_double);
+        ASSERT(memcmp(expect_double, got_double, n) == 0, "%s double filter mask mismatch n=%d", k->name, n);
+
+        MaskedAgg<int> got_iagg;
+        k->aggregate_int(ints.data(), expect_int, n, got_iagg);
+        checkAgg(oracle(ints.data(), expect_int, n), got_iagg, k->name, n);
+
+        MaskedAgg<double> got_dagg;
+        k->aggregate_double(doubles.data(), expect_double, n, got_dagg);
+        checkAgg(oracle(doubles.data(), expect_double, n), got_dagg, k->name, n);
+      }
+    }
+    OUTPUT("%s kernels passed\n", k->name);
+  }
+
+  OUTPUT("agg kernels test passed\n");
+  return 0;
+}
@@ -1,135 +1,125 @@
+#include <climits>
+#include <random>
+
 #include "agg.h"
+#include "bucket_agg.h"
+#include "struct/Requests.h"
+#include "test.hpp"
 
 using namespace LindormContest;
 
-int main() {
-  {
-    std::vector<int> tmp{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
-
-    AvgAggregate<int> avg;
-    for (auto& item : tmp) {
-      avg.Add(item);
-    }
-
-    MaxAggreate<int> max;
-    for (auto& item : tmp) {
-      max.Add(item);
-    }
-
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+// 逐行计算的结果，和bucket_agg.h的实现无关。sel为选中的行
+template <typename T>
+static ColumnValue expectAgg(Aggregator agg, const std::vector<T>& vals, const std::vector<int64_t>& tss,
+                             const std::vector<size_t>& sel) {
+  using TSum = std::conditional_t<std::is_integral<T>::value, int64_t, double>;
+  if (agg == COUNT) {
+    return ColumnValue((int)std::min<size_t>(sel.size(), INT_MAX));
   }
-  {
-    std::vector<int> tmp{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
-
-    AvgAggregate<int> avg(GREATER, 3);
-    for (auto& item : tmp) {
-      avg.Add(item);
-    }
-
-    MaxAggreate<int> max(GREATER, 11);
-    for (auto& item : tmp) {
-      max.Add(item);
-    }
-
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+  if (sel.empty()) {
+    return agg == AVG || agg == SUM ? ColumnValue(kDoubleNan) : ColumnValue(AggNan<T>());
   }
-  {
-    AvgAggregate<int> avg;
-    MaxAggreate<int> max;
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+  TSum sum = 0;
+  T max = vals[sel[0]];
+  T min = vals[sel[0]];
+  size_t first = sel[0];
+  size_t last = sel[0];
+  for (size_t i : sel) {
+    sum += vals[i];
+    max = std::max(max, vals[i]);
+    min = std::min(min, vals[i]);
+    // 时间戳相同的取先加入的
+    if (tss[i] < tss[first]) first = i;
+    if (tss[i] > tss[last]) last = i;
   }
-  {
-    std::vector<double> tmp{0, 1.2, 2.3, 3.4, 4.4, 5.5, 6.5, 7.8, 8.1, 9.1, 10.2};
-    AvgAggregate<double> avg;
-    MaxAggreate<double> max;
-    for (auto& item : tmp) {
-      avg.Add(item);
-    }
+  switch (agg) {
+    case AVG:
+      return ColumnValue(sum * 1.0 / sel.size());
+    case SUM:
+      return ColumnValue((double)sum);
+    case MAX:
+      return ColumnValue(max);
+    case MIN:
+      return ColumnValue(min);
+    case FIRST:
+      return ColumnValue(vals[first]);
+    default:
+      return ColumnValue(vals[last]);
+  }
+}
 
-    for (auto& item : tmp) {
-      max.Add(item);
-    }
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
+// 按桶聚合的结果和逐行计算的结果一致，第i行落在第i % buckets个桶
+template <typename TOp, typename TFilter, typename T>
+static void checkBucketAgg(Aggregator agg, const char* name, const std::vector<T>& vals, const CompareExpression* cmp,
+                           int buckets = 5) {
+  typename TOp::State state;
+  state.Init(buckets);
+  TFilter filter(cmp);
+  std::vector<int64_t> tss;
+  std::vector<std::vector<size_t>> sels(buckets);
+  for (size_t i = 0; i < vals.size(); i++) {
+    int64_t ts = (i * 7919) % 1000; // 乱序的时间戳
+    tss.push_back(ts);
+    if (filter.Pass(vals[i])) {
+      TOp::Add(state, i % buckets, vals[i], ts);
+      sels[i % buckets].push_back(i);
     }
   }
+  for (int i = 0; i < buckets; i++) {
+    ASSERT(TOp::Result(state, i) == expectAgg(agg, vals, tss, sels[i]), "%s bucket %d mismatch", name, i);
+  }
+}
+
+int main() {
   {
-    AvgAggregate<double> avg;
-    MaxAggreate<double> max;
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+    std::mt19937 rng(2023);
+    std::vector<int> ints;
+    std::vector<double> doubles;
+    for (int i = 0; i < 100; i++) {
+      ints.push_back(rng() % 20);
+      doubles.push_back((rng() % 80) / 4.0);
+    }
+    CompareExpression int_cmp{ColumnValue(10), GREATER};
+    CompareExpression double_cmp{ColumnValue(7.5), EQUAL};
+    checkBucketAgg<AvgOp<int>, NoFilter<int>>(AVG, "AVG", ints, nullptr);
+    checkBucketAgg<MaxOp<int>, GreaterFilter<int>>(MAX, "MAX", ints, &int_cmp);
+    checkBucketAgg<MinOp<int>, GreaterFilter<int>>(MIN, "MIN", ints, &int_cmp);
+    checkBucketAgg<SumOp<int>, GreaterFilter<int>>(SUM, "SUM", ints, &int_cmp);
+    checkBucketAgg<CountOp<int>, NoFilter<int>>(COUNT, "COUNT", ints, nullptr);
+    checkBucketAgg<FirstOp<int>, GreaterFilter<int>>(FIRST, "FIRST", ints, &int_cmp);
+    checkBucketAgg<LastOp<int>, NoFilter<int>>(LAST, "LAST", ints, nullptr);
+    checkBucketAgg<AvgOp<double>, EqualFilter<double>>(AVG, "AVG", doubles, &double_cmp);
+    checkBucketAgg<MaxOp<double>, NoFilter<double>>(MAX, "MAX", doubles, nullptr);
+    checkBucketAgg<MinOp<double>, EqualFilter<double>>(MIN, "MIN", doubles, &double_cmp);
+    checkBucketAgg<SumOp<double>, NoFilter<double>>(SUM, "SUM", doubles, nullptr);
+    checkBucketAgg<CountOp<double>, EqualFilter<double>>(COUNT, "COUNT", doubles, &double_cmp);
+    checkBucketAgg<FirstOp<double>, NoFilter<double>>(FIRST, "FIRST", doubles, nullptr);
+    checkBucketAgg<LastOp<double>, EqualFilter<double>>(LAST, "LAST", doubles, &double_cmp);
+    std::cout << "bucket agg passed" << std::endl;
   }
   {
-    std::vector<double> tmp{0, 1.2, 2.3, 3.4, 4.4, 5.5, 6.5, 7.8, 8.1, 9.1, 10.2};
-    AvgAggregate<double> avg(EQUAL, 1.2);
-    MaxAggreate<double> max(EQUAL, 1.2);
-    for (auto& item : tmp) {
-      avg.Add(item);
-    }
-
-    for (auto& item : tmp) {
-      max.Add(item);
-    }
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+    // 全部被过滤掉或者没有数据的桶：COUNT为0，其他为NaN
+    std::vector<int> ints{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    std::vector<double> doubles{0, 1.2, 2.3, 3.4, 4.4, 5.5, 6.5, 7.8, 8.1, 9.1, 10.2};
+    CompareExpression int_cmp{ColumnValue(11), GREATER};
+    CompareExpression double_cmp{ColumnValue(12.0), GREATER};
+    checkBucketAgg<AvgOp<int>, GreaterFilter<int>>(AVG, "AVG", ints, &int_cmp);
+    checkBucketAgg<MaxOp<int>, NoFilter<int>>(MAX, "MAX", ints, nullptr, 20);
+    checkBucketAgg<CountOp<int>, GreaterFilter<int>>(COUNT, "COUNT", ints, &int_cmp);
+    checkBucketAgg<FirstOp<int>, GreaterFilter<int>>(FIRST, "FIRST", ints, &int_cmp);
+    checkBucketAgg<SumOp<double>, GreaterFilter<double>>(SUM, "SUM", doubles, &double_cmp);
+    checkBucketAgg<MinOp<double>, NoFilter<double>>(MIN, "MIN", doubles, nullptr, 20);
+    checkBucketAgg<LastOp<double>, GreaterFilter<double>>(LAST, "LAST", doubles, &double_cmp);
+    std::cout << "empty bucket passed" << std::endl;
   }
   {
-    std::vector<double> tmp{0, 1.2, 2.3, 3.4, 4.4, 5.5, 6.5, 7.8, 8.1, 9.1, 10.2};
-    AvgAggregate<double> avg(GREATER, 8.1);
-    MaxAggreate<double> max(GREATER, 12);
-    for (auto& item : tmp) {
-      avg.Add(item);
-    }
-
-    for (auto& item : tmp) {
-      max.Add(item);
-    }
-    {
-      auto res = avg.GetResult();
-      std::cout << "AVG : " << res << std::endl;
-    }
-    {
-      auto res = max.GetResult();
-      std::cout << "MAX : " << res << std::endl;
-    }
+    // COUNT的结果是32位的，超出范围时截断
+    CountOp<int>::State cnt_state;
+    cnt_state.Init(1);
+    cnt_state.cnt[0] = (int64_t)std::numeric_limits<int>::max() + 5;
+    int cnt_res;
+    CountOp<int>::Result(cnt_state, 0).getIntegerValue(cnt_res);
+    ASSERT(cnt_res == std::numeric_limits<int>::max(), "COUNT should saturate, got %d", cnt_res);
   }
   return 0;
-}
\ No newline at end of file
+}
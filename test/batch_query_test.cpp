@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TSDBEngineImpl.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+/**
+ * 批量查询和逐个vin的单个查询返回同样的结果
+ */
+
+static const int kVins = 64;
+static const int kRows = 600;
+static const int64_t kStep = 1000;
+
+static Vin vins[kVins + 1]; // 最后一个没有写入
+
+// 一个vin的结果按时间戳索引，单个查询和批量查询都不保证同一个vin中行的顺序
+static std::map<int64_t, const Row*> byTs(const Row* begin, const Row* end) {
+  std::map<int64_t, const Row*> res;
+  for (auto row = begin; row != end; ++row) {
+    res[row->timestamp] = row;
+  }
+  return res;
+}
+
+static void checkTimeRangeBatch(TSDBEngineImpl* engine, std::mt19937_64& rng, const char* phase) {
+  for (int round = 0; round < 50; round++) {
+    TimeRangeBatchQueryRequest req;
+    req.tableName = "t1";
+    req.timeLowerBound = (int64_t)(rng() % (kRows * kStep));
+    req.timeUpperBound = req.timeLowerBound + (int64_t)(rng() % (kRows * kStep / 2));
+    if (round % 2 == 0) req.requestedColumns = {"ci", "cs"};
+    int n = rng() % (2 * kVins) + 1;
+    for (int i = 0; i < n; i++) {
+      req.vins.push_back(vins[rng() % (kVins + 1)]);
+    }
+
+    std::vector<Row> batch;
+    engine->executeTimeRangeBatchQuery(req, batch);
+    // 结果按请求中vin的顺序排列
+    size_t pos = 0;
+    for (auto& vin : req.vins) {
+      TimeRangeQueryRequest single;
+      single.tableName = "t1";
+      single.vin = vin;
+      single.timeLowerBound = req.timeLowerBound;
+      single.timeUpperBound = req.timeUpperBound;
+      single.requestedColumns = req.requestedColumns;
+      std::vector<Row> expect;
+      engine->executeTimeRangeQuery(single, expect);
+
+      ASSERT(pos + expect.size() <= batch.size(), "%s batch has too few rows", phase);
+      auto got = byTs(batch.data() + pos, batch.data() + pos + expect.size());
+      ASSERT(got.size() == expect.size(), "%s rows of a vin are not contiguous", phase);
+      for (auto& row : expect) {
+        auto iter = got.find(row.timestamp);
+        ASSERT(iter != got.end(), "%s ts %ld missing", phase, row.timestamp);
+        ASSERT(iter->second->vin == row.vin && iter->second->columns == row.columns, "%s ts %ld mismatch", phase,
+               row.timestamp);
+      }
+      pos += expect.size();
+    }
+    ASSERT(pos == batch.size(), "%s batch rows expect %zu, got %zu", phase, pos, batch.size());
+  }
+  OUTPUT("%s: time range batch passed\n", phase);
+}
+
+// 同一个vid的项在batch中按block完成的顺序累加，double的和只要求相对误差足够小
+static bool sameValue(const ColumnValue& a, const ColumnValue& b) {
+  if (a.getColumnType() != COLUMN_TYPE_DOUBLE_FLOAT || b.getColumnType() != COLUMN_TYPE_DOUBLE_FLOAT) {
+    return a == b;
+  }
+  double x, y;
+  a.getDoubleFloatValue(x);
+  b.getDoubleFloatValue(y);
+  // 没有满足过滤条件的行时是NaN或者inf
+  if (x == y || (std::isnan(x) && std::isnan(y))) return true;
+  return std::fabs(x - y) <= 1e-9 * std::max(1.0, std::fabs(y));
+}
+
+static void checkAggRows(const std::vector<Row>& expect, const std::vector<Row>& got, const char* what) {
+  ASSERT(expect.size() == got.size(), "%s rows expect %zu, got %zu", what, expect.size(), got.size());
+  for (size_t i = 0; i < expect.size(); i++) {
+    ASSERT(expect[i].vin == got[i].vin && expect[i].timestamp == got[i].timestamp, "%s row %zu key mismatch", what,
+           i);
+    ASSERT(expect[i].columns.size() == 1 && got[i].columns.size() == 1, "%s row %zu column num", what, i);
+    auto& e = *expect[i].columns.begin();
+    auto& g = *got[i].columns.begin();
+    ASSERT(e.first == g.first && sameValue(e.second, g.second), "%s row %zu ts %ld value mismatch", what, i,
+           expect[i].timestamp);
+  }
+}
+
+static const char* kCols[] = {"ci", "cd", "cs"};
+
+static void randomItem(std::mt19937_64& rng, AggregationItem& item) {
+  item.vin = vins[rng() % (kVins + 1)];
+  item.columnName = kCols[rng() % 2];
+  item.aggregator = (Aggregator)(rng() % 7);
+}
+
+static void checkAggregateBatch(TSDBEngineImpl* engine, std::mt19937_64& rng, const char* phase) {
+  for (int round = 0; round < 50; round++) {
+    TimeRangeAggregationBatchRequest req;
+    req.tableName = "t1";
+    req.timeLowerBound = (int64_t)(rng() % (kRows * kStep)) - kStep;
+    req.timeUpperBound = req.timeLowerBound + (int64_t)(rng() % (kRows * kStep / 2)) + 1;
+    int n = rng() % (4 * kVins) + 1;
+    req.items.resize(n);
+    for (auto& item : req.items) {
+      randomItem(rng, item);
+    }
+
+    std::vector<std::vector<Row>> batch;
+    engine->executeAggregateBatchQuery(req, batch);
+    ASSERT(batch.size() == req.items.size(), "%s aggregate batch size mismatch", phase);
+    for (int i = 0; i < n; i++) {
+      TimeRangeAggregationRequest single;
+      single.tableName = "t1";
+      single.vin = req.items[i].vin;
+      single.columnName = req.items[i].columnName;
+      single.aggregator = req.items[i].aggregator;
+      single.timeLowerBound = req.timeLowerBound;
+      single.timeUpperBound = req.timeUpperBound;
+      std::vector<Row> expect;
+      engine->executeAggregateQuery(single, expect);
+      checkAggRows(expect, batch[i], "aggregate");
+    }
+  }
+  OUTPUT("%s: aggregate batch passed\n", phase);
+}
+
+static void checkDownsampleBatch(TSDBEngineImpl* engine, std::mt19937_64& rng, const char* phase) {
+  for (int round = 0; round < 50; round++) {
+    TimeRangeDownsampleBatchRequest req;
+    req.tableName = "t1";
+    req.timeLowerBound = (int64_t)(rng() % (kRows * kStep)) - kStep;
+    req.timeUpperBound = req.timeLowerBound + (int64_t)(rng() % (kRows * kStep / 2)) + 1;
+    req.interval = (int64_t)(rng() % 50 + 1) * kStep / 2;
+    int n = rng() % (4 * kVins) + 1;
+    req.items.resize(n);
+    for (auto& item : req.items) {
+      randomItem(rng, item);
+      item.columnFilter.compareOp = rng() % 2 == 0 ? GREATER : EQUAL;
+      if (item.columnName == "ci") {
+        item.columnFilter.value = ColumnValue((int)(rng() % 20) - 5);
+      } else {
+        item.columnFilter.value = ColumnValue((double)(rng() % 400) / 8);
+      }
+    }
+
+    std::vector<std::vector<Row>> batch;
+    engine->executeDownsampleBatchQuery(req, batch);
+    ASSERT(batch.size() == req.items.size(), "%s downsample batch size mismatch", phase);
+    for (int i = 0; i < n; i++) {
+      TimeRangeDownsampleRequest single;
+      single.tableName = "t1";
+      single.vin = req.items[i].vin;
+      single.columnName = req.items[i].columnName;
+      single.aggregator = req.items[i].aggregator;
+      single.columnFilter = req.items[i].columnFilter;
+      single.timeLowerBound = req.timeLowerBound;
+      single.timeUpperBound = req.timeUpperBound;
+      single.interval = req.interval;
+      std::vector<Row> expect;
+      engine->executeDownsampleQuery(single, expect);
+      checkAggRows(expect, batch[i], "downsample");
+    }
+  }
+  OUTPUT("%s: downsample batch passed\n", phase);
+}
+
+static void runChecks(TSDBEngineImpl* engine, const char* phase) {
+  std::mt19937_64 rng(7);
+  checkTimeRangeBatch(engine, rng, phase);
+  checkAggregateBatch(engine, rng, phase);
+  checkDownsampleBatch(engine, rng, phase);
+}
+
+int main() {
+  std::string dir = "/tmp/batch_query_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  setenv("LINDORM_MEMTABLE_ROW_NUM", "64", 1);
+
+  std::mt19937_64 rng(2023);
+  for (int v = 0; v <= kVins; v++) {
+    memset(vins[v].vin, 'a', VIN_LENGTH);
+    std::string s = std::to_string(v);
+    memcpy(vins[v].vin + VIN_LENGTH - s.size(), s.c_str(), s.size());
+  }
+
+  {
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    Schema schema;
+    schema.columnTypeMap["ci"] = COLUMN_TYPE_INTEGER;
+    schema.columnTypeMap["cd"] = COLUMN_TYPE_DOUBLE_FLOAT;
+    schema.columnTypeMap["cs"] = COLUMN_TYPE_STRING;
+    ASSERT(engine->createTable("t1", schema) == 0, "create table failed");
+
+    for (int v = 0; v < kVins; v++) {
+      for (int i = 0; i < kRows; i += 100) {
+        WriteRequest req;
+        req.tableName = "t1";
+        for (int j = i; j < i + 100; j++) {
+          Row row;
+          row.vin = vins[v];
+          row.timestamp = j * kStep;
+          row.columns.emplace("ci", ColumnValue((int)(rng() % 20) - 5));
+          row.columns.emplace("cd", ColumnValue((double)(rng() % 400) / 8));
+          row.columns.emplace("cs", ColumnValue(std::string(rng() % 8, 'x')));
+          req.rows.push_back(std::move(row));
+        }
+        engine->write(req);
+      }
+    }
+    runChecks(engine, "write phase");
+    engine->shutdown();
+    delete engine;
+  }
+  {
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    runChecks(engine, "read phase");
+    engine->shutdown();
+    delete engine;
+  }
+  {
+    // 一个调度线程上同时执行多个批量查询，vin的协程不能把协程池占满
+    setenv("LINDORM_WORKER_THREAD", "1", 1);
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    std::vector<std::thread> clients;
+    for (int c = 0; c < 8; c++) {
+      clients.emplace_back([engine, c]() {
+        std::mt19937_64 rng(c);
+        checkTimeRangeBatch(engine, rng, "concurrent");
+      });
+    }
+    for (auto& t : clients) {
+      t.join();
+    }
+    engine->shutdown();
+    delete engine;
+  }
+
+  OUTPUT("batch query test passed\n");
+  return 0;
+}
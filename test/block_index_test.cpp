@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "BlockMetaManager.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+static const int kColNum = 2;
+static const ColumnType kTypes[kColNum] = {COLUMN_TYPE_INTEGER, COLUMN_TYPE_DOUBLE_FLOAT};
+
+// 和逐个遍历的结果比较
+static void check(BlockMetaManager& mgr, const std::vector<BlockMeta*>& all, int64_t lower, int64_t upper) {
+  std::vector<BlockMeta*> expect;
+  for (auto meta : all) {
+    if (meta->max_ts >= lower && meta->min_ts < upper) {
+      expect.push_back(meta);
+    }
+  }
+  std::vector<BlockMeta*> got;
+  mgr.GetVinBlockMetasByTimeRange(0, lower, upper, got);
+  for (size_t i = 1; i < got.size(); i++) {
+    ASSERT(got[i - 1]->min_ts <= got[i]->min_ts, "result is not sorted by min_ts");
+  }
+  std::sort(expect.begin(), expect.end());
+  std::sort(got.begin(), got.end());
+  ASSERT(expect == got, "range [%ld, %ld) expect %zu blocks, got %zu", lower, upper, expect.size(), got.size());
+}
+
+int main() {
+  std::mt19937_64 rng(2023);
+  ColumnStats stat;
+  stat.Reset(kColNum);
+  BlockLayout layout;
+  layout.Build(kTypes, kColNum);
+  BlockMetaArena arena;
+
+  // 按时间顺序下刷，偶尔夹杂乱序和跨度很大的block
+  BlockMetaManager mgr(&layout, &arena);
+  std::vector<BlockMeta*> all;
+  int64_t ts = 0;
+  for (int i = 0; i < 5000; i++) {
+    int64_t min_ts, max_ts;
+    if (rng() % 10 == 0) {
+      min_ts = rng() % (ts + 1);
+      max_ts = min_ts + rng() % 500000;
+    } else {
+      min_ts = ts;
+      max_ts = ts + 255000;
+      ts = max_ts + 1000;
+    }
+    all.push_back(mgr.NewVinBlockMeta(1, min_ts, max_ts, stat));
+  }
+  ASSERT(mgr.BlockNum() == all.size(), "block num %zu", mgr.BlockNum());
+
+  for (int i = 0; i < 2000; i++) {
+    int64_t lower = rng() % (ts + 100000);
+    int64_t upper = lower + rng() % (i % 2 == 0 ? 60000 : 5000000);
+    check(mgr, all, lower, upper);
+  }
+  check(mgr, all, 0, INT64_MAX);
+  check(mgr, all, ts + 1000000, INT64_MAX);
+
+  // 完全乱序
+  BlockMetaManager shuffled(&layout, &arena);
+  std::vector<BlockMeta*> shuffled_all;
+  for (int i = 0; i < 2000; i++) {
+    int64_t min_ts = rng() % 1000000;
+    shuffled_all.push_back(shuffled.NewVinBlockMeta(1, min_ts, min_ts + rng() % 10000, stat));
+  }
+  for (int i = 0; i < 2000; i++) {
+    int64_t lower = rng() % 1000000;
+    check(shuffled, shuffled_all, lower, lower + rng() % 20000);
+  }
+
+  // 乱序下刷和查询交替，每次查询前归并之间到来的乱序block
+  BlockMetaManager interleaved(&layout, &arena);
+  std::vector<BlockMeta*> interleaved_all;
+  for (int i = 0; i < 3000; i++) {
+    int64_t min_ts = rng() % 3 == 0 ? rng() % 1000000 : i * 300;
+    interleaved_all.push_back(interleaved.NewVinBlockMeta(1, min_ts, min_ts + rng() % 10000, stat));
+    if (i % 7 == 0) {
+      int64_t lower = rng() % 1000000;
+      check(interleaved, interleaved_all, lower, lower + rng() % 20000);
+    }
+  }
+
+  // 完全倒序下刷大量block，每个都是乱序的，只在查询的时候归并一次，不会逐个插入成O(n^2)
+  BlockMetaManager reversed(&layout, &arena);
+  std::vector<BlockMeta*> reversed_all;
+  const int kReversed = 200000;
+  for (int i = kReversed; i > 0; i--) {
+    reversed_all.push_back(reversed.NewVinBlockMeta(1, (int64_t)i * 1000, (int64_t)i * 1000 + 999, stat));
+  }
+  for (int i = 0; i < 100; i++) {
+    int64_t lower = rng() % ((int64_t)kReversed * 1000);
+    check(reversed, reversed_all, lower, lower + rng() % 50000);
+  }
+
+  // manifest中映射的block分多段挂上，第一次查询时才建索引，之后还能继续下刷新的block
+  size_t stride = layout.Stride();
+  std::vector<char> mapped_buf(stride * 3000);
+  BlockMetaManager mapped(&layout, &arena);
+  std::vector<BlockMeta*> mapped_all;
+  for (int seg = 0, off = 0; seg < 6; seg++) {
+    int cnt = 500;
+    for (int i = 0; i < cnt; i++) {
+      auto meta = reinterpret_cast<BlockMeta*>(mapped_buf.data() + (off + i) * stride);
+      meta->num = 1;
+      meta->column_num = kColNum;
+      meta->min_ts = rng() % 4 == 0 ? rng() % 1000000 : (seg * cnt + i) * 200;
+      meta->max_ts = meta->min_ts + rng() % 10000;
+      mapped_all.push_back(meta);
+    }
+    mapped.AddMapped(mapped_buf.data() + off * stride, cnt);
+    off += cnt;
+  }
+  ASSERT(mapped.BlockNum() == mapped_all.size(), "mapped block num %zu", mapped.BlockNum());
+  for (int i = 0; i < 1000; i++) {
+    int64_t lower = rng() % 1000000;
+    check(mapped, mapped_all, lower, lower + rng() % 20000);
+    if (i % 10 == 0) {
+      int64_t min_ts = rng() % 1000000;
+      mapped_all.push_back(mapped.NewVinBlockMeta(1, min_ts, min_ts + rng() % 10000, stat));
+    }
+  }
+  ASSERT(mapped.BlockNum() == mapped_all.size(), "mapped block num %zu", mapped.BlockNum());
+
+  OUTPUT("block index test passed\n");
+  return 0;
+}
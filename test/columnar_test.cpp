@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TSDBEngineImpl.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+/**
+ * 列式的time range查询和按行的executeTimeRangeQuery返回同样的数据
+ * memtable设置得比较小，查询范围覆盖整个block、部分block以及写阶段还在memtable中的行
+ */
+
+static const int kVins = 4;
+static const int kRows = 1000;
+static const int64_t kStep = 1000;
+
+static Vin vins[kVins];
+
+static void checkLayout(const ColumnBuffer& col, size_t rows) {
+  ASSERT(col.offsets.size() == rows + 1, "column %s offsets %zu, rows %zu", col.name.c_str(), col.offsets.size(),
+         rows);
+  ASSERT(col.offsets[0] == 0 && col.offsets.back() == col.bytes.size(), "column %s offsets do not cover bytes",
+         col.name.c_str());
+  for (size_t i = 0; i < rows; i++) {
+    ASSERT(col.offsets[i] <= col.offsets[i + 1], "column %s offsets not sorted at %zu", col.name.c_str(), i);
+  }
+}
+
+// batch中的第i行和row一致
+static void checkRow(const ColumnBatch& batch, size_t i, const Row& row) {
+  for (auto& col : batch.columns) {
+    auto iter = row.columns.find(col.name);
+    ASSERT(iter != row.columns.end(), "column %s missing in row", col.name.c_str());
+    switch (col.type) {
+      case COLUMN_TYPE_INTEGER: {
+        int32_t v;
+        iter->second.getIntegerValue(v);
+        ASSERT(col.ints[i] == v, "ts %ld column %s expect %d, got %d", row.timestamp, col.name.c_str(), v,
+               col.ints[i]);
+        break;
+      }
+      case COLUMN_TYPE_DOUBLE_FLOAT: {
+        double v;
+        iter->second.getDoubleFloatValue(v);
+        ASSERT(col.doubles[i] == v, "ts %ld column %s expect %f, got %f", row.timestamp, col.name.c_str(), v,
+               col.doubles[i]);
+        break;
+      }
+      case COLUMN_TYPE_STRING: {
+        std::pair<int32_t, const char*> v;
+        iter->second.getStringValue(v);
+        auto got = col.GetString(i);
+        ASSERT(got.first == v.first && memcmp(got.second, v.second, v.first) == 0, "ts %ld column %s mismatch",
+               row.timestamp, col.name.c_str());
+        break;
+      }
+      default:
+        ASSERT(false, "column %s uninitialized", col.name.c_str());
+    }
+  }
+}
+
+static void runChecks(TSDBEngineImpl* engine, const char* phase) {
+  std::mt19937_64 rng(7);
+  const std::vector<std::set<std::string>> col_sets = {{}, {"ci"}, {"cd", "cs"}, {"cs"}, {"ci", "cd", "cs"}};
+  int checks = 0;
+  for (int round = 0; round < 400; round++) {
+    TimeRangeQueryRequest req;
+    req.tableName = "t1";
+    req.vin = vins[rng() % kVins];
+    if (round % 10 == 0) {
+      // 覆盖所有block
+      req.timeLowerBound = -kStep;
+      req.timeUpperBound = (kRows + 1) * kStep;
+    } else {
+      req.timeLowerBound = (int64_t)(rng() % (kRows * kStep));
+      req.timeUpperBound = req.timeLowerBound + (int64_t)(rng() % (kRows * kStep / 4));
+    }
+    req.requestedColumns = col_sets[rng() % col_sets.size()];
+
+    std::vector<Row> rows;
+    engine->executeTimeRangeQuery(req, rows);
+    ColumnBatch batch;
+    engine->executeTimeRangeQueryColumnar(req, batch);
+
+    ASSERT(batch.RowNum() == rows.size(), "%s rows expect %zu, got %zu", phase, rows.size(), batch.RowNum());
+    ASSERT(memcmp(batch.vin.vin, req.vin.vin, VIN_LENGTH) == 0, "%s vin mismatch", phase);
+    size_t col_num = req.requestedColumns.empty() ? 3 : req.requestedColumns.size();
+    ASSERT(batch.columns.size() == col_num, "%s columns expect %zu, got %zu", phase, col_num, batch.columns.size());
+    for (auto& col : batch.columns) {
+      if (col.type == COLUMN_TYPE_STRING) checkLayout(col, batch.RowNum());
+    }
+    // 两种查询都不保证行的顺序，时间戳在一个vin中是唯一的
+    std::map<int64_t, const Row*> by_ts;
+    for (auto& row : rows) {
+      by_ts[row.timestamp] = &row;
+    }
+    for (size_t i = 0; i < batch.RowNum(); i++) {
+      auto iter = by_ts.find(batch.timestamps[i]);
+      ASSERT(iter != by_ts.end(), "%s ts %ld not in row result", phase, batch.timestamps[i]);
+      checkRow(batch, i, *iter->second);
+      checks++;
+    }
+  }
+  OUTPUT("%s: %d rows checked\n", phase, checks);
+}
+
+int main() {
+  std::string dir = "/tmp/columnar_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  // 小的memtable，一个vin有很多block
+  setenv("LINDORM_MEMTABLE_ROW_NUM", "64", 1);
+
+  std::mt19937_64 rng(2023);
+  for (int v = 0; v < kVins; v++) {
+    memset(vins[v].vin, 'a' + v, VIN_LENGTH);
+  }
+
+  {
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    Schema schema;
+    schema.columnTypeMap["ci"] = COLUMN_TYPE_INTEGER;
+    schema.columnTypeMap["cd"] = COLUMN_TYPE_DOUBLE_FLOAT;
+    schema.columnTypeMap["cs"] = COLUMN_TYPE_STRING;
+    ASSERT(engine->createTable("t1", schema) == 0, "create table failed");
+
+    for (int v = 0; v < kVins; v++) {
+      std::vector<int64_t> tss(kRows);
+      for (int i = 0; i < kRows; i++) tss[i] = i * kStep;
+      std::shuffle(tss.begin(), tss.end(), rng);
+      for (int i = 0; i < kRows; i += 50) {
+        WriteRequest req;
+        req.tableName = "t1";
+        for (int j = i; j < i + 50; j++) {
+          Row row;
+          row.vin = vins[v];
+          row.timestamp = tss[j];
+          row.columns.emplace("ci", ColumnValue((int)(rng() % 1000) - 500));
+          row.columns.emplace("cd", ColumnValue((double)(rng() % 10000) / 16));
+          // 包括空串
+          row.columns.emplace("cs", ColumnValue(std::string(rng() % 20, 'a' + j % 26)));
+          req.rows.push_back(std::move(row));
+        }
+        engine->write(req);
+      }
+    }
+    runChecks(engine, "write phase");
+    engine->shutdown();
+    delete engine;
+  }
+  {
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    runChecks(engine, "read phase");
+    engine->shutdown();
+    delete engine;
+  }
+
+  OUTPUT("columnar test passed\n");
+  return 0;
+}
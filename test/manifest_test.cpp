@@ -0,0 +1,190 @@
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "manifest.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+static const int kColNum = 3;
+static const ColumnType kTypes[kColNum] = {COLUMN_TYPE_INTEGER, COLUMN_TYPE_DOUBLE_FLOAT, COLUMN_TYPE_STRING};
+
+static void makeVin(int i, char* vin) {
+  memset(vin, 'L', VIN_LENGTH);
+  std::string s = std::to_string(i);
+  memcpy(vin + VIN_LENGTH - s.size(), s.c_str(), s.size());
+}
+
+// 和MemTable一样，统计值按uint64_t存放
+template <typename T>
+static uint64_t stat(T val) {
+  uint64_t res = 0;
+  memcpy(&res, &val, sizeof(val));
+  return res;
+}
+
+// 第edit次编辑中vid的第i个block
+static void fillBlocks(BlockMetaManager& mgr, int edit, int vid, int cnt) {
+  ColumnStats stats;
+  stats.Reset(kColNum);
+  for (int i = 0; i < cnt; i++) {
+    stats.max_val[0] = stat<int>(edit * 1000 + vid * 10);
+    stats.min_val[0] = stat<int>(-vid);
+    stats.first_val[0] = stat<int>(i);
+    stats.last_val[0] = stat<int>(i + 1);
+    stats.sum_val[0] = stat<int64_t>(-(int64_t)(edit * 1000 + vid * 10));
+    stats.max_val[1] = stat<double>(edit * 1000 + vid * 10 + 0.5);
+    stats.min_val[1] = stat<double>(-0.5);
+    stats.first_val[1] = stat<double>(i * 0.5);
+    stats.last_val[1] = stat<double>(i * 1.5);
+    stats.sum_val[1] = stat<double>(vid * 0.25);
+    auto meta = mgr.NewVinBlockMeta(i + 1, edit * 100000 + vid * 100 + i, edit * 100000 + vid * 100 + i + 1, stats);
+    meta->segment = edit;
+    meta->base_off = (uint64_t)vid << 32;
+    for (int k = 0; k <= kColNum; k++) {
+      meta->SetExtent(k, meta->base_off + i * 4096 + k, k + 1);
+    }
+  }
+}
+
+int main() {
+  std::string dir = "/tmp/manifest_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::string filename = dir + "/test.manifest";
+  BlockLayout layout;
+  layout.Build(kTypes, kColNum);
+  BlockMetaArena arena;
+
+  constexpr int kEdit = 3;
+  constexpr int kVinPerEdit = 10;
+  uint64_t prev_footer = Manifest::kNoPrev;
+  for (int e = 0; e < kEdit; e++) {
+    Manifest prev;
+    ASSERT(prev.Open(filename) == (e > 0), "open before edit %d", e);
+    ASSERT(e == 0 || prev.LastOffset() == prev_footer, "last footer before edit %d", e);
+    ManifestEditBuilder builder(layout, e * kVinPerEdit);
+    char vin[VIN_LENGTH];
+    for (int i = 0; i < kVinPerEdit; i++) {
+      makeVin(e * kVinPerEdit + i, vin);
+      builder.AddVin(vin);
+    }
+    // 每次编辑给之前所有的vid都追加一些block，并更新最新行
+    std::vector<BlockMetaManager> mgrs(kVinPerEdit * (e + 1), BlockMetaManager(&layout, &arena));
+    std::vector<BlockMeta*> blocks;
+    for (int vid = 0; vid < (e + 1) * kVinPerEdit; vid++) {
+      fillBlocks(mgrs[vid], e, vid, vid % 4);
+      mgrs[vid].TakeUnpersisted(blocks);
+      builder.AddBlocks(vid, blocks);
+      // 取出之后不会再出现在下一次编辑中
+      mgrs[vid].TakeUnpersisted(blocks);
+      ASSERT(blocks.empty(), "vid %d blocks are taken twice", vid);
+      std::vector<ColumnValue> cols;
+      cols.emplace_back(vid + e);
+      cols.emplace_back(vid * 0.5);
+      cols.emplace_back(std::string(vid % 7, 'a' + e));
+      builder.AddLatestRow(vid, e * 1000 + vid, cols);
+    }
+    prev_footer = builder.AppendTo(filename, prev_footer, e + 1, e == kEdit - 1 ? Manifest::kClosed : 0);
+  }
+
+  Manifest manifest;
+  ASSERT(manifest.Open(filename), "open manifest");
+  ASSERT(manifest.Edits().size() == kEdit, "edits %zu", manifest.Edits().size());
+  std::vector<BlockMetaManager> mgrs(kEdit * kVinPerEdit, BlockMetaManager(&layout, &arena));
+  std::vector<int64_t> latest_ts(kEdit * kVinPerEdit, -1);
+  std::vector<std::vector<ColumnValue>> latest(kEdit * kVinPerEdit);
+  int vin_num = 0;
+  for (int e = 0; e < kEdit; e++) {
+    auto& edit = manifest.Edits()[e];
+    ASSERT(edit.footer->first_vid == (uint32_t)vin_num, "first vid %u", edit.footer->first_vid);
+    ASSERT(edit.footer->wal_gen == (uint32_t)e + 1, "wal gen %u", edit.footer->wal_gen);
+    ASSERT(edit.footer->flags == (e == kEdit - 1 ? Manifest::kClosed : 0), "flags %u", edit.footer->flags);
+    char vin[VIN_LENGTH];
+    for (uint32_t i = 0; i < edit.footer->vin_cnt; i++) {
+      makeVin(vin_num + i, vin);
+      ASSERT(memcmp(edit.vins + i * VIN_LENGTH, vin, VIN_LENGTH) == 0, "vin %d", vin_num + i);
+    }
+    vin_num += edit.footer->vin_cnt;
+    for (uint32_t i = 0; i < edit.footer->block_index_cnt; i++) {
+      mgrs[edit.blocks[i].vid].AddMapped(manifest.At(edit.blocks[i].off), edit.blocks[i].cnt);
+    }
+    for (uint32_t i = 0; i < edit.footer->latest_cnt; i++) {
+      auto& idx = edit.latest[i];
+      latest_ts[idx.vid] = DecodeLatestRow(manifest.At(idx.off), kColNum, kTypes, latest[idx.vid]);
+    }
+  }
+  ASSERT(vin_num == kEdit * kVinPerEdit, "vin num %d", vin_num);
+
+  std::vector<BlockMeta*> metas;
+  for (int vid = 0; vid < vin_num; vid++) {
+    mgrs[vid].GetVinBlockMetasByTimeRange(vid, 0, INT64_MAX, metas);
+    int first_edit = vid / kVinPerEdit;
+    ASSERT(metas.size() == (size_t)(vid % 4) * (kEdit - first_edit), "vid %d has %zu blocks", vid, metas.size());
+    for (auto meta : metas) {
+      int e = meta->min_ts / 100000;
+      int i = meta->num - 1;
+      ASSERT(meta->min_ts == e * 100000 + vid * 100 + i, "vid %d min_ts %ld", vid, meta->min_ts);
+      ASSERT(meta->segment == (uint32_t)e, "vid %d segment", vid);
+      ASSERT(layout.Max<int>(meta, 0) == e * 1000 + vid * 10, "vid %d int max", vid);
+      ASSERT(layout.Sum<int64_t>(meta, 0) == -(int64_t)(e * 1000 + vid * 10), "vid %d int sum", vid);
+      ASSERT(layout.Max<double>(meta, 1) == e * 1000 + vid * 10 + 0.5, "vid %d double max", vid);
+      ASSERT(layout.Sum<double>(meta, 1) == vid * 0.25, "vid %d double sum", vid);
+      ASSERT(layout.Min<int>(meta, 0) == -vid && layout.Min<double>(meta, 1) == -0.5, "vid %d min", vid);
+      ASSERT(layout.First<int>(meta, 0) == i && layout.Last<int>(meta, 0) == i + 1, "vid %d int first/last", vid);
+      ASSERT(layout.First<double>(meta, 1) == i * 0.5 && layout.Last<double>(meta, 1) == i * 1.5,
+             "vid %d double first/last", vid);
+      ASSERT(!layout.HasStat(2), "string column should have no stat");
+      ASSERT(meta->Offset(kColNum) == ((uint64_t)vid << 32) + i * 4096 + kColNum, "vid %d offset", vid);
+      ASSERT(meta->CompressSz(2) == 3, "vid %d compress_sz", vid);
+    }
+
+    // 最新行以最后一次编辑为准
+    ASSERT(latest_ts[vid] == (kEdit - 1) * 1000 + vid, "vid %d latest ts %ld", vid, latest_ts[vid]);
+    int32_t ival;
+    latest[vid][0].getIntegerValue(ival);
+    ASSERT(ival == vid + kEdit - 1, "vid %d latest int", vid);
+    std::pair<int32_t, const char*> str{0, nullptr};
+    latest[vid][2].getStringValue(str);
+    ASSERT(str.first == vid % 7, "vid %d latest string", vid);
+  }
+
+  // 最后一次编辑没有写完整，以之前完整的编辑为准，下一次追加的时候截掉
+  {
+    AppendWriteFile file(filename, NORMAL_FLAG);
+    std::string garbage(sizeof(Manifest::Footer) * 3 + 8, '\1');
+    file.write(garbage.data(), garbage.size());
+  }
+  Manifest torn;
+  ASSERT(torn.Open(filename), "open torn manifest");
+  ASSERT(torn.Edits().size() == kEdit && torn.LastOffset() == prev_footer, "torn manifest edits %zu",
+         torn.Edits().size());
+  torn.Close();
+  {
+    ManifestEditBuilder builder(layout, kEdit * kVinPerEdit);
+    prev_footer = builder.AppendTo(filename, prev_footer, kEdit + 1, 0);
+  }
+  ASSERT(torn.Open(filename), "open manifest after torn edit");
+  ASSERT(torn.Edits().size() == kEdit + 1 && torn.LastOffset() == prev_footer &&
+           torn.Edits()[kEdit - 1].footer->flags == Manifest::kClosed,
+         "edits after torn edit %zu", torn.Edits().size());
+  ASSERT(std::filesystem::file_size(filename) == prev_footer + sizeof(Manifest::Footer), "torn edit is not truncated");
+  torn.Close();
+
+  // 一个完整的编辑都没有
+  std::filesystem::resize_file(filename, sizeof(Manifest::Footer) * 2);
+  {
+    AppendWriteFile file(filename, NORMAL_FLAG);
+    std::string garbage(sizeof(Manifest::Footer) * 3, '\1');
+    file.write(garbage.data(), garbage.size());
+  }
+  Manifest broken;
+  ASSERT(!broken.Open(filename), "broken manifest should not open");
+
+  manifest.Close();
+  std::filesystem::remove_all(dir);
+  OUTPUT("manifest test passed\n");
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TSDBEngineImpl.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+/**
+ * 读缓存很小、并发扫描的预读量加起来超过缓存的时候，多block的扫描不会卡死，结果也是对的
+ */
+
+static const int kVins = 64;
+static const int kRows = 64 * 24; // 每个vin 24个block
+static const int64_t kStep = 1000;
+
+static Vin vins[kVins];
+
+static void scan(TSDBEngineImpl* engine) {
+  std::mt19937_64 rng(2023);
+  for (int round = 0; round < 20; round++) {
+    TimeRangeBatchQueryRequest req;
+    req.tableName = "t1";
+    req.timeLowerBound = (int64_t)(rng() % (kRows / 4)) * kStep;
+    req.timeUpperBound = req.timeLowerBound + (int64_t)(kRows / 2 + rng() % (kRows / 4)) * kStep;
+    for (int i = 0; i < kVins; i++) {
+      req.vins.push_back(vins[(i + round) % kVins]);
+    }
+
+    std::vector<Row> batch;
+    engine->executeTimeRangeBatchQuery(req, batch);
+    size_t expect = kVins * (size_t)((req.timeUpperBound - req.timeLowerBound) / kStep);
+    ASSERT(batch.size() == expect, "round %d rows expect %zu, got %zu", round, expect,
+           batch.size());
+    for (auto& row : batch) {
+      int64_t idx = row.timestamp / kStep;
+      int vin = std::stoi(std::string(row.vin.vin + VIN_LENGTH - 2, 2));
+      int ci;
+      row.columns.at("ci").getIntegerValue(ci);
+      ASSERT(ci == (int)(idx * kVins + vin), "ts %ld ci mismatch", row.timestamp);
+    }
+  }
+}
+
+int main() {
+  std::string dir = "/tmp/readahead_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  setenv("LINDORM_MEMTABLE_ROW_NUM", "64", 1);
+  setenv("LINDORM_SHARD_BITS", "1", 1);
+  setenv("LINDORM_WORKER_THREAD", "1", 1);
+  setenv("LINDORM_COROUTINE_PER_THREAD", "32", 1);
+
+  for (int v = 0; v < kVins; v++) {
+    memset(vins[v].vin, 'a', VIN_LENGTH);
+    std::string s = std::to_string(v + 10);
+    memcpy(vins[v].vin + VIN_LENGTH - s.size(), s.c_str(), s.size());
+  }
+
+  {
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    Schema schema;
+    schema.columnTypeMap["ci"] = COLUMN_TYPE_INTEGER;
+    schema.columnTypeMap["cd"] = COLUMN_TYPE_DOUBLE_FLOAT;
+    ASSERT(engine->createTable("t1", schema) == 0, "create table failed");
+
+    for (int v = 0; v < kVins; v++) {
+      WriteRequest req;
+      req.tableName = "t1";
+      for (int i = 0; i < kRows; i++) {
+        Row row;
+        row.vin = vins[v];
+        row.timestamp = i * kStep;
+        row.columns.emplace("ci", ColumnValue((int)(i * kVins + v + 10)));
+        row.columns.emplace("cd", ColumnValue((double)i / 8));
+        req.rows.push_back(std::move(row));
+      }
+      engine->write(req);
+    }
+    engine->shutdown();
+    delete engine;
+  }
+
+  {
+    // 一个block的两列加时间戳大约1.3K，缓存能放下协程池里所有处理block的协程，
+    // 但是批量查询在一个调度线程上同时扫描8个vin，每个预读1/4的缓存，加起来远远超过缓存
+    setenv("LINDORM_READ_CACHE_SIZE", "48K", 1);
+    auto engine = new TSDBEngineImpl(dir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    alarm(120); // 卡死的时候直接失败
+    scan(engine);
+    alarm(0);
+    engine->shutdown();
+    delete engine;
+  }
+
+  OUTPUT("readahead test passed\n");
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "TSDBEngineImpl.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+/**
+ * 子进程写入之后不shutdown直接退出，模拟崩溃，下一次connect从日志恢复
+ * 连续崩溃两次，恢复的时候有两代日志；最后正常shutdown，读阶段的数据和写入的一致
+ * 第二轮把checkpoint的阈值调得很小，写入过程中不断checkpoint，崩溃之后只剩最新的日志，从manifest和它恢复
+ */
+
+static std::string kDir;
+static const int kVins = 8;
+static const int kRowsPerCrash = 500;
+static const int kCrashes = 2;
+static const int64_t kStep = 1000;
+
+static Vin makeVin(int v) {
+  Vin vin;
+  memset(vin.vin, 'r', VIN_LENGTH);
+  vin.vin[VIN_LENGTH - 1] = 'a' + v;
+  return vin;
+}
+
+static Row makeRow(int v, int i) {
+  Row row;
+  row.vin = makeVin(v);
+  row.timestamp = i * kStep;
+  row.columns.emplace("ci", ColumnValue(v * 100000 + i));
+  row.columns.emplace("cd", ColumnValue(i * 0.25 + v));
+  row.columns.emplace("cs", ColumnValue(std::string(i % 7, 'a' + v)));
+  return row;
+}
+
+// 第crash次崩溃之前写入[crash * kRowsPerCrash, (crash + 1) * kRowsPerCrash)
+static void writeAndCrash(int crash) {
+  pid_t pid = fork();
+  ASSERT(pid >= 0, "fork failed");
+  if (pid == 0) {
+    auto engine = new TSDBEngineImpl(kDir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    Schema schema;
+    schema.columnTypeMap["ci"] = COLUMN_TYPE_INTEGER;
+    schema.columnTypeMap["cd"] = COLUMN_TYPE_DOUBLE_FLOAT;
+    schema.columnTypeMap["cs"] = COLUMN_TYPE_STRING;
+    ASSERT(engine->createTable("t1", schema) == 0, "create table failed");
+    for (int i = crash * kRowsPerCrash; i < (crash + 1) * kRowsPerCrash; i += 50) {
+      WriteRequest req;
+      req.tableName = "t1";
+      for (int v = 0; v < kVins; v++) {
+        for (int j = i; j < i + 50; j++) {
+          req.rows.push_back(makeRow(v, j));
+        }
+      }
+      engine->write(req);
+    }
+    // 不shutdown，write返回的行都已经在日志中落盘
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "writer %d failed", crash);
+}
+
+static void check(TSDBEngineImpl* engine, const char* phase) {
+  int rows_num = kCrashes * kRowsPerCrash;
+  for (int v = 0; v < kVins; v++) {
+    TimeRangeQueryRequest req;
+    req.tableName = "t1";
+    req.vin = makeVin(v);
+    req.timeLowerBound = 0;
+    req.timeUpperBound = rows_num * kStep;
+    std::vector<Row> rows;
+    engine->executeTimeRangeQuery(req, rows);
+    ASSERT(rows.size() == (size_t)rows_num, "%s vin %d expect %d rows, got %zu", phase, v, rows_num, rows.size());
+    std::vector<bool> seen(rows_num, false);
+    for (auto& row : rows) {
+      int i = row.timestamp / kStep;
+      ASSERT(i >= 0 && i < rows_num && !seen[i], "%s vin %d invalid ts %ld", phase, v, row.timestamp);
+      seen[i] = true;
+      ASSERT(row.columns == makeRow(v, i).columns, "%s vin %d ts %ld mismatch", phase, v, row.timestamp);
+    }
+
+    LatestQueryRequest latest_req;
+    latest_req.tableName = "t1";
+    latest_req.vins.push_back(makeVin(v));
+    std::vector<Row> latest;
+    engine->executeLatestQuery(latest_req, latest);
+    ASSERT(latest.size() == 1 && latest[0].timestamp == (rows_num - 1) * kStep, "%s vin %d latest mismatch", phase,
+           v);
+  }
+  OUTPUT("%s: %d rows of %d vins checked\n", phase, rows_num, kVins);
+}
+
+// checkpoint之后旧的日志都删掉了，manifest中有checkpoint的编辑。
+// checkpoint在后台线程上做，崩溃的时候可能刚切换到新的日志、还没有删除旧的，这时有两代
+static void checkTruncated() {
+  std::set<uint32_t> gens;
+  for (auto& entry : std::filesystem::directory_iterator(kDir)) {
+    std::string name = entry.path().filename().string();
+    uint32_t gen = 0;
+    int tid = 0;
+    if (entry.path().extension() == ".wal" && sscanf(name.c_str(), "only_one_%u_%d.wal", &gen, &tid) == 2) {
+      gens.insert(gen);
+    }
+  }
+  ASSERT(gens.size() == 1 || (gens.size() == 2 && *gens.rbegin() == *gens.begin() + 1),
+         "expect at most 2 adjacent wal generations, got %zu", gens.size());
+  ASSERT(std::filesystem::exists(kDir + "/only_one.manifest"), "manifest is not written by checkpoint");
+}
+
+// 已有的表再次createTable，schema一致的时候成功，列数、列名或者类型不一致的时候失败
+static void checkCreateTable(TSDBEngineImpl* engine, const char* phase) {
+  Schema schema;
+  schema.columnTypeMap["ci"] = COLUMN_TYPE_INTEGER;
+  schema.columnTypeMap["cd"] = COLUMN_TYPE_DOUBLE_FLOAT;
+  schema.columnTypeMap["cs"] = COLUMN_TYPE_STRING;
+  ASSERT(engine->createTable("t1", schema) == 0, "%s same schema should be accepted", phase);
+
+  Schema wrong_type = schema;
+  wrong_type.columnTypeMap["ci"] = COLUMN_TYPE_DOUBLE_FLOAT;
+  ASSERT(engine->createTable("t1", wrong_type) != 0, "%s column type mismatch accepted", phase);
+
+  Schema more = schema;
+  more.columnTypeMap["cx"] = COLUMN_TYPE_INTEGER;
+  ASSERT(engine->createTable("t1", more) != 0, "%s column num mismatch accepted", phase);
+
+  Schema renamed = schema;
+  renamed.columnTypeMap.erase("cs");
+  renamed.columnTypeMap["ct"] = COLUMN_TYPE_STRING;
+  ASSERT(engine->createTable("t1", renamed) != 0, "%s column name mismatch accepted", phase);
+}
+
+static void run(const std::string& dir, bool checkpoint) {
+  kDir = dir;
+  std::filesystem::remove_all(kDir);
+  std::filesystem::create_directories(kDir);
+  for (int crash = 0; crash < kCrashes; crash++) {
+    writeAndCrash(crash);
+    if (checkpoint) {
+      checkTruncated();
+    }
+  }
+  {
+    auto engine = new TSDBEngineImpl(kDir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    checkCreateTable(engine, "recovered");
+    check(engine, "recovered");
+    engine->shutdown();
+    delete engine;
+  }
+  {
+    auto engine = new TSDBEngineImpl(kDir);
+    ASSERT(engine->connect() == 0, "connect failed");
+    checkCreateTable(engine, "read phase");
+    check(engine, "read phase");
+    engine->shutdown();
+    delete engine;
+  }
+}
+
+int main() {
+  setenv("LINDORM_MEMTABLE_ROW_NUM", "64", 1);
+  setenv("LINDORM_WAL", "sync", 1);
+  run("/tmp/recovery_test", false);
+
+  setenv("LINDORM_WAL_CHECKPOINT_SIZE", "64K", 1);
+  run("/tmp/recovery_checkpoint_test", true);
+
+  OUTPUT("recovery test passed\n");
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rollup.h"
+#include "test.hpp"
+
+using namespace LindormContest;
+
+static const int kColNum = 3;
+static const ColumnType kTypes[kColNum] = {COLUMN_TYPE_INTEGER, COLUMN_TYPE_DOUBLE_FLOAT, COLUMN_TYPE_STRING};
+static const int kSvidNum = 8;
+static const int64_t kResolution = 1000;
+
+// 暴力算出的一个桶
+struct Expect {
+  int64_t cnt{0};
+  MaskedAgg<int> ints;
+  MaskedAgg<double> doubles;
+};
+
+int main() {
+  std::string dir = "/tmp/rollup_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::string filename = dir + "/test.rollup";
+
+  std::mt19937_64 rng(2023);
+  Rollup rollup(kResolution, kTypes, kColNum, kSvidNum);
+  std::map<std::pair<int, int64_t>, Expect> expect;
+  IntArrWrapper ints(0);
+  DoubleArrWrapper doubles(1);
+  StringArrWrapper strs(2);
+  ColumnArrWrapper* cols[kColNum] = {&ints, &doubles, &strs};
+
+  // 模拟多次memtable下刷，时间戳基本递增，偶尔乱序写回之前的桶
+  for (int flush = 0; flush < 200; flush++) {
+    int svid = rng() % kSvidNum;
+    int n = rng() % 100 + 1;
+    std::vector<int64_t> tss(n);
+    int64_t ts = (int64_t)(rng() % 100) * 300;
+    for (int i = 0; i < n; i++) {
+      ts += rng() % 4 == 0 ? -(int64_t)(rng() % 2000) : (int64_t)(rng() % 300);
+      tss[i] = ts;
+      int iv = (int)(rng() % 2000) - 1000;
+      if (flush % 13 == 0) iv = (int)rng();
+      double dv = (double)(rng() % 400) / 8 - 25;
+      ints.Add(ColumnValue(iv), i);
+      doubles.Add(ColumnValue(dv), i);
+      strs.Add(ColumnValue(std::string(rng() % 5, 'x')), i);
+
+      int64_t bucket = ts - ((ts % kResolution) + kResolution) % kResolution;
+      Expect& e = expect[{svid, bucket}];
+      e.cnt++;
+      e.ints.cnt++;
+      e.ints.sum += iv;
+      e.ints.max = std::max(e.ints.max, iv);
+      e.ints.min = std::min(e.ints.min, iv);
+      e.doubles.cnt++;
+      e.doubles.sum += dv;
+      e.doubles.max = std::max(e.doubles.max, dv);
+      e.doubles.min = std::min(e.doubles.min, dv);
+    }
+    rollup.Add(svid, tss.data(), n, cols);
+    ints.Reset();
+    doubles.Reset();
+    strs.Reset();
+  }
+  rollup.Save(filename);
+
+  Rollup mismatch(kResolution * 2, kTypes, kColNum, kSvidNum);
+  ASSERT(!mismatch.Load(filename), "load rollup with another resolution");
+  Rollup missing(kResolution, kTypes, kColNum, kSvidNum);
+  ASSERT(!missing.Load(dir + "/missing.rollup"), "load missing rollup");
+
+  Rollup loaded(kResolution, kTypes, kColNum, kSvidNum);
+  ASSERT(loaded.Load(filename), "load rollup failed");
+  for (int round = 0; round < 1000; round++) {
+    int svid = rng() % kSvidNum;
+    int64_t lo = (int64_t)(rng() % 40) * kResolution - 5 * kResolution;
+    int64_t hi = lo + (int64_t)(rng() % 40) * kResolution;
+    int n = 0;
+    const char* rec = loaded.Find(svid, lo, hi, n);
+    auto begin = expect.lower_bound({svid, lo});
+    auto end = expect.lower_bound({svid, hi});
+    ASSERT(n == std::distance(begin, end), "svid %d [%ld, %ld) expect %ld buckets, got %d", svid, lo, hi,
+           std::distance(begin, end), n);
+    for (auto iter = begin; iter != end; ++iter, rec += loaded.Stride()) {
+      const Expect& e = iter->second;
+      ASSERT(Rollup::Ts(rec) == iter->first.second, "bucket ts expect %ld, got %ld", iter->first.second,
+             Rollup::Ts(rec));
+      ASSERT(Rollup::Cnt(rec) == e.cnt, "bucket %ld cnt expect %ld, got %ld", Rollup::Ts(rec), e.cnt, Rollup::Cnt(rec));
+      auto is = Rollup::LoadStat<int>(Rollup::Cnt(rec), loaded.Stat(rec, 0));
+      ASSERT(is.sum == e.ints.sum && is.max == e.ints.max && is.min == e.ints.min, "bucket %ld int stat mismatch",
+             Rollup::Ts(rec));
+      // double的和按照不同的分组累加，只要求相对误差足够小
+      auto ds = Rollup::LoadStat<double>(Rollup::Cnt(rec), loaded.Stat(rec, 1));
+      ASSERT(std::fabs(ds.sum - e.doubles.sum) <= 1e-9 * std::fabs(e.doubles.sum) + 1e-9,
+             "bucket %ld double sum expect %f, got %f", Rollup::Ts(rec), e.doubles.sum, ds.sum);
+      ASSERT(ds.max == e.doubles.max && ds.min == e.doubles.min, "bucket %ld double stat mismatch", Rollup::Ts(rec));
+    }
+  }
+
+  OUTPUT("rollup test passed\n");
+  return 0;
+}
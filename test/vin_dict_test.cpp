@@ -0,0 +1,71 @@
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test.hpp"
+#include "vin_dict.h"
+
+using namespace LindormContest;
+
+static void makeVin(int i, char* vin) {
+  memset(vin, 'L', VIN_LENGTH);
+  std::string s = std::to_string(i);
+  memcpy(vin + VIN_LENGTH - s.size(), s.c_str(), s.size());
+}
+
+int main() {
+  auto dict = new VinDict();
+  constexpr int kThread = 8;
+  constexpr int kNum = kVinNum - 1;
+
+  // 多线程并发插入相同的vin集合，每个vin只能分配到一个vid
+  std::vector<std::vector<uint16_t>> vids(kThread, std::vector<uint16_t>(kNum));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThread; t++) {
+    threads.emplace_back([&, t]() {
+      char vin[VIN_LENGTH];
+      for (int i = 0; i < kNum; i++) {
+        int k = (i + t * 97) % kNum;
+        makeVin(k, vin);
+        vids[t][k] = dict->GetOrInsert(vin);
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  ASSERT(dict->Size() == kNum, "size %d", dict->Size());
+  std::vector<bool> used(kNum, false);
+  char vin[VIN_LENGTH];
+  for (int i = 0; i < kNum; i++) {
+    uint16_t vid = vids[0][i];
+    for (int t = 1; t < kThread; t++) {
+      ASSERT(vids[t][i] == vid, "vin %d got different vid", i);
+    }
+    ASSERT(vid < kNum && !used[vid], "invalid vid %d", vid);
+    used[vid] = true;
+    makeVin(i, vin);
+    ASSERT(dict->Get(vin) == vid, "lookup vin %d", i);
+    ASSERT(memcmp(dict->GetVin(vid), vin, VIN_LENGTH) == 0, "vid2vin %d", vid);
+  }
+
+  // 只有最后一个字节不同的vin
+  makeVin(kNum, vin);
+  ASSERT(dict->Get(vin) == VinDict::kInvalidVid, "should not exist");
+
+  // 恢复
+  auto restored = new VinDict();
+  for (uint16_t vid = 0; vid < dict->Size(); vid++) {
+    restored->Restore(dict->GetVin(vid), vid);
+  }
+  ASSERT(restored->Size() == dict->Size(), "restored size");
+  for (int i = 0; i < kNum; i++) {
+    makeVin(i, vin);
+    ASSERT(restored->Get(vin) == dict->Get(vin), "restored vin %d", i);
+  }
+
+  delete dict;
+  delete restored;
+  OUTPUT("vin dict test passed\n");
+  return 0;
+}
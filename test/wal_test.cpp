@@ -0,0 +1,89 @@
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "coroutine/coroutine_pool.h"
+#include "io/io_manager.h"
+#include "test.hpp"
+#include "wal.h"
+
+using namespace LindormContest;
+
+static const int kColNum = 3;
+static const ColumnType kTypes[kColNum] = {COLUMN_TYPE_DOUBLE_FLOAT, COLUMN_TYPE_INTEGER, COLUMN_TYPE_STRING};
+static const std::string kNames[kColNum] = {"a", "b", "c"};
+
+static Row makeRow(int i) {
+  Row row;
+  memset(row.vin.vin, 'L', VIN_LENGTH);
+  std::string s = std::to_string(i % 97);
+  memcpy(row.vin.vin + VIN_LENGTH - s.size(), s.c_str(), s.size());
+  row.timestamp = 1000 + i;
+  row.columns.emplace(kNames[0], ColumnValue(i * 0.5));
+  row.columns.emplace(kNames[1], ColumnValue(i));
+  row.columns.emplace(kNames[2], ColumnValue(std::string(i % 13, 'a' + i % 26)));
+  return row;
+}
+
+int main() {
+  std::string dir = "/tmp/wal_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::string filename = dir + "/test.wal";
+
+  constexpr int kTask = 64;
+  constexpr int kRowsPerTask = 50;
+  {
+    // 同一个线程上的多个协程并发提交，合并成若干组落盘
+    IOManager io_mgr;
+    auto file = static_cast<AsyncWriteFile*>(io_mgr.OpenAsyncWriteFile(filename, 0, O_DSYNC));
+    WalWriter wal(file);
+    CoroutinePool pool(1, 16);
+    pool.registerPollingFunc(std::bind(&IOManager::PollingIOEvents, &io_mgr));
+    pool.start();
+    WaitGroup wg(kTask);
+    for (int t = 0; t < kTask; t++) {
+      pool.enqueue(
+        [&, t]() {
+          for (int i = 0; i < kRowsPerTask; i++) {
+            wal.Append(makeRow(t * kRowsPerTask + i));
+          }
+          wal.Sync();
+          wg.Done();
+        },
+        0);
+    }
+    wg.Wait();
+  }
+
+  // 模拟崩溃时写了一半的组
+  {
+    AppendWriteFile file(filename, NORMAL_FLAG);
+    WalGroupHeader header{WalGroupHeader::kMagic, 1000, 0, 3, 0};
+    file.write((const char*)&header, sizeof(header));
+  }
+
+  WalReader reader(filename, kColNum, kTypes, kNames);
+  std::vector<Row> rows;
+  std::vector<bool> seen(kTask * kRowsPerTask, false);
+  int groups = 0;
+  while (reader.Next(rows)) {
+    groups++;
+    for (auto& row : rows) {
+      int i = row.timestamp - 1000;
+      ASSERT(i >= 0 && i < kTask * kRowsPerTask && !seen[i], "invalid row %d", i);
+      seen[i] = true;
+      ASSERT(row == makeRow(i), "row %d mismatch", i);
+      ASSERT(row.columns == makeRow(i).columns, "row %d columns mismatch", i);
+    }
+  }
+  for (int i = 0; i < kTask * kRowsPerTask; i++) {
+    ASSERT(seen[i], "row %d lost", i);
+  }
+  ASSERT(groups <= kTask, "groups %d", groups);
+
+  std::filesystem::remove_all(dir);
+  OUTPUT("wal test passed, %d rows in %d groups\n", kTask * kRowsPerTask, groups);
+  return 0;
+}